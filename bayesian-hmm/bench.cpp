@@ -0,0 +1,118 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "core/bench.h"
+#include "core/bhmm.h"
+#include "core/corpus.h"
+#include "core/sampler.h"
+using namespace std;
+
+#define BOS_ID 0
+#define EOS_ID 1
+
+volatile uint64_t sink;
+
+// PyBayesianHMMと同じく文の前後に<bos>と<eos>を2つずつ置く
+void build_dataset(const BenchmarkCorpus &corpus, Corpus &dataset){
+	for(const auto &words: corpus._lines){
+		for(int n = 0;n < 2;n++){
+			dataset.add_word(BOS_ID, 0);
+		}
+		for(int word_id: words){
+			dataset.add_word(word_id, 0);
+		}
+		for(int n = 0;n < 2;n++){
+			dataset.add_word(EOS_ID, 0);
+		}
+		dataset.end_sentence();
+	}
+}
+BayesianHMM* build_model(const BenchmarkCorpus &corpus, Corpus &dataset, int num_tags){
+	Sampler::set_seed(0);
+	BayesianHMM* hmm = new BayesianHMM();
+	hmm->_num_tags = num_tags;
+	hmm->initialize(dataset);
+	for(int tag = 0;tag < num_tags;tag++){
+		hmm->set_Wt_for_tag(tag, corpus._num_word_types);
+	}
+	hmm->update_lookup_tables();
+	return hmm;
+}
+void add_params(BenchmarkResult &result, const BenchmarkCorpus &corpus, int num_tags){
+	result.add_param("corpus", corpus._name);
+	result.add_param("num_tags", num_tags);
+	result.add_param("mean_line_length", corpus.get_mean_line_length());
+	result.add_param("num_words", (int)corpus.get_num_words());
+}
+// 1回で1文をサンプリングし、次は続きの文から始める
+// <bos>と<eos>は数えない
+void bench_gibbs_sampling(Benchmark &bench, const BenchmarkCorpus &corpus, int num_tags){
+	Corpus dataset;
+	build_dataset(corpus, dataset);
+	BayesianHMM* hmm = build_model(corpus, dataset, num_tags);
+	BenchmarkResult result("BayesianHMM::perform_gibbs_sampling_with_line", "token");
+	add_params(result, corpus, num_tags);
+	int data_index = 0;
+	bench.measure(result, [&](){
+		Sentence line = dataset[data_index];
+		hmm->perform_gibbs_sampling_with_line(line);
+		data_index = (data_index + 1) % dataset.size();
+		return (uint64_t)(line.size() - 4);
+	});
+	delete hmm;
+}
+// 学習中と同じく、引く単語はコーパス中の頻度に従う
+// 品詞は半分を今割り当てられているもの、残りを一様に選ぶので、カウントが0の組も引く
+void bench_get_count_for_tag_word(Benchmark &bench, const BenchmarkCorpus &corpus, int num_tags){
+	Corpus dataset;
+	build_dataset(corpus, dataset);
+	BayesianHMM* hmm = build_model(corpus, dataset, num_tags);
+	mt19937 mt(0);
+	uniform_int_distribution<size_t> position(0, dataset.get_num_words() - 1);
+	uniform_int_distribution<int> tag(0, num_tags - 1);
+	vector<pair<int, int>> queries(1 << 16);
+	for(int n = 0;n < queries.size();n++){
+		size_t pos = position(mt);
+		queries[n].first = (n % 2 == 0) ? dataset._tag_ids[pos] : tag(mt);
+		queries[n].second = dataset._word_ids[pos];
+	}
+	BenchmarkResult result("BayesianHMM::get_count_for_tag_word", "lookup");
+	add_params(result, corpus, num_tags);
+	bench.measure(result, [&](){
+		uint64_t sum = 0;
+		for(const auto &query: queries){
+			sum += hmm->get_count_for_tag_word(query.first, query.second);
+		}
+		sink = sum;
+		return (uint64_t)queries.size();
+	});
+	delete hmm;
+}
+// usage: ./model.bench <テキストファイル> <出力するJSON> [1試行の秒数]
+int main(int argc, char** argv){
+	if(argc < 3){
+		cerr << "usage: " << argv[0] << " <textfile> <output.json> [min_seconds]" << endl;
+		return 1;
+	}
+	Benchmark bench;
+	if(argc > 3){
+		bench._min_seconds = atof(argv[3]);
+	}
+	vector<BenchmarkCorpus> corpora;
+	corpora.push_back(BenchmarkCorpus::load_textfile(argv[1], EOS_ID + 1));
+	for(int line_length: {10, 30, 100}){
+		corpora.push_back(BenchmarkCorpus::generate(30000, line_length, 5000, EOS_ID + 1));
+	}
+	for(const auto &corpus: corpora){
+		for(int num_tags: {10, 20, 45, 150}){
+			bench_gibbs_sampling(bench, corpus, num_tags);
+			bench_get_count_for_tag_word(bench, corpus, num_tags);
+		}
+	}
+	if(bench.write_json(argv[2], BENCH_REVISION) == false){
+		c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sに書き込めません.") % argv[2]).str().c_str());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,92 @@
+#ifndef _alias_
+#define _alias_
+#include <cassert>
+#include <vector>
+using namespace std;
+
+// Walkerのエイリアス法によるO(1)サンプリング
+// 構築時の重みを覚えておき、MH法の提案分布の確率として使う
+class AliasTable{
+public:
+	int _size;
+	int _num_draws;		// 構築してから引いた回数
+	double _sum;
+	vector<double> _weights;
+	vector<double> _prob;
+	vector<int> _alias;
+	vector<int> _small;	// 構築用の作業領域
+	vector<int> _large;
+	AliasTable(){
+		_size = 0;
+		_num_draws = 0;
+		_sum = 0;
+	}
+	// Voseの方法で構築
+	void build(const double* weights, int size){
+		assert(size > 0);
+		_size = size;
+		_num_draws = 0;
+		_weights.assign(weights, weights + size);
+		_prob.resize(size);
+		_alias.resize(size);
+		_small.clear();
+		_large.clear();
+		_sum = 0;
+		for(int k = 0;k < size;k++){
+			_sum += weights[k];
+		}
+		assert(_sum > 0);
+		for(int k = 0;k < size;k++){
+			_prob[k] = weights[k] * size / _sum;
+			if(_prob[k] < 1){
+				_small.push_back(k);
+			}else{
+				_large.push_back(k);
+			}
+		}
+		while(_small.empty() == false && _large.empty() == false){
+			int s = _small.back();
+			_small.pop_back();
+			int l = _large.back();
+			_alias[s] = l;
+			_prob[l] -= 1 - _prob[s];
+			if(_prob[l] < 1){
+				_large.pop_back();
+				_small.push_back(l);
+			}
+		}
+		// 丸め誤差で残ったものは確率1にしておく
+		for(int k: _small){
+			_prob[k] = 1;
+			_alias[k] = k;
+		}
+		for(int k: _large){
+			_prob[k] = 1;
+			_alias[k] = k;
+		}
+	}
+	// u1, u2は[0, 1)の一様乱数
+	int sample(double u1, double u2){
+		assert(_size > 0);
+		_num_draws += 1;
+		int k = (int)(u1 * _size);
+		if(k >= _size){
+			k = _size - 1;
+		}
+		if(u2 < _prob[k]){
+			return k;
+		}
+		return _alias[k];
+	}
+	// 構築時の重みでの確率
+	double get_probability(int k){
+		return _weights[k] / _sum;
+	}
+	// 要素数と同じ回数だけ引いたら作り直す
+	// 構築のO(K)が1回あたりO(1)に償却される
+	bool is_stale(){
+		return _size == 0 || _num_draws >= _size;
+	}
+};
+
+#endif
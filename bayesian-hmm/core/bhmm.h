@@ -8,18 +8,26 @@
 #include <boost/format.hpp>
 #include <cassert>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
 #include <unordered_map>
 #include <set>
+#include <vector>
+#include "alias.h"
+#include "cache.h"
+#include "corpus.h"
 #include "cprintf.h"
+#include "emission.h"
+#include "kernel.h"
+#include "lookup.h"
 #include "sampler.h"
-#include "util.h"
+#include "stats.h"
+#include "trigram.h"
 using namespace std;
 
-typedef struct Word {
-	int word_id;
-	int tag_id;
-} Word;
-
 class BayesianHMM{
 private:
 	friend class boost::serialization::access;
@@ -37,21 +45,40 @@ private:
 public:
 	int _num_tags;	// 品詞数
 	int _num_words;		// 単語数
-	int*** _trigram_counts;	// 品詞3-gramのカウント
-	int** _bigram_counts;	// 品詞2-gramのカウント
+	int* _ngram_counts;		// 2-gram, 1-gramのカウントをまとめて確保した連続領域
+	int _ngram_counts_size;	// _ngram_countsの要素数
+	TrigramCounts _trigram_counts;	// 品詞3-gramのカウント [t_{i-2}][t_{i-1}][t_i]
+	int* _bigram_counts;	// 品詞2-gramのカウント [t_{i-1}][t_i]
 	int* _unigram_counts;	// 品詞1-gramのカウント
 	int* _Wt;
-	unordered_map<int, unordered_map<int, int>> _tag_word_counts;	// 品詞と単語のペアの出現頻度
+	EmissionCounts _tag_word_counts;	// 品詞と単語のペアの出現頻度
 	double* _sampling_table;	// キャッシュ
+	int* _word_row_buffer;	// 疎な単語の行を展開するためのキャッシュ
+	SamplingTableFunction _compute_sampling_table_annealed;	// 品詞数に合わせて選んだもの
+	SamplingTableFunction _compute_sampling_table_unit;		// 温度が1の時に使う
+	bool _use_mh_sampler;	// trueならエイリアス法の提案分布とMH法で品詞をサンプリングする
+	int _num_mh_steps;
+	vector<AliasTable> _word_alias_tables;		// 単語ごとの品詞の提案分布
+	vector<AliasTable> _context_alias_tables;	// [t_{i-2}][t_{i-1}]ごとの品詞の提案分布
 	double _alpha;
 	double* _beta;
+	LogTable _log_alpha_table;			// log(n + alpha)
+	vector<LogTable> _log_beta_tables;	// 品詞ごとのlog(n + beta_t)
 	double _temperature;
 	double _minimum_temperature;
+	SamplerStats* _stats;	// 計測しないならNULL
 	BayesianHMM(){
-		_trigram_counts = NULL;
+		_ngram_counts = NULL;
+		_ngram_counts_size = 0;
 		_bigram_counts = NULL;
 		_unigram_counts = NULL;
 		_sampling_table = NULL;
+		_word_row_buffer = NULL;
+		_stats = NULL;
+		_compute_sampling_table_annealed = NULL;
+		_compute_sampling_table_unit = NULL;
+		_use_mh_sampler = false;
+		_num_mh_steps = 2;
 		_Wt = NULL;
 		_num_tags = -1;
 		_num_words = -1;
@@ -61,27 +88,15 @@ public:
 		_minimum_temperature = 1;
 	}
 	~BayesianHMM(){
-		if(_trigram_counts != NULL){
-			for(int tri_tag = 0;tri_tag < _num_tags;tri_tag++){
-				for(int bi_tag = 0;bi_tag < _num_tags;bi_tag++){
-					free(_trigram_counts[tri_tag][bi_tag]);
-				}
-				free(_trigram_counts[tri_tag]);
-			}
-			free(_trigram_counts);
-		}
-		if(_bigram_counts != NULL){
-			for(int bi_tag = 0;bi_tag < _num_tags;bi_tag++){
-				free(_bigram_counts);
-			}
-			free(_bigram_counts);
-		}
-		if(_unigram_counts != NULL){
-			free(_unigram_counts);
+		if(_ngram_counts != NULL){
+			free(_ngram_counts);
 		}
 		if(_sampling_table != NULL){
 			free(_sampling_table);
 		}
+		if(_word_row_buffer != NULL){
+			free(_word_row_buffer);
+		}
 		if(_beta != NULL){
 			free(_beta);
 		}
@@ -94,7 +109,7 @@ public:
 			_temperature *= multiplier;
 		}
 	}
-	void initialize(vector<vector<Word*>> &dataset){
+	void initialize(Corpus &dataset){
 		// その他
 		alloc_table();
 		// nグラムのカウントテーブル
@@ -102,6 +117,17 @@ public:
 	}
 	void alloc_table(){
 		assert(_num_tags != -1);
+		// 初期化や読み込みのたびに呼ばれるので、前に確保したものは捨てる
+		if(_Wt != NULL){
+			free(_Wt);
+		}
+		if(_beta != NULL){
+			free(_beta);
+		}
+		if(_ngram_counts != NULL){
+			free(_ngram_counts);
+			_ngram_counts = NULL;
+		}
 		// 各タグの可能な単語数
 		_Wt = (int*)calloc(_num_tags, sizeof(int));
 		// Betaの初期化
@@ -110,69 +136,128 @@ public:
 		for(int tag = 0;tag < _num_tags;tag++){
 			_beta[tag] = 1;
 		}
-		// 3-gram		
-		_trigram_counts = (int***)malloc(_num_tags * sizeof(int**));
-		for(int tri_tag = 0;tri_tag < _num_tags;tri_tag++){
-			_trigram_counts[tri_tag] = (int**)malloc(_num_tags * sizeof(int*));
-			for(int bi_tag = 0;bi_tag < _num_tags;bi_tag++){
-				_trigram_counts[tri_tag][bi_tag] = (int*)calloc(_num_tags, sizeof(int));
-			}
+		// 品詞数ぶんの作業領域は品詞数が変わっているかもしれないので捨て、次に使う時に確保し直す
+		if(_sampling_table != NULL){
+			free(_sampling_table);
+			_sampling_table = NULL;
 		}
-		// 2-gram
-		_bigram_counts = (int**)malloc(_num_tags * sizeof(int*));
-		for(int bi_tag = 0;bi_tag < _num_tags;bi_tag++){
-			_bigram_counts[bi_tag] = (int*)calloc(_num_tags, sizeof(int));
+		if(_word_row_buffer != NULL){
+			free(_word_row_buffer);
+			_word_row_buffer = NULL;
 		}
-		// 1-gram
-		_unigram_counts = (int*)calloc(_num_tags, sizeof(int));
+		// 3-gramは品詞数によって密な表現かブロック表現かを選ぶ
+		int K = _num_tags;
+		_trigram_counts.init(K);
+		// 2-gramと1-gramのカウントは1つの連続領域に確保する
+		// [2-gram][1-gram]の順に並べる
+		_ngram_counts_size = K * K + K;
+		void* ptr = NULL;
+		if(posix_memalign(&ptr, 64, _ngram_counts_size * sizeof(int)) != 0){
+			c_printf("[r]%s [*]%s\n", "エラー", "nグラムのカウントテーブルを確保できません.");
+			exit(1);
+		}
+		_ngram_counts = (int*)ptr;
+		memset(_ngram_counts, 0, _ngram_counts_size * sizeof(int));
+		_bigram_counts = _ngram_counts;
+		_unigram_counts = _bigram_counts + K * K;
+		// 品詞-単語ペア
+		if(_tag_word_counts._num_tags != K){
+			_tag_word_counts.init(K);
+		}
+		select_sampling_functions();
+	}
+	// 品詞数が決まった時点でサンプリングに使う関数を選ぶ
+	void select_sampling_functions(){
+		assert(_num_tags != -1);
+		_compute_sampling_table_annealed = SamplingKernel::select(_num_tags, true);
+		_compute_sampling_table_unit = SamplingKernel::select(_num_tags, false);
 	}
-	void init_ngram_counts(vector<vector<Word*>> &dataset){
+	// 3-gramの[t_{i-2}][t_{i-1}][*]
+	// ブロック表現では向きごとの作業領域に展開したものを返すので、同じ向きの行を次に読むまでに使い終えること
+	inline const int* trigram_row(int ti_2, int ti_1){
+		return _trigram_counts.row(ti_2, ti_1);
+	}
+	// 3-gramの[t_{i-1}][*][t_{i+1}]
+	inline const int* trigram_column(int ti_1, int ti1){
+		return _trigram_counts.column(ti_1, ti1);
+	}
+	// 3-gramの[*][t_{i+1}][t_{i+2}]
+	// 要素の間隔は_trigram_counts.first_axis_stride()
+	inline const int* trigram_first_axis(int ti1, int ti2){
+		return _trigram_counts.first_axis(ti1, ti2);
+	}
+	// 2-gramの[t_{i-1}][*]
+	inline int* bigram_row(int ti_1){
+		return _bigram_counts + ti_1 * _num_tags;
+	}
+	inline int get_trigram_count(int ti_2, int ti_1, int ti){
+		return _trigram_counts.get_count(ti_2, ti_1, ti);
+	}
+	inline int get_bigram_count(int ti_1, int ti){
+		return _bigram_counts[ti_1 * _num_tags + ti];
+	}
+	inline void increment_trigram_count(int ti_2, int ti_1, int ti){
+		_trigram_counts.increment(ti_2, ti_1, ti);
+	}
+	inline void decrement_trigram_count(int ti_2, int ti_1, int ti){
+		_trigram_counts.decrement(ti_2, ti_1, ti);
+	}
+	inline void increment_bigram_count(int ti_1, int ti){
+		_bigram_counts[ti_1 * _num_tags + ti] += 1;
+	}
+	inline void decrement_bigram_count(int ti_1, int ti){
+		int &count = _bigram_counts[ti_1 * _num_tags + ti];
+		count -= 1;
+		assert(count >= 0);
+	}
+	void init_ngram_counts(Corpus &dataset){
 		c_printf("[*]%s\n", "n-gramモデルを構築してます ...");
 		assert(_num_tags != -1);
 		// 最初は品詞をランダムに割り当てる
 		set<int> word_set;
 		unordered_map<int, int> tag_for_word;
 		for(int data_index = 0;data_index < dataset.size();data_index++){
-			vector<Word*> &line = dataset[data_index];
+			Sentence line = dataset[data_index];
 			// pos < 2
 			// <bos>2つ
-			_bigram_counts[line[0]->tag_id][line[1]->tag_id] += 1;
-			_unigram_counts[line[0]->tag_id] += 1;
-			_unigram_counts[line[1]->tag_id] += 1;
-			word_set.insert(line[0]->word_id);
-			word_set.insert(line[1]->word_id);
-			increment_tag_word_count(line[0]->tag_id, line[0]->word_id);
-			increment_tag_word_count(line[1]->tag_id, line[1]->word_id);
+			increment_bigram_count(line.tag_id(0), line.tag_id(1));
+			_unigram_counts[line.tag_id(0)] += 1;
+			_unigram_counts[line.tag_id(1)] += 1;
+			word_set.insert(line.word_id(0));
+			word_set.insert(line.word_id(1));
+			increment_tag_word_count(line.tag_id(0), line.word_id(0));
+			increment_tag_word_count(line.tag_id(1), line.word_id(1));
 			// line.size() - 2 > pos >= 2
 			for(int pos = 2;pos < line.size() - 2;pos++){	// 3-gramなので3番目から.
-				Word* word = line[pos];
-				auto itr = tag_for_word.find(word->word_id);
+				int word_id = line.word_id(pos);
+				int &tag_id = line.tag_id(pos);
+				auto itr = tag_for_word.find(word_id);
 				if(itr == tag_for_word.end()){
-					word->tag_id = Sampler::uniform_int(0, _num_tags - 1);
-					tag_for_word[word->word_id] = word->tag_id;
+					tag_id = Sampler::uniform_int(0, _num_tags - 1);
+					tag_for_word[word_id] = tag_id;
 				}else{
-					word->tag_id = itr->second;
+					tag_id = itr->second;
 				}
-				update_ngram_count(line[pos - 2], line[pos - 1], line[pos]);
-				word_set.insert(word->word_id);
+				update_ngram_count(line.tag_id(pos - 2), line.tag_id(pos - 1), tag_id);
+				word_set.insert(word_id);
 				// 同じタグの単語集合をカウント
-				increment_tag_word_count(word->tag_id, word->word_id);
+				increment_tag_word_count(tag_id, word_id);
 			}
 			// pos >= line.size() - 2
 			// <eos>2つ
 			int end_index = line.size() - 1;
-			int t_end = line[end_index]->tag_id;
-			int t_end_1 = line[end_index - 1]->tag_id;
-			int t_end_2 = line[end_index - 2]->tag_id;
-			int t_end_3 = line[end_index - 3]->tag_id;
+			int t_end = line.tag_id(end_index);
+			int t_end_1 = line.tag_id(end_index - 1);
+			int t_end_2 = line.tag_id(end_index - 2);
+			int t_end_3 = line.tag_id(end_index - 3);
 			_unigram_counts[t_end] += 1;
 			_unigram_counts[t_end_1] += 1;
-			_bigram_counts[t_end_2][t_end_1] += 1;
-			_bigram_counts[t_end_1][t_end] += 1;
-			_trigram_counts[t_end_3][t_end_2][t_end_1] += 1;
-			_trigram_counts[t_end_2][t_end_1][t_end] += 1;
-			int w_end = line[end_index]->word_id;
-			int w_end_1 = line[end_index - 1]->word_id;
+			increment_bigram_count(t_end_2, t_end_1);
+			increment_bigram_count(t_end_1, t_end);
+			increment_trigram_count(t_end_3, t_end_2, t_end_1);
+			increment_trigram_count(t_end_2, t_end_1, t_end);
+			int w_end = line.word_id(end_index);
+			int w_end_1 = line.word_id(end_index - 1);
 			word_set.insert(w_end);
 			word_set.insert(w_end_1);
 			increment_tag_word_count(t_end, w_end);
@@ -181,81 +266,182 @@ public:
 		_num_words = word_set.size();
 		c_printf("[*]%s\n", (boost::format("単語数: %d - 行数: %d") % _num_words % dataset.size()).str().c_str());
 	}
+	// 並列サンプリング用
+	// sourceのハイパーパラメータとカウントを全て複製する
+	void copy_state_from(BayesianHMM* source){
+		if(_ngram_counts == NULL){
+			_num_tags = source->_num_tags;
+			alloc_table();
+		}
+		assert(_num_tags == source->_num_tags);
+		copy_hyperparameters_from(source);
+		memcpy(_ngram_counts, source->_ngram_counts, _ngram_counts_size * sizeof(int));
+		_trigram_counts = source->_trigram_counts;
+		_tag_word_counts = source->_tag_word_counts;
+	}
+	// カウント以外の品詞数ぶんの値だけを複製する
+	void copy_hyperparameters_from(BayesianHMM* source){
+		assert(_num_tags == source->_num_tags);
+		_num_words = source->_num_words;
+		_alpha = source->_alpha;
+		_temperature = source->_temperature;
+		_minimum_temperature = source->_minimum_temperature;
+		_use_mh_sampler = source->_use_mh_sampler;
+		_num_mh_steps = source->_num_mh_steps;
+		memcpy(_beta, source->_beta, _num_tags * sizeof(double));
+		memcpy(_Wt, source->_Wt, _num_tags * sizeof(int));
+	}
+	// 文の品詞がold_tag_idsから今のlineの品詞に変わった分だけカウントを直す
+	// 品詞が変わった位置を含むnグラムと、その位置の品詞-単語ペアだけを書き換える
+	// 古い品詞のカウントは必ず残っているので、途中でカウントが負になることはない
+	void replace_tags_of_line(Sentence &line, int* old_tag_ids){
+		Sentence old_line(line._word_ids, old_tag_ids, line.size());
+		for(int pos = 0;pos < line.size();pos++){
+			bool unigram_changed = old_line.tag_id(pos) != line.tag_id(pos);
+			bool bigram_changed = unigram_changed || (pos >= 1 && old_line.tag_id(pos - 1) != line.tag_id(pos - 1));
+			bool trigram_changed = bigram_changed || (pos >= 2 && old_line.tag_id(pos - 2) != line.tag_id(pos - 2));
+			if(trigram_changed == false){
+				continue;
+			}
+			if(unigram_changed){
+				_unigram_counts[old_line.tag_id(pos)] -= 1;
+				assert(_unigram_counts[old_line.tag_id(pos)] >= 0);
+				_unigram_counts[line.tag_id(pos)] += 1;
+				decrement_tag_word_count(old_line.tag_id(pos), line.word_id(pos));
+				increment_tag_word_count(line.tag_id(pos), line.word_id(pos));
+			}
+			if(pos >= 1 && bigram_changed){
+				decrement_bigram_count(old_line.tag_id(pos - 1), old_line.tag_id(pos));
+				increment_bigram_count(line.tag_id(pos - 1), line.tag_id(pos));
+			}
+			if(pos >= 2){
+				decrement_trigram_count(old_line.tag_id(pos - 2), old_line.tag_id(pos - 1), old_line.tag_id(pos));
+				increment_trigram_count(line.tag_id(pos - 2), line.tag_id(pos - 1), line.tag_id(pos));
+			}
+		}
+	}
 	void set_Wt_for_tag(int tag_id, int number){
 		assert(_Wt != NULL);
 		assert(tag_id < _num_tags);
 		_Wt[tag_id] = number;
 	}
-	void update_ngram_count(Word* tri_word, Word* bi_word, Word* uni_word){
-		_trigram_counts[tri_word->tag_id][bi_word->tag_id][uni_word->tag_id] += 1;
-		_bigram_counts[bi_word->tag_id][uni_word->tag_id] += 1;
-		_unigram_counts[uni_word->tag_id] += 1;
+	void update_ngram_count(int ti_2, int ti_1, int ti){
+		increment_trigram_count(ti_2, ti_1, ti);
+		increment_bigram_count(ti_1, ti);
+		_unigram_counts[ti] += 1;
 	}
 	void increment_tag_word_count(int tag_id, int word_id){
-		unordered_map<int, int> &word_counts = _tag_word_counts[tag_id];
-		auto itr = word_counts.find(word_id);
-		if(itr == word_counts.end()){
-			word_counts[word_id] = 1;
-			return;
-		}
-		itr->second += 1;
+		_tag_word_counts.increment(tag_id, word_id);
 	}
 	void decrement_tag_word_count(int tag_id, int word_id){
-		unordered_map<int, int> &word_counts = _tag_word_counts[tag_id];
-		auto itr = word_counts.find(word_id);
-		if(itr == word_counts.end()){
-			c_printf("[R]%s [*]%s", "エラー", "品詞-単語ペアのカウントが正しく実装されていません.");
-			exit(1);
-		}
-		itr->second -= 1;
-		if(itr->second <= 0){
-			word_counts.erase(itr);
-		}
+		_tag_word_counts.decrement(tag_id, word_id);
 	}
 	int get_count_for_tag_word(int tag_id, int word_id){
-		unordered_map<int, int> &word_counts = _tag_word_counts[tag_id];
-		auto itr = word_counts.find(word_id);
-		if(itr == word_counts.end()){
-			return 0;
+		return _tag_word_counts.get_count(tag_id, word_id);
+	}
+	// 単語word_idの全品詞についてのカウント
+	const int* get_counts_for_word(int word_id){
+		if(_word_row_buffer == NULL){
+			_word_row_buffer = (int*)malloc(_num_tags * sizeof(int));
 		}
-		return itr->second;
+		return _tag_word_counts.get_row(word_id, _word_row_buffer);
 	}
 	int get_word_types_for_tag(int tag_id){
-		unordered_map<int, int> &word_counts = _tag_word_counts[tag_id];
-		return word_counts.size();
+		return _tag_word_counts.get_word_types_for_tag(tag_id);
 	}
-	double compute_log_Pt_alpha(vector<Word*> &line, double alpha){
-		double log_Pt_alpha = 0;
-		for(int pos = 2;pos < line.size() - 2;pos++){	// <bos>と<eos>の内側だけ考える
-			int ti_2 = line[pos - 2]->tag_id;
-			int ti_1 = line[pos - 1]->tag_id;
-			int ti = line[pos]->tag_id;
-			double n_ti_2_ti_1_ti = _trigram_counts[ti_2][ti_1][ti];
-			double n_ti_2_ti_1 = _bigram_counts[ti_2][ti_1];
-			double Pt_i_alpha = (n_ti_2_ti_1_ti + alpha) / (n_ti_2_ti_1 + _num_tags * alpha);
-			log_Pt_alpha += log(Pt_i_alpha);
+	// 対数の表を今のハイパーパラメータに合わせる
+	// 値が変わっていない表は作り直さない
+	void update_lookup_tables(){
+		_log_alpha_table.update(_alpha);
+		if(_log_beta_tables.size() != _num_tags){
+			// 品詞と単語のペアのカウントは小さいので表も小さくてよい
+			_log_beta_tables.assign(_num_tags, LogTable(256));
+		}
+		for(int tag = 0;tag < _num_tags;tag++){
+			_log_beta_tables[tag].update(_beta[tag]);
 		}
-		return log_Pt_alpha;
 	}
-	double compute_log_Pw_t_alpha(vector<Word*> &line, double alpha){
+	// 品詞列の周辺尤度 log P(t|alpha)
+	// 各文脈[t_{i-2}][t_{i-1}]ごとのディリクレ-多項分布の積をカウントから直接計算する
+	// カウントの値ごとにまとめたヒストグラムを受け取るのでlgammaの呼び出しは異なる値の数だけで済む
+	double compute_log_Pt_alpha(double alpha, const vector<pair<int, int>> &trigram_histogram, const vector<pair<int, int>> &context_histogram){
 		double log_Pt_alpha = 0;
-		for(int pos = 2;pos < line.size() - 2;pos++){	// <bos>と<eos>の内側だけ考える
-			int ti_2 = line[pos - 2]->tag_id;
-			int ti_1 = line[pos - 1]->tag_id;
-			int ti = line[pos]->tag_id;
-			double n_ti_2_ti_1_ti = _trigram_counts[ti_2][ti_1][ti];
-			double n_ti_2_ti_1 = _bigram_counts[ti_2][ti_1];
-			double Pt_i_alpha = (n_ti_2_ti_1_ti + alpha) / (n_ti_2_ti_1 + _num_tags * alpha);
-			log_Pt_alpha += log(Pt_i_alpha);
+		double lgamma_alpha = lgamma(alpha);
+		for(const auto &elem: trigram_histogram){
+			log_Pt_alpha += elem.second * (lgamma(elem.first + alpha) - lgamma_alpha);
+		}
+		double lgamma_K_alpha = lgamma(_num_tags * alpha);
+		for(const auto &elem: context_histogram){
+			log_Pt_alpha += elem.second * (lgamma_K_alpha - lgamma(elem.first + _num_tags * alpha));
 		}
 		return log_Pt_alpha;
 	}
-	// 正規化定数で割る前の値
-	double compute_Pti_wi_beta(int ti, int wi, double beta){
-		double n_ti_wi = get_count_for_tag_word(ti, wi);
-		double n_ti = _unigram_counts[ti];
-		double W_ti = _Wt[ti];
-		return (n_ti_wi + beta) / (n_ti + W_ti * beta);
+	// 品詞tagから生成された単語列の周辺尤度 log P(w|t,beta)
+	double compute_log_Pw_t_beta(int tag, double beta, const vector<pair<int, int>> &word_histogram){
+		double log_Pw_t_beta = 0;
+		double lgamma_beta = lgamma(beta);
+		int n_t = 0;
+		for(const auto &elem: word_histogram){
+			log_Pw_t_beta += elem.second * (lgamma(elem.first + beta) - lgamma_beta);
+			n_t += elem.first * elem.second;
+		}
+		double W_t_beta = _Wt[tag] * beta;
+		log_Pw_t_beta += lgamma(W_t_beta) - lgamma(n_t + W_t_beta);
+		return log_Pw_t_beta;
+	}
+	// 3-gramのカウントと文脈ごとの合計をヒストグラムにする
+	void build_trigram_histograms(vector<pair<int, int>> &trigram_histogram, vector<pair<int, int>> &context_histogram){
+		map<int, int> trigram_map;
+		map<int, int> context_map;
+		int K = _num_tags;
+		_trigram_counts.enumerate_rows([&](int context, const int* row){
+			int sum = 0;
+			for(int tag = 0;tag < K;tag++){
+				if(row[tag] > 0){
+					trigram_map[row[tag]] += 1;
+					sum += row[tag];
+				}
+			}
+			if(sum > 0){
+				context_map[sum] += 1;
+			}
+		});
+		trigram_histogram.assign(trigram_map.begin(), trigram_map.end());
+		context_histogram.assign(context_map.begin(), context_map.end());
+	}
+	// 品詞ごとに単語のカウントをヒストグラムにする
+	void build_word_histograms(vector<vector<pair<int, int>>> &word_histograms){
+		vector<map<int, int>> word_maps(_num_tags);
+		_tag_word_counts.enumerate_counts([&word_maps](int tag_id, int count){
+			word_maps[tag_id][count] += 1;
+		});
+		word_histograms.resize(_num_tags);
+		for(int tag = 0;tag < _num_tags;tag++){
+			word_histograms[tag].assign(word_maps[tag].begin(), word_maps[tag].end());
+		}
+	}
+	// 品詞列と単語列の同時確率 log P(t,w|alpha,beta)
+	double compute_log_Pdata(){
+		vector<pair<int, int>> trigram_histogram;
+		vector<pair<int, int>> context_histogram;
+		build_trigram_histograms(trigram_histogram, context_histogram);
+		double log_Pdata = compute_log_Pt_alpha(_alpha, trigram_histogram, context_histogram);
+		vector<vector<pair<int, int>>> word_histograms;
+		build_word_histograms(word_histograms);
+		for(int tag = 0;tag < _num_tags;tag++){
+			if(_Wt[tag] <= 0){
+				continue;
+			}
+			log_Pdata += compute_log_Pw_t_beta(tag, _beta[tag], word_histograms[tag]);
+		}
+		return log_Pdata;
+	}
+	// 提案分布は標準偏差が現在の値の0.1倍の正規分布なので対称ではない
+	// log q(x|new_x) - log q(new_x|x)を返す
+	double compute_log_correcting_term(double x, double new_x){
+		double var_x = 0.01 * x * x;
+		double var_new_x = 0.01 * new_x * new_x;
+		return log(x / new_x) - 0.5 * (x - new_x) * (x - new_x) / var_new_x + 0.5 * (new_x - x) * (new_x - x) / var_x;
 	}
 	// in:  t_{i-2},t_{i-1},ti,t_{i+1},t_{i+2},w_i
 	// out: void
@@ -263,12 +449,12 @@ public:
 		// 1-gram
 		_unigram_counts[ti] += 1;
 		// 2-gram
-		_bigram_counts[ti_1][ti] += 1;
-		_bigram_counts[ti][ti1] += 1;
+		increment_bigram_count(ti_1, ti);
+		increment_bigram_count(ti, ti1);
 		// 3-gram
-		_trigram_counts[ti_2][ti_1][ti] += 1;
-		_trigram_counts[ti_1][ti][ti1] += 1;
-		_trigram_counts[ti][ti1][ti2] += 1;
+		increment_trigram_count(ti_2, ti_1, ti);
+		increment_trigram_count(ti_1, ti, ti1);
+		increment_trigram_count(ti, ti1, ti2);
 		// 品詞-単語ペア
 		increment_tag_word_count(ti, wi);
 	}
@@ -279,82 +465,256 @@ public:
 		_unigram_counts[ti] -= 1;
 		assert(_unigram_counts[ti] >= 0);
 		// 2-gram
-		_bigram_counts[ti_1][ti] -= 1;
-		assert(_bigram_counts[ti_1][ti] >= 0);
-		_bigram_counts[ti][ti1] -= 1;
-		assert(_bigram_counts[ti][ti1] >= 0);
+		decrement_bigram_count(ti_1, ti);
+		decrement_bigram_count(ti, ti1);
 		// 3-gram
-		_trigram_counts[ti_2][ti_1][ti] -= 1;
-		assert(_trigram_counts[ti_2][ti_1][ti] >= 0);
-		_trigram_counts[ti_1][ti][ti1] -= 1;
-		assert(_trigram_counts[ti_1][ti][ti1] >= 0);
-		_trigram_counts[ti][ti1][ti2] -= 1;
-		assert(_trigram_counts[ti][ti1][ti2] >= 0);
+		decrement_trigram_count(ti_2, ti_1, ti);
+		decrement_trigram_count(ti_1, ti, ti1);
+		decrement_trigram_count(ti, ti1, ti2);
 		// 品詞-単語ペア
 		decrement_tag_word_count(ti, wi);
 	}
-	void perform_gibbs_sampling_with_line(vector<Word*> &line){
+	// 文の位置posのカウントを追加・除去する
+	// <bos>と<eos>も含め、全ての位置は1-gramと品詞-単語ペアを、pos >= 1は2-gramを、pos >= 2は3-gramを持つ
+	void increment_counts_at(Sentence &line, int pos){
+		int ti = line.tag_id(pos);
+		_unigram_counts[ti] += 1;
+		increment_tag_word_count(ti, line.word_id(pos));
+		if(pos >= 1){
+			increment_bigram_count(line.tag_id(pos - 1), ti);
+		}
+		if(pos >= 2){
+			increment_trigram_count(line.tag_id(pos - 2), line.tag_id(pos - 1), ti);
+		}
+	}
+	void decrement_counts_at(Sentence &line, int pos){
+		int ti = line.tag_id(pos);
+		_unigram_counts[ti] -= 1;
+		assert(_unigram_counts[ti] >= 0);
+		decrement_tag_word_count(ti, line.word_id(pos));
+		if(pos >= 1){
+			decrement_bigram_count(line.tag_id(pos - 1), ti);
+		}
+		if(pos >= 2){
+			decrement_trigram_count(line.tag_id(pos - 2), line.tag_id(pos - 1), ti);
+		}
+	}
+	void add_line_to_model_parameters(Sentence &line){
+		for(int pos = 0;pos < line.size();pos++){
+			increment_counts_at(line, pos);
+		}
+	}
+	void remove_line_from_model_parameters(Sentence &line){
+		for(int pos = 0;pos < line.size();pos++){
+			decrement_counts_at(line, pos);
+		}
+	}
+	// 文を除いたカウントから、文の品詞列を先頭から1つずつ生成する確率の対数
+	// 各位置の確率を計算してからその位置のカウントを追加するので、終わると文のカウントは全て追加されている
+	double add_line_and_compute_log_Pline(Sentence &line){
+		double log_Pline = 0;
+		for(int pos = 0;pos < line.size();pos++){
+			if(pos >= 2){
+				int ti_2 = line.tag_id(pos - 2);
+				int ti_1 = line.tag_id(pos - 1);
+				int ti = line.tag_id(pos);
+				double Pt = (get_trigram_count(ti_2, ti_1, ti) + _alpha) / (get_bigram_count(ti_2, ti_1) + _num_tags * _alpha);
+				log_Pline += log(Pt) + log(compute_Ptag_emission(ti, line.word_id(pos)));
+			}
+			increment_counts_at(line, pos);
+		}
+		return log_Pline;
+	}
+	// 新しく来た文の品詞を先頭から1つずつ今のカウントで引きながらカウントを追加する
+	// 右の文脈は見ないので、この後perform_gibbs_sampling_with_lineで引き直す
+	void add_line_by_sequential_sampling(Sentence &line){
+		if(_sampling_table == NULL){
+			_sampling_table = (double*)malloc(_num_tags * sizeof(double));
+		}
+		for(int pos = 0;pos < line.size();pos++){
+			if(2 <= pos && pos < line.size() - 2){
+				int ti_2 = line.tag_id(pos - 2);
+				int ti_1 = line.tag_id(pos - 1);
+				int wi = line.word_id(pos);
+				const int* n_ti_2_ti_1_row = trigram_row(ti_2, ti_1);
+				double sum = 0;
+				for(int tag = 0;tag < _num_tags;tag++){
+					_sampling_table[tag] = (n_ti_2_ti_1_row[tag] + _alpha) * compute_Ptag_emission(tag, wi);
+					sum += _sampling_table[tag];
+				}
+				line.tag_id(pos) = SamplingKernel::sample_from_table(_sampling_table, _num_tags, sum, Sampler::uniform(0, 1));
+			}
+			increment_counts_at(line, pos);
+		}
+	}
+	void perform_gibbs_sampling_with_line(Sentence &line){
 		if(_sampling_table == NULL){
 			_sampling_table = (double*)malloc(_num_tags * sizeof(double));
 		}
+		// 文中で変わらないものは先にセットしておく
+		TagContext ctx;
+		ctx.num_tags = _num_tags;
+		ctx.n_ti = _unigram_counts;
+		ctx.n_ti_ti1_ti2_stride = _trigram_counts.first_axis_stride();
+		ctx.bigram_counts = _bigram_counts;
+		ctx.Wt = _Wt;
+		ctx.beta = _beta;
+		ctx.alpha = _alpha;
+		double inv_temperature = 1.0 / _temperature;
+		// 温度が1ならべき乗は不要
+		SamplingTableFunction compute_sampling_table = (_temperature == 1) ? _compute_sampling_table_unit : _compute_sampling_table_annealed;
+		assert(compute_sampling_table != NULL);
+		SamplerStats* stats = _stats;
 		for(int pos = 2;pos < line.size() - 2;pos++){	// <bos>と<eos>の内側だけ考える
-			int ti_2 = line[pos - 2]->tag_id;
-			int ti_1 = line[pos - 1]->tag_id;
-			int ti = line[pos]->tag_id;
-			int wi = line[pos]->word_id;
-			int ti1 = line[pos + 1]->tag_id;
-			int ti2 = line[pos + 2]->tag_id;
+			int ti_2 = line.tag_id(pos - 2);
+			int ti_1 = line.tag_id(pos - 1);
+			int ti = line.tag_id(pos);
+			int wi = line.word_id(pos);
+			int ti1 = line.tag_id(pos + 1);
+			int ti2 = line.tag_id(pos + 2);
 			// t_iをモデルパラメータから除去
+			if(stats != NULL){
+				stats->begin_phase(STATS_PHASE_REMOVE);
+			}
 			remove_tag_from_model_parameters(ti_2, ti_1, ti, ti1, ti2, wi);
 			// t_iを再サンプリング
-			double sum = 0;
-			int new_ti = 0;
-			for(int tag = 0;tag < _num_tags;tag++){
-				_sampling_table[tag] = 1;
-				double n_ti_wi = get_count_for_tag_word(tag, wi);
-				double n_ti = _unigram_counts[tag];
-				double W_ti = _Wt[tag];
-				double n_ti_2_ti_1_ti = _trigram_counts[ti_2][ti_1][tag];
-				double n_ti_2_ti_1 = _bigram_counts[ti_2][ti_1];
-				double n_ti_1_ti_ti1 = _trigram_counts[ti_1][tag][ti1];
-				double n_ti_1_ti = _bigram_counts[ti_1][tag];
-				double I_ti_2_ti_1_ti_ti1 = (ti_2 == ti_1 == tag == ti1) ? 1 : 0;
-				double I_ti_2_ti_1_ti = (ti_2 == ti_1 == tag) ? 1 : 0;
-				double n_ti_ti1_ti2 = _trigram_counts[tag][ti1][ti2];
-				double n_ti_ti1 = _bigram_counts[tag][ti1];
-				double I_ti_2_ti_ti2_and_ti_1_ti1 = (ti_2 == tag == ti2 && ti_1 == ti1) ? 1 : 0;
-				double I_ti_1_ti_ti1_ti2 = (ti_1 == tag == ti1 == ti2) ? 1 : 0;
-				double I_ti_2_ti_and_ti_1_ti1 = (ti_2 == tag && ti_1 == ti1) ? 1 : 0;
-				double I_ti_1_ti_ti1 = (ti_1 == tag == ti1) ? 1 : 0;
-				_sampling_table[tag] *= (n_ti_wi + _beta[tag]) / (n_ti + W_ti * _beta[tag]);
-				_sampling_table[tag] *= (n_ti_2_ti_1_ti + _alpha) / (n_ti_2_ti_1 + _num_tags * _alpha);
-				_sampling_table[tag] *= (n_ti_1_ti_ti1 + I_ti_2_ti_1_ti_ti1 + _alpha) / (n_ti_1_ti + I_ti_2_ti_1_ti + _num_tags * _alpha);
-				_sampling_table[tag] *= (n_ti_ti1_ti2 + I_ti_2_ti_ti2_and_ti_1_ti1 + I_ti_1_ti_ti1_ti2 + _alpha) / (n_ti_ti1 + I_ti_2_ti_and_ti_1_ti1 + I_ti_1_ti_ti1 + _num_tags * _alpha);
-				_sampling_table[tag] = pow(_sampling_table[tag], 1.0 / _temperature);
-				sum += _sampling_table[tag];
-			}
-			assert(sum > 0);
-			double normalizer = 1.0 / sum;
-			double bernoulli = Sampler::uniform(0, 1);
-			sum = 0;
-			for(int tag = 0;tag < _num_tags;tag++){
-				sum += _sampling_table[tag] * normalizer;
-				if(sum >= bernoulli){
-					new_ti = tag;
-					break;
+			// 3-gramと2-gramは連続した行として読む
+			ctx.ti_2 = ti_2;
+			ctx.ti_1 = ti_1;
+			ctx.ti1 = ti1;
+			ctx.ti2 = ti2;
+			ctx.n_ti_2_ti_1_ti = trigram_row(ti_2, ti_1);
+			ctx.n_ti_1_ti_ti1 = trigram_column(ti_1, ti1);
+			ctx.n_ti_ti1_ti2 = trigram_first_axis(ti1, ti2);
+			ctx.n_ti_1_ti = bigram_row(ti_1);
+			ctx.n_ti_2_ti_1 = get_bigram_count(ti_2, ti_1);
+			int new_ti;
+			if(_use_mh_sampler){
+				// 確率の計算と引くことが交互に行われるのでまとめてsampleに数える
+				if(stats != NULL){
+					stats->begin_phase(STATS_PHASE_SAMPLE);
 				}
+				new_ti = sample_tag_by_metropolis_hastings(ti, wi, ti_2, ti_1, [&](int tag){
+					return compute_Ptag_emission(tag, wi) * compute_Ptag_transition(ctx, tag);
+				}, inv_temperature);
+			}else{
+				// 品詞-単語ペアは単語ごとに1行まとめて読む
+				if(stats != NULL){
+					stats->begin_phase(STATS_PHASE_SCORE);
+				}
+				ctx.n_ti_wi = get_counts_for_word(wi);
+				double sum = compute_sampling_table(ctx, inv_temperature, _sampling_table);
+				assert(sum > 0);
+				if(stats != NULL){
+					stats->begin_phase(STATS_PHASE_SAMPLE);
+				}
+				double bernoulli = Sampler::uniform(0, 1);
+				new_ti = SamplingKernel::sample_from_table(_sampling_table, _num_tags, sum, bernoulli);
 			}
 			// 新しいt_iをモデルパラメータに追加
+			if(stats != NULL){
+				stats->begin_phase(STATS_PHASE_ADD);
+			}
 			add_tag_to_model_parameters(ti_2, ti_1, new_ti, ti1, ti2, wi);
-			line[pos]->tag_id = new_ti;
+			line.tag_id(pos) = new_ti;
+			if(stats != NULL){
+				stats->end_phase();
+				stats->count_token(ti, new_ti);
+			}
+		}
+	}
+	// 論文(7)式
+	double compute_Ptag_emission(int tag, int wi){
+		return (get_count_for_tag_word(tag, wi) + _beta[tag]) / (_unigram_counts[tag] + _Wt[tag] * _beta[tag]);
+	}
+	// 提案分布は古いカウントから作ったものでもよいので、要素数ぶん引くまで使い回す
+	AliasTable &get_word_alias_table(int wi){
+		AliasTable &table = _word_alias_tables[wi];
+		if(table.is_stale()){
+			const int* n_wi_row = get_counts_for_word(wi);
+			for(int tag = 0;tag < _num_tags;tag++){
+				_sampling_table[tag] = (n_wi_row[tag] + _beta[tag]) / (_unigram_counts[tag] + _Wt[tag] * _beta[tag]);
+			}
+			table.build(_sampling_table, _num_tags);
 		}
+		return table;
+	}
+	AliasTable &get_context_alias_table(int ti_2, int ti_1){
+		AliasTable &table = _context_alias_tables[ti_2 * _num_tags + ti_1];
+		if(table.is_stale()){
+			const int* n_ti_2_ti_1_row = trigram_row(ti_2, ti_1);
+			for(int tag = 0;tag < _num_tags;tag++){
+				_sampling_table[tag] = n_ti_2_ti_1_row[tag] + _alpha;
+			}
+			table.build(_sampling_table, _num_tags);
+		}
+		return table;
+	}
+	// LightLDAと同じく単語の提案分布と文脈の提案分布を交互に使うMH法
+	// targetは目標分布の非正規化確率. 1回あたりO(1)
+	template <typename Target>
+	int sample_tag_by_metropolis_hastings(int current, int wi, int ti_2, int ti_1, Target target, double inv_temperature){
+		if(_sampling_table == NULL){
+			_sampling_table = (double*)malloc(_num_tags * sizeof(double));
+		}
+		if(wi >= _word_alias_tables.size()){
+			_word_alias_tables.resize(wi + 1);
+		}
+		if(_context_alias_tables.size() != _num_tags * _num_tags){
+			_context_alias_tables.clear();
+			_context_alias_tables.resize(_num_tags * _num_tags);
+		}
+		double p_current = target(current);
+		if(inv_temperature != 1){
+			p_current = pow(p_current, inv_temperature);
+		}
+		for(int step = 0;step < _num_mh_steps;step++){
+			AliasTable &proposal = (step % 2 == 0) ? get_word_alias_table(wi) : get_context_alias_table(ti_2, ti_1);
+			double u1 = Sampler::uniform(0, 1);
+			double u2 = Sampler::uniform(0, 1);
+			int candidate = proposal.sample(u1, u2);
+			if(candidate == current){
+				continue;
+			}
+			double p_candidate = target(candidate);
+			if(inv_temperature != 1){
+				p_candidate = pow(p_candidate, inv_temperature);
+			}
+			double acceptance = (p_candidate * proposal.get_probability(current)) / (p_current * proposal.get_probability(candidate));
+			double bernoulli = Sampler::uniform(0, 1);
+			if(bernoulli < acceptance){
+				current = candidate;
+				p_current = p_candidate;
+			}
+		}
+		return current;
 	}
 	// 論文(6)式と(7)式を掛けたものからtiをサンプリング
 	int sample_tag_from_Pt_w(int ti_2, int ti_1, int wi){
+		if(_use_mh_sampler){
+			// 初期値は単語の提案分布から引く
+			if(wi >= _word_alias_tables.size()){
+				_word_alias_tables.resize(wi + 1);
+			}
+			if(_sampling_table == NULL){
+				_sampling_table = (double*)malloc(_num_tags * sizeof(double));
+			}
+			AliasTable &table = get_word_alias_table(wi);
+			double u1 = Sampler::uniform(0, 1);
+			double u2 = Sampler::uniform(0, 1);
+			int initial_tag = table.sample(u1, u2);
+			const int* n_ti_2_ti_1_row = trigram_row(ti_2, ti_1);
+			return sample_tag_by_metropolis_hastings(initial_tag, wi, ti_2, ti_1, [&](int tag){
+				return compute_Ptag_emission(tag, wi) * (n_ti_2_ti_1_row[tag] + _alpha);
+			}, 1.0);
+		}
 		double sum_p = 0;
+		const int* n_ti_2_ti_1_row = trigram_row(ti_2, ti_1);
+		int n_ti_2_ti_1 = get_bigram_count(ti_2, ti_1);
+		const int* n_wi_row = get_counts_for_word(wi);
 		for(int tag = 0;tag < _num_tags;tag++){
-			double Pt_alpha = (_trigram_counts[ti_2][ti_1][tag] + _alpha) / (_bigram_counts[ti_2][ti_1] + _num_tags * _alpha);
-			double Pw_t_beta = (get_count_for_tag_word(tag, wi) + _beta[tag]) / (_unigram_counts[tag] + _Wt[tag] * _beta[tag]);
+			double Pt_alpha = (n_ti_2_ti_1_row[tag] + _alpha) / (n_ti_2_ti_1 + _num_tags * _alpha);
+			double Pw_t_beta = (n_wi_row[tag] + _beta[tag]) / (_unigram_counts[tag] + _Wt[tag] * _beta[tag]);
 			double Ptw_alpha_beta = Pw_t_beta * Pt_alpha;
 			_sampling_table[tag] = Ptw_alpha_beta;
 			sum_p += Ptw_alpha_beta;
@@ -375,9 +735,12 @@ public:
 		double max_p = 0;
 		double max_tag = 0;
 		// cout << (boost::format("argmax(%d, %d, %d)") % ti_2 % ti_1 % wi).str() << endl;
+		const int* n_ti_2_ti_1_row = trigram_row(ti_2, ti_1);
+		int n_ti_2_ti_1 = get_bigram_count(ti_2, ti_1);
+		const int* n_wi_row = get_counts_for_word(wi);
 		for(int tag = 0;tag < _num_tags;tag++){
-			double Pt_alpha = (_trigram_counts[ti_2][ti_1][tag] + _alpha) / (_bigram_counts[ti_2][ti_1] + _num_tags * _alpha);
-			double Pw_t_beta = (get_count_for_tag_word(tag, wi) + _beta[tag]) / (_unigram_counts[tag] + _Wt[tag] * _beta[tag]);
+			double Pt_alpha = (n_ti_2_ti_1_row[tag] + _alpha) / (n_ti_2_ti_1 + _num_tags * _alpha);
+			double Pw_t_beta = (n_wi_row[tag] + _beta[tag]) / (_unigram_counts[tag] + _Wt[tag] * _beta[tag]);
 			double Ptw_alpha_beta = Pw_t_beta * Pt_alpha;
 			// cout << (boost::format("%f = %f * %f") % Ptw_alpha_beta % Pw_t_beta % Pt_alpha).str() << endl;
 			if(Ptw_alpha_beta > max_p){
@@ -388,93 +751,63 @@ public:
 		// cout << "return " << max_tag << endl;
 		return max_tag;
 	}
-	Word* _get_random_word_with_tag(int tag, vector<vector<Word*>> &dataset){
-		int random_index = Sampler::uniform_int(0, dataset.size() - 1);
-		vector<Word*> &line = dataset[random_index];
-		for(int pos = 0;pos < line.size();pos++){
-			int ti = line[pos]->tag_id;
-			if(ti == tag){
-				return line[pos];
-			}
-		}
-		return NULL;
-	}
 	// 新しいAlphaをサンプリング
-	void sample_new_alpha(vector<vector<Word*>> &dataset){
-		double new_alpha = Sampler::normal(_alpha, 0.1 * _alpha);
-		int random_index = Sampler::uniform_int(0, dataset.size() - 1);
-		vector<Word*> &line = dataset[random_index];
-		// メトロポリス・ヘイスティングス法
-		// http://ebsa.ism.ac.jp/ebooks/sites/default/files/ebook/1881/pdf/vol3_ch10.pdf
-		// 提案分布は正規分布
-		double log_Pt_alpha = compute_log_Pt_alpha(line, _alpha);
-		double log_Pt_new_alpha = compute_log_Pt_alpha(line, new_alpha);
-		// q(alpha|new_alpha) / q(new_alpha|alpha)の計算
-		double sigma_alpha = 0.1 * _alpha;
-		double sigma_new_alpha = 0.1 * new_alpha;
-		double var_alpha = sigma_alpha * sigma_alpha;
-		double var_new_alpha = sigma_new_alpha * sigma_new_alpha;
-		double correcting_term = (_alpha / new_alpha) * exp(
-			  0.5 * (new_alpha - _alpha) * (new_alpha - _alpha) / var_alpha
-			+ 0.5 * (_alpha - new_alpha) * (_alpha - new_alpha) / var_new_alpha
-		);
-		if(log_Pt_new_alpha == 0){
-			return;
-		}
-		// 採択率
-		double adoption_rate = std::min(1.0, exp(log_Pt_new_alpha - log_Pt_alpha) * correcting_term);
-		double bernoulli = Sampler::uniform(0, 1);
-		if(bernoulli < adoption_rate){
-			_alpha = new_alpha;
+	// メトロポリス・ヘイスティングス法
+	// http://ebsa.ism.ac.jp/ebooks/sites/default/files/ebook/1881/pdf/vol3_ch10.pdf
+	// 目標分布はコーパス全体の周辺尤度で、コーパスの大きさによらず非ゼロのカウントの数に比例する時間で計算できる
+	void sample_new_alpha(int num_iterations = 20){
+		vector<pair<int, int>> trigram_histogram;
+		vector<pair<int, int>> context_histogram;
+		build_trigram_histograms(trigram_histogram, context_histogram);
+		double log_Pt_alpha = compute_log_Pt_alpha(_alpha, trigram_histogram, context_histogram);
+		for(int itr = 0;itr < num_iterations;itr++){
+			double new_alpha = Sampler::normal(_alpha, 0.1 * _alpha);
+			if(new_alpha <= 0){
+				continue;
+			}
+			double log_Pt_new_alpha = compute_log_Pt_alpha(new_alpha, trigram_histogram, context_histogram);
+			// 採択率
+			double log_adoption_rate = log_Pt_new_alpha - log_Pt_alpha + compute_log_correcting_term(_alpha, new_alpha);
+			double bernoulli = Sampler::uniform(0, 1);
+			if(log(bernoulli) < log_adoption_rate){
+				_alpha = new_alpha;
+				log_Pt_alpha = log_Pt_new_alpha;
+			}
 		}
 	}
 	// 新しいBetaをサンプリング
-	void sample_new_beta(vector<vector<Word*>> &dataset){
+	// 周辺尤度は品詞ごとに分解できるので各品詞のBetaを独立に更新する
+	void sample_new_beta(int num_iterations = 20){
+		vector<vector<pair<int, int>>> word_histograms;
+		build_word_histograms(word_histograms);
 		for(int tag = 0;tag < _num_tags;tag++){
-			double beta = _beta[tag];
-			double new_beta = Sampler::normal(beta, 0.1 * beta);
-			Word* random_word = NULL;
-			int limit = 100;
-			while(random_word == NULL){
-				if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
-					return;
-				}
-				random_word = _get_random_word_with_tag(tag, dataset);
-				limit--;
-				if(limit < 0){
-					break;
-				}
-			}
-			if(random_word == NULL){
+			if(_Wt[tag] <= 0){
 				continue;
 			}
-			// メトロポリス・ヘイスティングス法
-			// http://ebsa.ism.ac.jp/ebooks/sites/default/files/ebook/1881/pdf/vol3_ch10.pdf
-			// 提案分布は正規分布
-			double Pti_wi_beta = compute_Pti_wi_beta(random_word->tag_id, random_word->word_id, beta);
-			double Pti_wi_new_beta = compute_Pti_wi_beta(random_word->tag_id, random_word->word_id, new_beta);
-			// q(beta|new_beta) / q(new_beta|beta)の計算
-			double sigma_beta = 0.1 * beta;
-			double sigma_new_beta = 0.1 * new_beta;
-			double var_beta = sigma_beta * sigma_beta;
-			double var_new_beta = sigma_new_beta * sigma_new_beta;
-			double correcting_term = (beta / new_beta) * exp(
-				  0.5 * (new_beta - beta) * (new_beta - beta) / var_beta
-				+ 0.5 * (beta - new_beta) * (beta - new_beta) / var_new_beta
-			);
-			// 採択率
-			double adoption_rate = std::min(1.0, Pti_wi_new_beta * correcting_term / Pti_wi_beta);
-			double bernoulli = Sampler::uniform(0, 1);
-			if(bernoulli < adoption_rate){
-				_beta[tag] = new_beta;
+			double log_Pw_t_beta = compute_log_Pw_t_beta(tag, _beta[tag], word_histograms[tag]);
+			for(int itr = 0;itr < num_iterations;itr++){
+				double beta = _beta[tag];
+				double new_beta = Sampler::normal(beta, 0.1 * beta);
+				if(new_beta <= 0){
+					continue;
+				}
+				double log_Pw_t_new_beta = compute_log_Pw_t_beta(tag, new_beta, word_histograms[tag]);
+				// 採択率
+				double log_adoption_rate = log_Pw_t_new_beta - log_Pw_t_beta + compute_log_correcting_term(beta, new_beta);
+				double bernoulli = Sampler::uniform(0, 1);
+				if(log(bernoulli) < log_adoption_rate){
+					_beta[tag] = new_beta;
+					log_Pw_t_beta = log_Pw_t_new_beta;
+				}
 			}
 		}
 	}
 	int get_most_co_occurring_tag(int word_id){
 		int max_count = 0;
 		int most_co_occurring_tag_id = 0;
+		const int* counts = get_counts_for_word(word_id);
 		for(int tag = 0;tag < _num_tags;tag++){
-			int count = get_count_for_tag_word(tag, word_id);
+			int count = counts[tag];
 			if(count > max_count){
 				max_count = count;
 				most_co_occurring_tag_id = tag;
@@ -482,19 +815,20 @@ public:
 		}
 		return most_co_occurring_tag_id;
 	}
+	// 0でないカウントだけを書く
 	void dump_trigram_counts(){
-		for(int tri_tag = 0;tri_tag < _num_tags;tri_tag++){
-			for(int bi_tag = 0;bi_tag < _num_tags;bi_tag++){
-				for(int uni_tag = 0;uni_tag < _num_tags;uni_tag++){
-					cout << (boost::format("3-gram [%d][%d][%d] = %d") % tri_tag % bi_tag % uni_tag % _trigram_counts[tri_tag][bi_tag][uni_tag]).str() << endl;
-				}
-			}
+		vector<int> entries;
+		_trigram_counts.get_nonzero(entries);
+		for(size_t i = 0;i < entries.size();i += 3){
+			int tri_tag = entries[i] / _num_tags;
+			int bi_tag = entries[i] % _num_tags;
+			cout << (boost::format("3-gram [%d][%d][%d] = %d") % tri_tag % bi_tag % entries[i + 1] % entries[i + 2]).str() << endl;
 		}
 	}
 	void dump_bigram_counts(){
 		for(int bi_tag = 0;bi_tag < _num_tags;bi_tag++){
 			for(int uni_tag = 0;uni_tag < _num_tags;uni_tag++){
-				cout << (boost::format("2-gram [%d][%d] = %d") % bi_tag % uni_tag % _bigram_counts[bi_tag][uni_tag]).str() << endl;
+				cout << (boost::format("2-gram [%d][%d] = %d") % bi_tag % uni_tag % get_bigram_count(bi_tag, uni_tag)).str() << endl;
 			}
 		}
 	}
@@ -508,29 +842,158 @@ public:
 			cout << tag << ": " << get_word_types_for_tag(tag) << endl;
 		}
 	}
+	// チェックポイント用に学習の状態を全て書き出す
+	void save_state(CacheWriter &writer){
+		writer.write<int32_t>(_num_tags);
+		writer.write<int32_t>(_num_words);
+		writer.write<double>(_alpha);
+		writer.write<double>(_temperature);
+		writer.write<double>(_minimum_temperature);
+		writer.write<uint8_t>(_use_mh_sampler);
+		writer.write<int32_t>(_num_mh_steps);
+		// 3-gramは密な表現ならK^3の配列を、ブロック表現なら0でないカウントだけを書く
+		// 転置した配列は読み込む時に作り直すので書かない
+		// 2-gramと1-gramは連続領域なのでそのまま書く
+		if(_trigram_counts._blocked){
+			vector<int> entries;
+			_trigram_counts.get_nonzero(entries);
+			writer.write_vector(entries);
+		}else{
+			writer.write_array(_trigram_counts._dense.data(), _trigram_counts._dense.size());
+		}
+		writer.write_array(_ngram_counts, _ngram_counts_size);
+		writer.write_array(_beta, _num_tags);
+		writer.write_array(_Wt, _num_tags);
+		// 品詞-単語ペア
+		// 疎な行は長さと中身を別々に並べる. 中身は(品詞, カウント)を交互に並べたintの列
+		writer.write<int32_t>(_tag_word_counts._max_sparse_size);
+		writer.write_vector(_tag_word_counts._dense_index);
+		writer.write_vector(_tag_word_counts._dense_counts);
+		writer.write_vector(_tag_word_counts._word_types_for_tag);
+		vector<int> sparse_sizes;
+		vector<int> sparse_counts;
+		for(const auto &sparse: _tag_word_counts._sparse_counts){
+			sparse_sizes.push_back(sparse.size());
+			for(const auto &elem: sparse){
+				sparse_counts.push_back(elem.first);
+				sparse_counts.push_back(elem.second);
+			}
+		}
+		writer.write_vector(sparse_sizes);
+		writer.write_vector(sparse_counts);
+		// MH法の提案分布
+		// 作り直すタイミングが変わると乱数列が変わるので引いた回数も含めて書く
+		save_alias_tables(writer, _word_alias_tables);
+		save_alias_tables(writer, _context_alias_tables);
+	}
+	// 構築は重みから決まるので重みと引いた回数だけ書く
+	void save_alias_tables(CacheWriter &writer, vector<AliasTable> &tables){
+		writer.write<uint64_t>(tables.size());
+		for(auto &table: tables){
+			writer.write<int32_t>(table._num_draws);
+			writer.write_vector(table._weights);
+		}
+	}
+	bool load_alias_tables(CacheReader &reader, vector<AliasTable> &tables){
+		uint64_t size;
+		if(reader.read(size) == false){
+			return false;
+		}
+		tables.clear();
+		for(uint64_t n = 0;n < size;n++){
+			int32_t num_draws;
+			vector<double> weights;
+			if(reader.read(num_draws) == false || reader.read_vector(weights) == false){
+				return false;
+			}
+			tables.emplace_back();
+			if(weights.size() > 0){
+				if(weights.size() != _num_tags){
+					return false;
+				}
+				tables.back().build(weights.data(), weights.size());
+				tables.back()._num_draws = num_draws;
+			}
+		}
+		return true;
+	}
+	// save_stateで書いたものを読む
+	// initialize()の代わりに呼ぶのでテーブルはまだ確保されていないこと
+	bool load_state(CacheReader &reader){
+		assert(_ngram_counts == NULL);
+		int32_t num_tags, num_words, num_mh_steps;
+		uint8_t use_mh_sampler;
+		if(reader.read(num_tags) == false || num_tags <= 0){
+			return false;
+		}
+		bool complete = reader.read(num_words) && reader.read(_alpha) && reader.read(_temperature) && reader.read(_minimum_temperature) && reader.read(use_mh_sampler) && reader.read(num_mh_steps);
+		if(complete == false){
+			return false;
+		}
+		_num_tags = num_tags;
+		_num_words = num_words;
+		_use_mh_sampler = use_mh_sampler;
+		_num_mh_steps = num_mh_steps;
+		alloc_table();
+		if(_trigram_counts._blocked){
+			vector<int> entries;
+			complete = reader.read_vector(entries) && _trigram_counts.set_nonzero(entries);
+		}else{
+			complete = reader.read_array(_trigram_counts._dense.data(), _trigram_counts._dense.size());
+			if(complete){
+				_trigram_counts.rebuild_transpose();
+			}
+		}
+		complete = complete && reader.read_array(_ngram_counts, _ngram_counts_size) && reader.read_array(_beta, _num_tags) && reader.read_array(_Wt, _num_tags);
+		int32_t max_sparse_size;
+		vector<int> sparse_sizes;
+		vector<int> sparse_counts;
+		complete = complete && reader.read(max_sparse_size)
+			&& reader.read_vector(_tag_word_counts._dense_index)
+			&& reader.read_vector(_tag_word_counts._dense_counts)
+			&& reader.read_vector(_tag_word_counts._word_types_for_tag)
+			&& reader.read_vector(sparse_sizes)
+			&& reader.read_vector(sparse_counts);
+		if(complete == false || sparse_sizes.size() != _tag_word_counts._dense_index.size()){
+			return false;
+		}
+		_tag_word_counts._max_sparse_size = max_sparse_size;
+		_tag_word_counts._sparse_counts.resize(sparse_sizes.size());
+		size_t offset = 0;
+		for(int word_id = 0;word_id < sparse_sizes.size();word_id++){
+			if(sparse_sizes[word_id] < 0 || offset + 2 * (size_t)sparse_sizes[word_id] > sparse_counts.size()){
+				return false;
+			}
+			auto &sparse = _tag_word_counts._sparse_counts[word_id];
+			sparse.clear();
+			for(int i = 0;i < sparse_sizes[word_id];i++){
+				sparse.emplace_back(sparse_counts[offset], sparse_counts[offset + 1]);
+				offset += 2;
+			}
+		}
+		return load_alias_tables(reader, _word_alias_tables) && load_alias_tables(reader, _context_alias_tables);
+	}
 	bool save(string dir = "out"){
 		ofstream ofs(dir + "/hmm.obj");
 		boost::archive::binary_oarchive oarchive(ofs);
 		oarchive << static_cast<const BayesianHMM&>(*this);
 		ofs.close();
 		ofstream ofs_bin;
-		// 3-gram
-		ofs_bin.open(dir + "/hmm.trigram", ios::binary);
-		for(int tri_tag = 0;tri_tag < _num_tags;tri_tag++){
-			for(int bi_tag = 0;bi_tag < _num_tags;bi_tag++){
-				ofs_bin.write((char*)(_trigram_counts[tri_tag][bi_tag]), _num_tags * sizeof(int));
-			}
-		}
-		ofs_bin.close();
-		// 2-gram
-		ofs_bin.open(dir + "/hmm.bigram", ios::binary);
-		for(int bi_tag = 0;bi_tag < _num_tags;bi_tag++){
-			ofs_bin.write((char*)(_bigram_counts[bi_tag]), _num_tags * sizeof(int));
+		// nグラム
+		// 3-gramは密な表現なら[a][b][c]の配列を、ブロック表現なら0でないカウントの数と(文脈, 品詞, 回数)の組を書く
+		// 転置した配列は読み込む時に作り直すので書かない
+		// 2-gramと1-gramは連続領域なので一度に書き込む
+		ofs_bin.open(dir + "/hmm.ngram", ios::binary);
+		if(_trigram_counts._blocked){
+			vector<int> entries;
+			_trigram_counts.get_nonzero(entries);
+			uint64_t size = entries.size();
+			ofs_bin.write((char*)(&size), sizeof(size));
+			ofs_bin.write((char*)(entries.data()), size * sizeof(int));
+		}else{
+			ofs_bin.write((char*)(_trigram_counts._dense.data()), _trigram_counts._dense.size() * sizeof(int));
 		}
-		ofs_bin.close();
-		// 1-gram
-		ofs_bin.open(dir + "/hmm.unigram", ios::binary);
-		ofs_bin.write((char*)(_unigram_counts), _num_tags * sizeof(int));
+		ofs_bin.write((char*)(_ngram_counts), _ngram_counts_size * sizeof(int));
 		ofs_bin.close();
 		// beta
 		ofs_bin.open(dir + "/hmm.beta", ios::binary);
@@ -554,40 +1017,37 @@ public:
 		ifs.close();
 
 		// ポインタの読み込み
-		if(_trigram_counts == NULL){
+		if(_ngram_counts == NULL){
 			alloc_table();
 		}
 		ifstream ifs_bin;
-		// 3-gram
-		ifs_bin.open(dir + "/hmm.trigram", ios::binary);
+		// nグラム
+		ifs_bin.open(dir + "/hmm.ngram", ios::binary);
 		if(ifs_bin.good()){
-			for(int tri_tag = 0;tri_tag < _num_tags;tri_tag++){
-				for(int bi_tag = 0;bi_tag < _num_tags;bi_tag++){
-					ifs_bin.read((char*)(_trigram_counts[tri_tag][bi_tag]), _num_tags * sizeof(int));
+			if(_trigram_counts._blocked){
+				uint64_t size = 0;
+				ifs_bin.read((char*)(&size), sizeof(size));
+				vector<int> entries;
+				if(ifs_bin.good() && size <= (uint64_t)3 * _num_tags * _num_tags * _num_tags){
+					entries.resize(size);
+					ifs_bin.read((char*)(entries.data()), size * sizeof(int));
+				}
+				if(ifs_bin.good() == false || _trigram_counts.set_nonzero(entries) == false){
+					complete = false;
 				}
+			}else{
+				ifs_bin.read((char*)(_trigram_counts._dense.data()), _trigram_counts._dense.size() * sizeof(int));
+				_trigram_counts.rebuild_transpose();
 			}
-		}else{
-			complete = false;
-		}
-		ifs_bin.close();
-		// 2-gram
-		ifs_bin.open(dir + "/hmm.bigram", ios::binary);
-		if(ifs_bin.good()){
-			for(int bi_tag = 0;bi_tag < _num_tags;bi_tag++){
-				ifs_bin.read((char*)(_bigram_counts[bi_tag]), _num_tags * sizeof(int));
+			ifs_bin.read((char*)(_ngram_counts), _ngram_counts_size * sizeof(int));
+			// 大きさが合わなければ別の品詞数か別の形式で書いたもの
+			if(ifs_bin.good() == false || ifs_bin.peek() != EOF){
+				complete = false;
 			}
 		}else{
 			complete = false;
 		}
 		ifs_bin.close();
-		// 1-gram
-		ifs_bin.open(dir + "/hmm.unigram", ios::binary);
-		if(ifs_bin.good()){
-			ifs_bin.read((char*)(_unigram_counts), _num_tags * sizeof(int));
-		}else{
-			complete = false;
-		}
-		ifs_bin.close();
 		// beta
 		ifs_bin.open(dir + "/hmm.beta", ios::binary);
 		if(ifs_bin.good()){
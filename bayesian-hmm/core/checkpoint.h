@@ -0,0 +1,67 @@
+#ifndef _checkpoint_
+#define _checkpoint_
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include "corpus.h"
+using namespace std;
+
+// チェックポイントを取った時点の品詞列を、学習を止めずに書き出す
+// 品詞列全体は複製せず、書き込み用のスレッドが先頭から少しずつ文を読んでファイルに書く
+// 学習側は文の品詞を書き換える前にpreserve()を呼び、まだ書き出されていない文なら元の品詞列を退避させる(コピーオンライト)
+// 書き込みが終わるまでコーパスの配列を確保し直したり入れ替えたりしてはいけない
+class TagSnapshot{
+public:
+	Corpus* _dataset;
+	int _num_lines;
+	uint64_t _num_words;
+	std::mutex _mutex;				// 以下を守る
+	int _num_written_lines;			// [0, _num_written_lines)の文は書き出し済み
+	vector<int64_t> _saved_offsets;	// 退避した文の_saved_tag_idsの中の位置. 退避していなければ-1
+	vector<int> _saved_tag_ids;
+	TagSnapshot(Corpus* dataset){
+		_dataset = dataset;
+		_num_lines = dataset->size();
+		_num_words = dataset->get_num_words();
+		_num_written_lines = 0;
+		_saved_offsets.assign(_num_lines, -1);
+	}
+	// 文data_indexの品詞を書き換える前に呼ぶ
+	void preserve(int data_index){
+		std::lock_guard<std::mutex> lock(_mutex);
+		if(data_index < _num_written_lines || _saved_offsets[data_index] != -1){
+			return;
+		}
+		Sentence line = (*_dataset)[data_index];
+		_saved_offsets[data_index] = _saved_tag_ids.size();
+		_saved_tag_ids.insert(_saved_tag_ids.end(), line._tag_ids, line._tag_ids + line.size());
+	}
+	// 書き込み用のスレッドで呼ぶ
+	// 品詞列をCacheWriter::write_vectorと同じ形式で、chunk_size文ずつosに書く
+	bool write(ostream &os, int chunk_size = 4096){
+		os.write((const char*)&_num_words, sizeof(_num_words));
+		vector<int> buffer;
+		for(int begin = 0;begin < _num_lines;begin += chunk_size){
+			int end = std::min(begin + chunk_size, _num_lines);
+			buffer.clear();
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				for(int data_index = begin;data_index < end;data_index++){
+					Sentence line = (*_dataset)[data_index];
+					const int* tag_ids = line._tag_ids;
+					if(_saved_offsets[data_index] != -1){
+						tag_ids = &_saved_tag_ids[_saved_offsets[data_index]];
+					}
+					buffer.insert(buffer.end(), tag_ids, tag_ids + line.size());
+				}
+				_num_written_lines = end;
+			}
+			os.write((const char*)buffer.data(), buffer.size() * sizeof(int));
+		}
+		return os.good();
+	}
+};
+
+#endif
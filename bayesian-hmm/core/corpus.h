@@ -0,0 +1,86 @@
+#ifndef _corpus_
+#define _corpus_
+#include <cassert>
+#include <cstddef>
+#include <vector>
+using namespace std;
+
+// コーパス中の1文を指すビュー
+// 配列はCorpusが持ち、これは先頭へのポインタと長さだけを持つ
+class Sentence{
+public:
+	int* _word_ids;
+	int* _tag_ids;
+	int _size;
+	Sentence(int* word_ids, int* tag_ids, int size){
+		_word_ids = word_ids;
+		_tag_ids = tag_ids;
+		_size = size;
+	}
+	inline int size() const {
+		return _size;
+	}
+	inline int &word_id(int pos) const {
+		assert(0 <= pos && pos < _size);
+		return _word_ids[pos];
+	}
+	inline int &tag_id(int pos) const {
+		assert(0 <= pos && pos < _size);
+		return _tag_ids[pos];
+	}
+};
+
+// 全ての文の単語IDと品詞IDを1本の配列に詰めて持つ
+// i番目の文は[_offsets[i], _offsets[i + 1])の範囲
+class Corpus{
+public:
+	vector<int> _word_ids;
+	vector<int> _tag_ids;
+	vector<size_t> _offsets;
+	Corpus(){
+		_offsets.push_back(0);
+	}
+	// 文の数
+	inline int size() const {
+		return _offsets.size() - 1;
+	}
+	inline size_t get_num_words() const {
+		return _word_ids.size();
+	}
+	inline Sentence operator[](int index){
+		assert(0 <= index && index < size());
+		size_t begin = _offsets[index];
+		return Sentence(&_word_ids[begin], &_tag_ids[begin], _offsets[index + 1] - begin);
+	}
+	// 今の文の末尾に単語を追加する
+	void add_word(int word_id, int tag_id){
+		_word_ids.push_back(word_id);
+		_tag_ids.push_back(tag_id);
+	}
+	// add_wordで追加した単語を1つの文として閉じる
+	void end_sentence(){
+		assert(_word_ids.size() > _offsets.back());
+		_offsets.push_back(_word_ids.size());
+	}
+	// 先頭からnum_lines文を取り除き、残りを詰める
+	void erase_front(int num_lines){
+		assert(0 <= num_lines && num_lines <= size());
+		if(num_lines == 0){
+			return;
+		}
+		size_t num_words = _offsets[num_lines];
+		_word_ids.erase(_word_ids.begin(), _word_ids.begin() + num_words);
+		_tag_ids.erase(_tag_ids.begin(), _tag_ids.begin() + num_words);
+		_offsets.erase(_offsets.begin(), _offsets.begin() + num_lines);
+		for(size_t &offset: _offsets){
+			offset -= num_words;
+		}
+	}
+	void clear(){
+		_word_ids.clear();
+		_tag_ids.clear();
+		_offsets.assign(1, 0);
+	}
+};
+
+#endif
@@ -0,0 +1,270 @@
+#ifndef _emission_
+#define _emission_
+#include <boost/serialization/serialization.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/utility.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <vector>
+#include <utility>
+#include "cprintf.h"
+#include "ranking.h"
+#include "stats.h"
+using namespace std;
+
+// 品詞と単語のペアの出現頻度を単語ごとに管理する
+// 多くの品詞と共起する単語は品詞数ぶんの連続した行で持ち、
+// それ以外の単語は(品詞, 回数)の組を並べた小さな疎な行で持つ
+// 疎な行の長さは_max_sparse_size以下なので増減はどちらもO(1)
+class EmissionCounts{
+private:
+	friend class boost::serialization::access;
+	template <class Archive>
+	void serialize(Archive& archive, unsigned int version)
+	{
+		static_cast<void>(version);
+		archive & _num_tags;
+		archive & _max_sparse_size;
+		archive & _dense_index;
+		archive & _dense_counts;
+		archive & _sparse_counts;
+		archive & _word_types_for_tag;
+	}
+public:
+	int _num_tags;
+	int _max_sparse_size;	// これを超える数の品詞と共起したら密な行に切り替える
+	vector<int> _dense_index;	// 単語IDから密な行の番号へ. 疎な行なら-1
+	vector<int> _dense_counts;	// 密な行をまとめた領域. 行ごとに_num_tags個
+	vector<vector<pair<int, int>>> _sparse_counts;	// 単語IDから(品詞, 回数)の組へ
+	vector<int> _word_types_for_tag;	// 各品詞と共起する単語の種類数
+	EmissionCounts(){
+		_num_tags = 0;
+		_max_sparse_size = 0;
+	}
+	void init(int num_tags){
+		assert(num_tags > 0);
+		_num_tags = num_tags;
+		_max_sparse_size = std::max(4, num_tags / 8);
+		_dense_index.clear();
+		_dense_counts.clear();
+		_sparse_counts.clear();
+		_word_types_for_tag.assign(num_tags, 0);
+	}
+	void reserve_word(int word_id){
+		if(word_id >= _dense_index.size()){
+			SamplerStats::count_allocation();
+			_dense_index.resize(word_id + 1, -1);
+			_sparse_counts.resize(word_id + 1);
+		}
+	}
+	bool is_dense(int word_id){
+		return word_id < _dense_index.size() && _dense_index[word_id] != -1;
+	}
+	inline int* dense_row(int word_id){
+		return &_dense_counts[0] + (size_t)_dense_index[word_id] * _num_tags;
+	}
+	// 疎な行を密な行に移す
+	void promote(int word_id){
+		assert(is_dense(word_id) == false);
+		SamplerStats::count_allocation();
+		_dense_index[word_id] = _dense_counts.size() / _num_tags;
+		_dense_counts.resize(_dense_counts.size() + _num_tags, 0);
+		int* row = dense_row(word_id);
+		vector<pair<int, int>> &sparse = _sparse_counts[word_id];
+		for(const auto &elem: sparse){
+			row[elem.first] = elem.second;
+		}
+		vector<pair<int, int>>().swap(sparse);
+	}
+	void increment(int tag_id, int word_id){
+		assert(tag_id < _num_tags);
+		SamplerStats::count_hash_probe();
+		reserve_word(word_id);
+		if(is_dense(word_id)){
+			int &count = dense_row(word_id)[tag_id];
+			if(count == 0){
+				_word_types_for_tag[tag_id] += 1;
+			}
+			count += 1;
+			return;
+		}
+		vector<pair<int, int>> &sparse = _sparse_counts[word_id];
+		for(auto &elem: sparse){
+			if(elem.first == tag_id){
+				elem.second += 1;
+				return;
+			}
+		}
+		_word_types_for_tag[tag_id] += 1;
+		if(sparse.size() >= _max_sparse_size){
+			promote(word_id);
+			dense_row(word_id)[tag_id] = 1;
+			return;
+		}
+		if(sparse.size() == sparse.capacity()){
+			SamplerStats::count_allocation();
+		}
+		sparse.push_back(std::make_pair(tag_id, 1));
+	}
+	void decrement(int tag_id, int word_id){
+		assert(tag_id < _num_tags);
+		SamplerStats::count_hash_probe();
+		if(word_id >= _dense_index.size()){
+			c_printf("[r]%s [*]%s\n", "エラー", "品詞-単語ペアのカウントが正しく実装されていません.");
+			exit(1);
+		}
+		if(is_dense(word_id)){
+			int &count = dense_row(word_id)[tag_id];
+			if(count <= 0){
+				c_printf("[r]%s [*]%s\n", "エラー", "品詞-単語ペアのカウントが正しく実装されていません.");
+				exit(1);
+			}
+			count -= 1;
+			if(count == 0){
+				_word_types_for_tag[tag_id] -= 1;
+			}
+			return;
+		}
+		vector<pair<int, int>> &sparse = _sparse_counts[word_id];
+		for(int i = 0;i < sparse.size();i++){
+			if(sparse[i].first == tag_id){
+				sparse[i].second -= 1;
+				if(sparse[i].second <= 0){
+					sparse[i] = sparse.back();
+					sparse.pop_back();
+					_word_types_for_tag[tag_id] -= 1;
+				}
+				return;
+			}
+		}
+		c_printf("[r]%s [*]%s\n", "エラー", "品詞-単語ペアのカウントが正しく実装されていません.");
+		exit(1);
+	}
+	int get_count(int tag_id, int word_id){
+		SamplerStats::count_hash_probe();
+		if(word_id >= _dense_index.size()){
+			return 0;
+		}
+		if(is_dense(word_id)){
+			return dense_row(word_id)[tag_id];
+		}
+		for(const auto &elem: _sparse_counts[word_id]){
+			if(elem.first == tag_id){
+				return elem.second;
+			}
+		}
+		return 0;
+	}
+	// 単語word_idの全品詞についてのカウントを返す
+	// 密な行ならその行を、疎な行ならbufferに展開して返す
+	const int* get_row(int word_id, int* buffer){
+		SamplerStats::count_hash_probe();
+		if(is_dense(word_id)){
+			return dense_row(word_id);
+		}
+		memset(buffer, 0, _num_tags * sizeof(int));
+		if(word_id < _sparse_counts.size()){
+			for(const auto &elem: _sparse_counts[word_id]){
+				buffer[elem.first] = elem.second;
+			}
+		}
+		return buffer;
+	}
+	int get_word_types_for_tag(int tag_id){
+		return _word_types_for_tag[tag_id];
+	}
+	// 0でない全てのカウントについてfunc(品詞, 回数)を呼ぶ
+	template <typename Function>
+	void enumerate_counts(Function func){
+		for(int word_id = 0;word_id < _dense_index.size();word_id++){
+			if(is_dense(word_id)){
+				const int* row = dense_row(word_id);
+				for(int tag = 0;tag < _num_tags;tag++){
+					if(row[tag] > 0){
+						func(tag, row[tag]);
+					}
+				}
+				continue;
+			}
+			for(const auto &elem: _sparse_counts[word_id]){
+				func(elem.first, elem.second);
+			}
+		}
+	}
+	// 0でない全てのカウントについてfunc(単語ID, 品詞, 回数)を呼ぶ
+	template <typename Function>
+	void enumerate_word_counts(Function func){
+		for(int word_id = 0;word_id < _dense_index.size();word_id++){
+			if(is_dense(word_id)){
+				const int* row = dense_row(word_id);
+				for(int tag = 0;tag < _num_tags;tag++){
+					if(row[tag] > 0){
+						func(word_id, tag, row[tag]);
+					}
+				}
+				continue;
+			}
+			for(const auto &elem: _sparse_counts[word_id]){
+				func(word_id, elem.first, elem.second);
+			}
+		}
+	}
+	// 品詞ごとに回数の多い上位k個の(単語ID, 回数)を多い順に返す
+	// 全てのカウントを1度だけ走査するので、品詞ごとに全ての単語を引き直すより速い
+	void get_top_words_for_each_tag(int k, vector<vector<pair<int, int>>> &top_words){
+		vector<TopKRanking> rankings(_num_tags, TopKRanking(k));
+		enumerate_word_counts([&rankings](int word_id, int tag, int count){
+			rankings[tag].push(word_id, count);
+		});
+		top_words.resize(_num_tags);
+		for(int tag = 0;tag < _num_tags;tag++){
+			top_words[tag] = rankings[tag].get_sorted();
+		}
+	}
+	// 品詞ごとに共起する全ての(単語ID, 回数)を単語IDの順に返す
+	void get_words_for_each_tag(vector<vector<pair<int, int>>> &words){
+		words.assign(_num_tags, vector<pair<int, int>>());
+		enumerate_word_counts([&words](int word_id, int tag, int count){
+			words[tag].push_back(std::make_pair(word_id, count));
+		});
+	}
+	// 0でないカウントの数
+	size_t get_num_nonzero(){
+		size_t num_nonzero = 0;
+		enumerate_counts([&num_nonzero](int tag, int count){
+			num_nonzero += 1;
+		});
+		return num_nonzero;
+	}
+	// 単語を行、品詞を列とするCSR形式に書き出す
+	// indptrは単語数+1個、indicesとdataはget_num_nonzero()個の領域を呼び出し側が確保しておく
+	// 各行の中は品詞の昇順に並べる
+	void fill_csr(int* indptr, int* indices, int* data){
+		int nnz = 0;
+		indptr[0] = 0;
+		for(int word_id = 0;word_id < _dense_index.size();word_id++){
+			if(is_dense(word_id)){
+				const int* row = dense_row(word_id);
+				for(int tag = 0;tag < _num_tags;tag++){
+					if(row[tag] > 0){
+						indices[nnz] = tag;
+						data[nnz] = row[tag];
+						nnz++;
+					}
+				}
+			}else{
+				vector<pair<int, int>> sorted(_sparse_counts[word_id]);
+				std::sort(sorted.begin(), sorted.end());
+				for(const auto &elem: sorted){
+					indices[nnz] = elem.first;
+					data[nnz] = elem.second;
+					nnz++;
+				}
+			}
+			indptr[word_id + 1] = nnz;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,231 @@
+#ifndef _ffbs_
+#define _ffbs_
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include "bhmm.h"
+#include "corpus.h"
+#include "kernel.h"
+#include "sampler.h"
+using namespace std;
+
+// 文単位のブロック化ギブスサンプリング(前向きフィルタリング・後ろ向きサンプリング)
+// 状態は(t_{i-1}, t_i)の組で、1単語あたりO(K^3)
+// 文のカウントを除いたモデルを固定した提案分布から品詞列をまとめて引き、
+// 文の中でカウントが増えていく影響はメトロポリス・ヘイスティングス法で補正する
+// Johnson et al., "Bayesian Inference for PCFGs via Markov chain Monte Carlo" 参照
+class BlockedGibbsSampler{
+public:
+	int _num_tags;
+	BayesianHMM* _hmm;
+	vector<double> _Pt;			// P(t_i|t_{i-2}, t_{i-1})^(1/T) [t_{i-2}][t_{i-1}][t_i]
+	double _inv_temperature;	// _Ptを作った時の温度の逆数
+	vector<double> _Pw_t;		// 文中の各位置のP(w_i|t_i)^(1/T) [i][t_i]
+	vector<double> _forward;	// 各位置の前向き確率 [i][t_{i-1}][t_i]
+	vector<double> _sampling_table;
+	vector<int> _old_tags;
+	vector<int> _new_tags;
+	int _num_proposed;
+	int _num_accepted;
+	BlockedGibbsSampler(BayesianHMM* hmm){
+		_hmm = hmm;
+		_num_tags = hmm->_num_tags;
+		assert(_num_tags > 0);
+		int K = _num_tags;
+		_Pt.resize(K * K * K);
+		_sampling_table.resize(K * K);
+		_inv_temperature = 1;
+		_num_proposed = 0;
+		_num_accepted = 0;
+	}
+	// _Ptの行[t_{i-2}][t_{i-1}]を今のカウントで作り直す
+	void update_Pt_row(int ti_2, int ti_1){
+		int K = _num_tags;
+		double alpha = _hmm->_alpha;
+		double* row = &_Pt[(ti_2 * K + ti_1) * K];
+		const int* n_ti_2_ti_1_row = _hmm->trigram_row(ti_2, ti_1);
+		double denominator = _hmm->get_bigram_count(ti_2, ti_1) + K * alpha;
+		for(int ti = 0;ti < K;ti++){
+			row[ti] = (n_ti_2_ti_1_row[ti] + alpha) / denominator;
+		}
+		if(_inv_temperature != 1){
+			for(int ti = 0;ti < K;ti++){
+				row[ti] = pow(row[ti], _inv_temperature);
+			}
+		}
+	}
+	// 品詞列tagsのカウントが変わると行[t_{i-1}][t_i]の分子か分母が変わる
+	void update_Pt_rows(const vector<int> &tags){
+		for(int pos = 1;pos < tags.size();pos++){
+			update_Pt_row(tags[pos - 1], tags[pos]);
+		}
+	}
+	// 全ての行を作り直す
+	// 温度やハイパーパラメータが変わったり、1文ずつ以外の方法でカウントが変わった後に呼ぶ
+	void prepare(){
+		_inv_temperature = 1.0 / _hmm->_temperature;
+		for(int ti_2 = 0;ti_2 < _num_tags;ti_2++){
+			for(int ti_1 = 0;ti_1 < _num_tags;ti_1++){
+				update_Pt_row(ti_2, ti_1);
+			}
+		}
+		_num_proposed = 0;
+		_num_accepted = 0;
+	}
+	// 提案分布での品詞列の確率の対数(正規化定数を除く)
+	// <bos>の後から<eos>までの遷移と、<bos>と<eos>の内側の単語の出力を掛ける
+	double compute_log_Pline_proposal(const vector<int> &tags){
+		int K = _num_tags;
+		int size = tags.size();
+		double log_p = 0;
+		for(int pos = 2;pos < size;pos++){
+			log_p += log(_Pt[(tags[pos - 2] * K + tags[pos - 1]) * K + tags[pos]]);
+			if(pos < size - 2){
+				log_p += log(_Pw_t[pos * K + tags[pos]]);
+			}
+		}
+		return log_p;
+	}
+	void sample_line(Sentence &line){
+		int K = _num_tags;
+		int size = line.size();
+		int first = 2;			// 最初の単語
+		int last = size - 3;	// 最後の単語
+		if(last < first){
+			return;
+		}
+		SamplerStats* stats = _hmm->_stats;
+		if(stats != NULL){
+			stats->begin_phase(STATS_PHASE_REMOVE);
+		}
+		_old_tags.resize(size);
+		for(int pos = 0;pos < size;pos++){
+			_old_tags[pos] = line.tag_id(pos);
+		}
+		// 文のカウントを除く
+		_hmm->remove_line_from_model_parameters(line);
+		update_Pt_rows(_old_tags);
+		double log_Pline_old = _hmm->add_line_and_compute_log_Pline(line);
+		_hmm->remove_line_from_model_parameters(line);
+		// 各位置の出力確率
+		if(stats != NULL){
+			stats->begin_phase(STATS_PHASE_SCORE);
+		}
+		if(_Pw_t.size() < size * K){
+			_Pw_t.resize(size * K);
+			_forward.resize(size * K * K);
+		}
+		for(int pos = first;pos <= last;pos++){
+			double* Pw_t = &_Pw_t[pos * K];
+			int wi = line.word_id(pos);
+			for(int tag = 0;tag < K;tag++){
+				Pw_t[tag] = _hmm->compute_Ptag_emission(tag, wi);
+			}
+			if(_inv_temperature != 1){
+				for(int tag = 0;tag < K;tag++){
+					Pw_t[tag] = pow(Pw_t[tag], _inv_temperature);
+				}
+			}
+		}
+		// 前向き
+		// 各位置で正規化するのでアンダーフローしない
+		int t_bos_1 = _old_tags[first - 2];
+		int t_bos_2 = _old_tags[first - 1];
+		double* forward = &_forward[first * K * K];
+		std::fill(forward, forward + K * K, 0.0);
+		double sum = 0;
+		for(int tag = 0;tag < K;tag++){
+			double p = _Pt[(t_bos_1 * K + t_bos_2) * K + tag] * _Pw_t[first * K + tag];
+			forward[t_bos_2 * K + tag] = p;
+			sum += p;
+		}
+		normalize(forward, K * K, sum);
+		for(int pos = first + 1;pos <= last;pos++){
+			double* prev = &_forward[(pos - 1) * K * K];
+			forward = &_forward[pos * K * K];
+			sum = SamplingKernel::forward_step(prev, &_Pt[0], &_Pw_t[pos * K], forward, K);
+			normalize(forward, K * K, sum);
+		}
+		// 後ろ向き
+		// 最後の2単語の組を<eos>2つへの遷移と合わせて引く
+		if(stats != NULL){
+			stats->begin_phase(STATS_PHASE_SAMPLE);
+		}
+		_new_tags = _old_tags;
+		int t_eos_1 = _old_tags[last + 1];
+		int t_eos_2 = _old_tags[last + 2];
+		forward = &_forward[last * K * K];
+		sum = 0;
+		for(int ti_1 = 0;ti_1 < K;ti_1++){
+			for(int ti = 0;ti < K;ti++){
+				double p = forward[ti_1 * K + ti] * _Pt[(ti_1 * K + ti) * K + t_eos_1] * _Pt[(ti * K + t_eos_1) * K + t_eos_2];
+				_sampling_table[ti_1 * K + ti] = p;
+				sum += p;
+			}
+		}
+		int state = SamplingKernel::sample_from_table(&_sampling_table[0], K * K, sum, Sampler::uniform(0, 1));
+		_new_tags[last] = state % K;
+		if(last > first){
+			_new_tags[last - 1] = state / K;
+		}
+		// 残りは後ろから1つずつ
+		for(int pos = last - 1;pos > first;pos--){
+			int ti = _new_tags[pos];
+			int ti1 = _new_tags[pos + 1];
+			forward = &_forward[pos * K * K];
+			sum = 0;
+			for(int ti_1 = 0;ti_1 < K;ti_1++){
+				double p = forward[ti_1 * K + ti] * _Pt[(ti_1 * K + ti) * K + ti1];
+				_sampling_table[ti_1] = p;
+				sum += p;
+			}
+			_new_tags[pos - 1] = SamplingKernel::sample_from_table(&_sampling_table[0], K, sum, Sampler::uniform(0, 1));
+		}
+		// 採択率
+		// 目標分布は文を先頭から1つずつ生成する確率の1/T乗
+		if(stats != NULL){
+			stats->begin_phase(STATS_PHASE_ADD);
+		}
+		for(int pos = first;pos <= last;pos++){
+			line.tag_id(pos) = _new_tags[pos];
+		}
+		double log_Pline_new = _hmm->add_line_and_compute_log_Pline(line);
+		double log_adoption_rate = _inv_temperature * (log_Pline_new - log_Pline_old)
+			- (compute_log_Pline_proposal(_new_tags) - compute_log_Pline_proposal(_old_tags));
+		_num_proposed++;
+		double bernoulli = Sampler::uniform(0, 1);
+		if(log(bernoulli) < log_adoption_rate){
+			_num_accepted++;
+		}else{
+			// 棄却したら元に戻す
+			_hmm->remove_line_from_model_parameters(line);
+			for(int pos = first;pos <= last;pos++){
+				line.tag_id(pos) = _old_tags[pos];
+			}
+			_hmm->add_line_to_model_parameters(line);
+		}
+		update_Pt_rows(_old_tags);
+		update_Pt_rows(_new_tags);
+		if(stats != NULL){
+			stats->end_phase();
+			for(int pos = first;pos <= last;pos++){
+				stats->count_token(_old_tags[pos], line.tag_id(pos));
+			}
+		}
+	}
+	void normalize(double* table, int size, double sum){
+		assert(sum > 0);
+		double inv_sum = 1.0 / sum;
+		for(int i = 0;i < size;i++){
+			table[i] *= inv_sum;
+		}
+	}
+	double get_acceptance_rate(){
+		if(_num_proposed == 0){
+			return 0;
+		}
+		return _num_accepted / (double)_num_proposed;
+	}
+};
+
+#endif
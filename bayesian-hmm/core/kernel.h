@@ -0,0 +1,486 @@
+#ifndef _kernel_
+#define _kernel_
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNEL_X86
+#endif
+using namespace std;
+
+// t_iの条件付き確率の計算に使うカウント
+// 行はどれも品詞数ぶんの長さを持つ
+typedef struct TagContext {
+	int num_tags;
+	int ti_2;
+	int ti_1;
+	int ti1;
+	int ti2;
+	const int* n_ti_2_ti_1_ti;	// 3-gram [t_{i-2}][t_{i-1}][*]
+	const int* n_ti_1_ti_ti1;	// 3-gram [t_{i-1}][*][t_{i+1}]
+	const int* n_ti_1_ti;		// 2-gram [t_{i-1}][*]
+	const int* n_ti_ti1_ti2;	// 3-gram [*][t_{i+1}][t_{i+2}]. n_ti_ti1_ti2_strideおきに読む
+	const int* n_ti_wi;			// 品詞-単語 [*][w_i]
+	const int* n_ti;			// 1-gram
+	const int* bigram_counts;	// 2-gram全体. [*][t_{i+1}]は飛び飛びに読む
+	const int* Wt;
+	const double* beta;
+	int n_ti_ti1_ti2_stride;	// 3-gramが密な表現ならK^2, ブロック表現なら1
+	double n_ti_2_ti_1;
+	double alpha;
+} TagContext;
+
+// 論文(10)式の右辺のうち品詞の遷移に関する部分をスカラーで計算
+// 指示関数はtagがt_{i-1}かt_{i-2}に一致する時だけ1になりうる
+inline double compute_Ptag_transition(const TagContext &ctx, int tag){
+	int K = ctx.num_tags;
+	int ti_2 = ctx.ti_2;
+	int ti_1 = ctx.ti_1;
+	int ti1 = ctx.ti1;
+	int ti2 = ctx.ti2;
+	double I_ti_2_ti_1_ti_ti1 = (ti_2 == ti_1 && ti_1 == tag && tag == ti1) ? 1 : 0;
+	double I_ti_2_ti_1_ti = (ti_2 == ti_1 && ti_1 == tag) ? 1 : 0;
+	double I_ti_2_ti_ti2_and_ti_1_ti1 = (ti_2 == tag && tag == ti2 && ti_1 == ti1) ? 1 : 0;
+	double I_ti_1_ti_ti1_ti2 = (ti_1 == tag && tag == ti1 && ti1 == ti2) ? 1 : 0;
+	double I_ti_2_ti_and_ti_1_ti1 = (ti_2 == tag && ti_1 == ti1) ? 1 : 0;
+	double I_ti_1_ti_ti1 = (ti_1 == tag && tag == ti1) ? 1 : 0;
+	double n_ti_ti1_ti2 = ctx.n_ti_ti1_ti2[tag * ctx.n_ti_ti1_ti2_stride];
+	double n_ti_ti1 = ctx.bigram_counts[tag * K + ti1];
+	double alpha = ctx.alpha;
+	double p = (ctx.n_ti_2_ti_1_ti[tag] + alpha) / (ctx.n_ti_2_ti_1 + K * alpha);
+	p *= (ctx.n_ti_1_ti_ti1[tag] + I_ti_2_ti_1_ti_ti1 + alpha) / (ctx.n_ti_1_ti[tag] + I_ti_2_ti_1_ti + K * alpha);
+	p *= (n_ti_ti1_ti2 + I_ti_2_ti_ti2_and_ti_1_ti1 + I_ti_1_ti_ti1_ti2 + alpha) / (n_ti_ti1 + I_ti_2_ti_and_ti_1_ti1 + I_ti_1_ti_ti1 + K * alpha);
+	return p;
+}
+
+// 論文(10)式の右辺をスカラーで計算
+inline double compute_Ptag_context(const TagContext &ctx, int tag){
+	double beta = ctx.beta[tag];
+	double p = (ctx.n_ti_wi[tag] + beta) / (ctx.n_ti[tag] + ctx.Wt[tag] * beta);
+	return p * compute_Ptag_transition(ctx, tag);
+}
+
+// 全品詞についての条件付き確率(温度を適用する前)を計算しtableに入れる
+// FixedKが正ならコンパイル時に品詞数が決まるのでループを展開できる
+// 指示関数が効くのはt_{i-1}, t_{i-2}だけなので、まとめて計算した後その2つを上書きする
+template <int FixedK>
+inline void compute_raw_table_scalar(const TagContext &ctx, double* table){
+	const int K = FixedK > 0 ? FixedK : ctx.num_tags;
+	assert(K == ctx.num_tags);
+	const double alpha = ctx.alpha;
+	const double K_alpha = K * ctx.alpha;
+	const double n_ti_2_ti_1_K_alpha = ctx.n_ti_2_ti_1 + K_alpha;
+	const int* n_ti_ti1_ti2 = ctx.n_ti_ti1_ti2;
+	const int stride = ctx.n_ti_ti1_ti2_stride;
+	const int* n_ti_ti1 = ctx.bigram_counts + ctx.ti1;
+	for(int tag = 0;tag < K;tag++){
+		double beta = ctx.beta[tag];
+		double numerator = (ctx.n_ti_wi[tag] + beta) * (ctx.n_ti_2_ti_1_ti[tag] + alpha) * (ctx.n_ti_1_ti_ti1[tag] + alpha) * (n_ti_ti1_ti2[tag * stride] + alpha);
+		double denominator = (ctx.n_ti[tag] + ctx.Wt[tag] * beta) * n_ti_2_ti_1_K_alpha * (ctx.n_ti_1_ti[tag] + K_alpha) * (n_ti_ti1[tag * K] + K_alpha);
+		table[tag] = numerator / denominator;
+	}
+	table[ctx.ti_1] = compute_Ptag_context(ctx, ctx.ti_1);
+	table[ctx.ti_2] = compute_Ptag_context(ctx, ctx.ti_2);
+}
+
+// 温度による指数は対数領域で取り、最大値を引いてからexpに戻すのでアンダーフローしない
+// 戻り値はtableの総和
+inline double apply_temperature_scalar(double* table, int num_tags, double inv_temperature){
+	double max_log_p = -HUGE_VAL;
+	for(int tag = 0;tag < num_tags;tag++){
+		table[tag] = log(table[tag]) * inv_temperature;
+		max_log_p = std::max(max_log_p, table[tag]);
+	}
+	double sum = 0;
+	for(int tag = 0;tag < num_tags;tag++){
+		table[tag] = exp(table[tag] - max_log_p);
+		sum += table[tag];
+	}
+	return sum;
+}
+
+inline double sum_table_scalar(const double* table, int num_tags){
+	double sum = 0;
+	for(int tag = 0;tag < num_tags;tag++){
+		sum += table[tag];
+	}
+	return sum;
+}
+
+// 温度が1でない時(Annealed)だけ対数領域を経由する
+// 戻り値はtableの総和
+template <int FixedK, bool Annealed>
+double compute_sampling_table_scalar(const TagContext &ctx, double inv_temperature, double* table){
+	const int K = FixedK > 0 ? FixedK : ctx.num_tags;
+	compute_raw_table_scalar<FixedK>(ctx, table);
+	if(Annealed){
+		return apply_temperature_scalar(table, K, inv_temperature);
+	}
+	return sum_table_scalar(table, K);
+}
+
+// 累積和がbernoulli * sumを超えた最初の品詞を返す
+inline int sample_from_table_scalar(const double* table, int num_tags, double sum, double bernoulli){
+	double target = bernoulli * sum;
+	double stack = 0;
+	for(int tag = 0;tag < num_tags;tag++){
+		stack += table[tag];
+		if(stack >= target){
+			return tag;
+		}
+	}
+	return num_tags - 1;
+}
+
+// 2次HMMの前向き計算の1ステップ
+// 状態は(t_{i-1}, t_i)の組で、next[b][c] = Pw_t[c] * Σ_a prev[a][b] * Pt[a][b][c]
+// 内側のcのループは3-gramの行とnextの行がどちらも連続しているのでベクトル化できる
+// 戻り値はnextの総和
+inline double forward_step_scalar(const double* prev, const double* Pt, const double* Pw_t, double* next, int num_tags){
+	const int K = num_tags;
+	memset(next, 0, K * K * sizeof(double));
+	for(int a = 0;a < K;a++){
+		for(int b = 0;b < K;b++){
+			double weight = prev[a * K + b];
+			if(weight == 0){
+				continue;
+			}
+			const double* row = Pt + (a * K + b) * K;
+			double* next_row = next + b * K;
+			for(int c = 0;c < K;c++){
+				next_row[c] += weight * row[c];
+			}
+		}
+	}
+	double sum = 0;
+	for(int b = 0;b < K;b++){
+		double* next_row = next + b * K;
+		for(int c = 0;c < K;c++){
+			next_row[c] *= Pw_t[c];
+			sum += next_row[c];
+		}
+	}
+	return sum;
+}
+
+#ifdef KERNEL_X86
+// 4つのint32をdoubleに
+__attribute__((target("avx2")))
+static inline __m256d _kernel_load_int(const int* ptr){
+	return _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)ptr));
+}
+// int64の下位32bitをdoubleに
+__attribute__((target("avx2")))
+static inline __m256d _kernel_int64_to_pd(__m256i v){
+	__m256i packed = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0));
+	return _mm256_cvtepi32_pd(_mm256_castsi256_si128(packed));
+}
+// 正の正規化数に対するlog
+// 仮数部を[sqrt(1/2), sqrt(2))に寄せてlog(1+f) = 2atanh(f/(2+f))を級数展開する
+__attribute__((target("avx2")))
+static inline __m256d _kernel_log_pd(__m256d x){
+	const __m256i mantissa_mask = _mm256_set1_epi64x(0x000FFFFFFFFFFFFFLL);
+	const __m256i exponent_one = _mm256_set1_epi64x(0x3FF0000000000000LL);
+	__m256i bits = _mm256_castpd_si256(x);
+	__m256d e = _kernel_int64_to_pd(_mm256_sub_epi64(_mm256_srli_epi64(bits, 52), _mm256_set1_epi64x(1023)));
+	__m256d m = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits, mantissa_mask), exponent_one));
+	__m256d too_large = _mm256_cmp_pd(m, _mm256_set1_pd(M_SQRT2), _CMP_GT_OQ);
+	m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), too_large);
+	e = _mm256_add_pd(e, _mm256_and_pd(too_large, _mm256_set1_pd(1.0)));
+	__m256d f = _mm256_sub_pd(m, _mm256_set1_pd(1.0));
+	__m256d s = _mm256_div_pd(f, _mm256_add_pd(f, _mm256_set1_pd(2.0)));
+	__m256d s2 = _mm256_mul_pd(s, s);
+	__m256d poly = _mm256_set1_pd(1.0 / 19.0);
+	for(int k = 17;k >= 1;k -= 2){
+		poly = _mm256_add_pd(_mm256_mul_pd(poly, s2), _mm256_set1_pd(1.0 / k));
+	}
+	__m256d log_m = _mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(2.0), s), poly);
+	return _mm256_add_pd(_mm256_mul_pd(e, _mm256_set1_pd(M_LN2)), log_m);
+}
+// x <= 0に対するexp
+// x = n * log(2) + rに分解しexp(r)をテイラー展開する
+__attribute__((target("avx2")))
+static inline __m256d _kernel_exp_pd(__m256d x){
+	__m256d underflow = _mm256_cmp_pd(x, _mm256_set1_pd(-708.0), _CMP_LT_OQ);
+	x = _mm256_max_pd(x, _mm256_set1_pd(-708.0));
+	__m256d n = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(M_LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256d r = _mm256_sub_pd(x, _mm256_mul_pd(n, _mm256_set1_pd(6.93145751953125E-1)));
+	r = _mm256_sub_pd(r, _mm256_mul_pd(n, _mm256_set1_pd(1.42860682030941723212E-6)));
+	// 係数は1/k!. 13次まで取る
+	double coeff = 1.0;
+	for(int k = 2;k <= 13;k++){
+		coeff /= k;
+	}
+	__m256d poly = _mm256_set1_pd(coeff);
+	for(int k = 13;k >= 1;k--){
+		coeff *= k;
+		poly = _mm256_add_pd(_mm256_mul_pd(poly, r), _mm256_set1_pd(coeff));
+	}
+	__m256i n64 = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(n));
+	__m256d two_n = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(n64, _mm256_set1_epi64x(1023)), 52));
+	return _mm256_andnot_pd(underflow, _mm256_mul_pd(poly, two_n));
+}
+__attribute__((target("avx2")))
+static inline double _kernel_hmax_pd(__m256d v){
+	__m128d m = _mm_max_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+	return std::max(_mm_cvtsd_f64(m), _mm_cvtsd_f64(_mm_unpackhi_pd(m, m)));
+}
+__attribute__((target("avx2")))
+static inline double _kernel_hsum_pd(__m256d v){
+	__m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+	return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+// compute_raw_table_scalarのAVX2版
+// 4品詞ずつまとめて計算し、指示関数が効く品詞t_{i-1}, t_{i-2}だけスカラーで上書きする
+template <int FixedK>
+__attribute__((target("avx2")))
+static inline void compute_raw_table_avx2(const TagContext &ctx, double* table){
+	const int K = FixedK > 0 ? FixedK : ctx.num_tags;
+	assert(K == ctx.num_tags);
+	const int K_aligned = K & ~3;
+	const __m256d alpha = _mm256_set1_pd(ctx.alpha);
+	const __m256d K_alpha = _mm256_set1_pd(K * ctx.alpha);
+	const __m256d n_ti_2_ti_1_K_alpha = _mm256_set1_pd(ctx.n_ti_2_ti_1 + K * ctx.alpha);
+	// [tag][t_{i+1}][t_{i+2}]と[tag][t_{i+1}]の添字
+	const __m128i step_tri = _mm_set1_epi32(4 * ctx.n_ti_ti1_ti2_stride);
+	const __m128i step_bi = _mm_set1_epi32(4 * K);
+	__m128i index_tri = _mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(ctx.n_ti_ti1_ti2_stride));
+	__m128i index_bi = _mm_add_epi32(_mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(K)), _mm_set1_epi32(ctx.ti1));
+	int tag = 0;
+	for(;tag < K_aligned;tag += 4){
+		__m256d beta = _mm256_loadu_pd(ctx.beta + tag);
+		__m256d n_ti_wi = _kernel_load_int(ctx.n_ti_wi + tag);
+		__m256d n_ti = _kernel_load_int(ctx.n_ti + tag);
+		__m256d W_ti = _kernel_load_int(ctx.Wt + tag);
+		__m256d n_ti_2_ti_1_ti = _kernel_load_int(ctx.n_ti_2_ti_1_ti + tag);
+		__m256d n_ti_1_ti_ti1 = _kernel_load_int(ctx.n_ti_1_ti_ti1 + tag);
+		__m256d n_ti_1_ti = _kernel_load_int(ctx.n_ti_1_ti + tag);
+		__m256d n_ti_ti1_ti2 = _mm256_cvtepi32_pd(_mm_i32gather_epi32(ctx.n_ti_ti1_ti2, index_tri, 4));
+		__m256d n_ti_ti1 = _mm256_cvtepi32_pd(_mm_i32gather_epi32(ctx.bigram_counts, index_bi, 4));
+		index_tri = _mm_add_epi32(index_tri, step_tri);
+		index_bi = _mm_add_epi32(index_bi, step_bi);
+		__m256d numerator = _mm256_add_pd(n_ti_wi, beta);
+		__m256d denominator = _mm256_add_pd(n_ti, _mm256_mul_pd(W_ti, beta));
+		numerator = _mm256_mul_pd(numerator, _mm256_add_pd(n_ti_2_ti_1_ti, alpha));
+		denominator = _mm256_mul_pd(denominator, n_ti_2_ti_1_K_alpha);
+		numerator = _mm256_mul_pd(numerator, _mm256_add_pd(n_ti_1_ti_ti1, alpha));
+		denominator = _mm256_mul_pd(denominator, _mm256_add_pd(n_ti_1_ti, K_alpha));
+		numerator = _mm256_mul_pd(numerator, _mm256_add_pd(n_ti_ti1_ti2, alpha));
+		denominator = _mm256_mul_pd(denominator, _mm256_add_pd(n_ti_ti1, K_alpha));
+		_mm256_storeu_pd(table + tag, _mm256_div_pd(numerator, denominator));
+	}
+	for(;tag < K;tag++){
+		table[tag] = compute_Ptag_context(ctx, tag);
+	}
+	table[ctx.ti_1] = compute_Ptag_context(ctx, ctx.ti_1);
+	table[ctx.ti_2] = compute_Ptag_context(ctx, ctx.ti_2);
+}
+
+// apply_temperature_scalarのAVX2版
+__attribute__((target("avx2")))
+static inline double apply_temperature_avx2(double* table, int num_tags, double inv_temperature){
+	const int K_aligned = num_tags & ~3;
+	const __m256d inv_t = _mm256_set1_pd(inv_temperature);
+	__m256d max_log_p_v = _mm256_set1_pd(-HUGE_VAL);
+	int tag = 0;
+	for(;tag < K_aligned;tag += 4){
+		__m256d log_p = _mm256_mul_pd(_kernel_log_pd(_mm256_loadu_pd(table + tag)), inv_t);
+		_mm256_storeu_pd(table + tag, log_p);
+		max_log_p_v = _mm256_max_pd(max_log_p_v, log_p);
+	}
+	double max_log_p = _kernel_hmax_pd(max_log_p_v);
+	for(;tag < num_tags;tag++){
+		table[tag] = log(table[tag]) * inv_temperature;
+		max_log_p = std::max(max_log_p, table[tag]);
+	}
+	const __m256d max_v = _mm256_set1_pd(max_log_p);
+	__m256d sum_v = _mm256_setzero_pd();
+	for(tag = 0;tag < K_aligned;tag += 4){
+		__m256d p = _kernel_exp_pd(_mm256_sub_pd(_mm256_loadu_pd(table + tag), max_v));
+		_mm256_storeu_pd(table + tag, p);
+		sum_v = _mm256_add_pd(sum_v, p);
+	}
+	double sum = _kernel_hsum_pd(sum_v);
+	for(;tag < num_tags;tag++){
+		table[tag] = exp(table[tag] - max_log_p);
+		sum += table[tag];
+	}
+	return sum;
+}
+
+__attribute__((target("avx2")))
+static inline double sum_table_avx2(const double* table, int num_tags){
+	const int K_aligned = num_tags & ~3;
+	__m256d sum_v = _mm256_setzero_pd();
+	int tag = 0;
+	for(;tag < K_aligned;tag += 4){
+		sum_v = _mm256_add_pd(sum_v, _mm256_loadu_pd(table + tag));
+	}
+	double sum = _kernel_hsum_pd(sum_v);
+	for(;tag < num_tags;tag++){
+		sum += table[tag];
+	}
+	return sum;
+}
+
+// compute_sampling_table_scalarのAVX2版
+template <int FixedK, bool Annealed>
+__attribute__((target("avx2")))
+double compute_sampling_table_avx2(const TagContext &ctx, double inv_temperature, double* table){
+	const int K = FixedK > 0 ? FixedK : ctx.num_tags;
+	compute_raw_table_avx2<FixedK>(ctx, table);
+	if(Annealed){
+		return apply_temperature_avx2(table, K, inv_temperature);
+	}
+	return sum_table_avx2(table, K);
+}
+
+// sample_from_table_scalarのAVX2版
+// 4要素ごとにレジスタ内で累積和を取り、閾値を超えた位置をビットマスクで探す
+__attribute__((target("avx2")))
+static int sample_from_table_avx2(const double* table, int num_tags, double sum, double bernoulli){
+	int K_aligned = num_tags & ~3;
+	double target = bernoulli * sum;
+	const __m256d target_v = _mm256_set1_pd(target);
+	const __m256d zero = _mm256_setzero_pd();
+	__m256d carry = zero;
+	int tag = 0;
+	for(;tag < K_aligned;tag += 4){
+		__m256d v = _mm256_loadu_pd(table + tag);
+		// [a, b, c, d] -> [a, a+b, b+c, c+d]
+		v = _mm256_add_pd(v, _mm256_blend_pd(_mm256_permute4x64_pd(v, _MM_SHUFFLE(2, 1, 0, 0)), zero, 0x1));
+		// -> [a, a+b, a+b+c, a+b+c+d]
+		v = _mm256_add_pd(v, _mm256_blend_pd(_mm256_permute4x64_pd(v, _MM_SHUFFLE(1, 0, 0, 0)), zero, 0x3));
+		v = _mm256_add_pd(v, carry);
+		int mask = _mm256_movemask_pd(_mm256_cmp_pd(v, target_v, _CMP_GE_OQ));
+		if(mask != 0){
+			return tag + __builtin_ctz(mask);
+		}
+		carry = _mm256_permute4x64_pd(v, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+	double stack = _mm256_cvtsd_f64(carry);
+	for(;tag < num_tags;tag++){
+		stack += table[tag];
+		if(stack >= target){
+			return tag;
+		}
+	}
+	return num_tags - 1;
+}
+
+// forward_step_scalarのAVX2版
+__attribute__((target("avx2")))
+static double forward_step_avx2(const double* prev, const double* Pt, const double* Pw_t, double* next, int num_tags){
+	const int K = num_tags;
+	const int K_aligned = K & ~3;
+	memset(next, 0, K * K * sizeof(double));
+	for(int a = 0;a < K;a++){
+		for(int b = 0;b < K;b++){
+			double weight = prev[a * K + b];
+			if(weight == 0){
+				continue;
+			}
+			const __m256d weight_v = _mm256_set1_pd(weight);
+			const double* row = Pt + (a * K + b) * K;
+			double* next_row = next + b * K;
+			int c = 0;
+			for(;c < K_aligned;c += 4){
+				__m256d v = _mm256_add_pd(_mm256_loadu_pd(next_row + c), _mm256_mul_pd(weight_v, _mm256_loadu_pd(row + c)));
+				_mm256_storeu_pd(next_row + c, v);
+			}
+			for(;c < K;c++){
+				next_row[c] += weight * row[c];
+			}
+		}
+	}
+	__m256d sum_v = _mm256_setzero_pd();
+	double sum = 0;
+	for(int b = 0;b < K;b++){
+		double* next_row = next + b * K;
+		int c = 0;
+		for(;c < K_aligned;c += 4){
+			__m256d v = _mm256_mul_pd(_mm256_loadu_pd(next_row + c), _mm256_loadu_pd(Pw_t + c));
+			_mm256_storeu_pd(next_row + c, v);
+			sum_v = _mm256_add_pd(sum_v, v);
+		}
+		for(;c < K;c++){
+			next_row[c] *= Pw_t[c];
+			sum += next_row[c];
+		}
+	}
+	return sum + _kernel_hsum_pd(sum_v);
+}
+#endif
+
+typedef double (*SamplingTableFunction)(const TagContext &, double, double*);
+
+// 実行時にCPUを見てAVX2版かスカラー版を選ぶ
+// よく使う品詞数については品詞数を固定したものを用意しておく
+class SamplingKernel{
+public:
+	static bool _use_avx2;
+	static bool detect_avx2(){
+#ifdef KERNEL_X86
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#else
+		return false;
+#endif
+	}
+	template <int FixedK, bool Annealed>
+	static SamplingTableFunction get_function(){
+#ifdef KERNEL_X86
+		if(_use_avx2){
+			return &compute_sampling_table_avx2<FixedK, Annealed>;
+		}
+#endif
+		return &compute_sampling_table_scalar<FixedK, Annealed>;
+	}
+	template <bool Annealed>
+	static SamplingTableFunction select(int num_tags){
+		switch(num_tags){
+			case 17:
+				return get_function<17, Annealed>();
+			case 25:
+				return get_function<25, Annealed>();
+			case 45:
+				return get_function<45, Annealed>();
+			case 50:
+				return get_function<50, Annealed>();
+		}
+		return get_function<0, Annealed>();
+	}
+	// 温度が1なら対数領域を経由しないものを返す
+	static SamplingTableFunction select(int num_tags, bool annealed){
+		if(annealed){
+			return select<true>(num_tags);
+		}
+		return select<false>(num_tags);
+	}
+	static double compute_sampling_table(const TagContext &ctx, double inv_temperature, double* table){
+		return select(ctx.num_tags, true)(ctx, inv_temperature, table);
+	}
+	static double forward_step(const double* prev, const double* Pt, const double* Pw_t, double* next, int num_tags){
+#ifdef KERNEL_X86
+		if(_use_avx2){
+			return forward_step_avx2(prev, Pt, Pw_t, next, num_tags);
+		}
+#endif
+		return forward_step_scalar(prev, Pt, Pw_t, next, num_tags);
+	}
+	static int sample_from_table(const double* table, int num_tags, double sum, double bernoulli){
+#ifdef KERNEL_X86
+		if(_use_avx2){
+			return sample_from_table_avx2(table, num_tags, sum, bernoulli);
+		}
+#endif
+		return sample_from_table_scalar(table, num_tags, sum, bernoulli);
+	}
+};
+
+bool SamplingKernel::_use_avx2 = SamplingKernel::detect_avx2();
+
+#endif
@@ -0,0 +1,210 @@
+#ifndef _parallel_
+#define _parallel_
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "bhmm.h"
+#include "sampler.h"
+using namespace std;
+
+// 近似分散Gibbsサンプリング(AD-LDAと同じ方法)
+// シャッフルした文をスレッドごとに分け、各スレッドは同期した時点のカウントの複製に対してサンプリングする
+// 同期時に各スレッドでサンプリングした文の品詞の変化を本体に反映する
+// スレッドは最初に作ったものを使い続け、各回の担当が来るまで待つ
+// 各スレッドのモデルは本体が外から書き換えられた後の最初の回でだけ丸ごと複製し、それ以外の回では他のスレッドが直前の回に変えた文の分だけを直す
+class ParallelGibbsSampler{
+public:
+	int _num_threads;
+	int _sync_interval;		// 1スレッドあたり何文ごとに同期するか. 0ならエポックごと
+	vector<BayesianHMM*> _workers;
+	vector<thread> _threads;
+	vector<vector<int>> _prev_tags[2];		// 各スレッドが担当した文の更新前の品詞. 文ごとに<bos>と<eos>も含めて並べる. 今の回と直前の回で交互に使う
+	vector<SamplerStats> _stats;		// 各スレッドでの計測
+	bool _workers_synced;		// 各スレッドのモデルが、直前の回に他のスレッドが変えた分を除いて本体と同じか
+	// 以下は各回の担当. _mutexで守る
+	std::mutex _mutex;
+	std::condition_variable _start_condition;
+	std::condition_variable _finish_condition;
+	int _round;
+	int _num_finished_threads;
+	bool _exiting;
+	BayesianHMM* _hmm;
+	Corpus* _dataset;
+	vector<int>* _rand_indices;
+	int _begin;
+	int _end;
+	int _prev_begin;		// 直前の回の範囲
+	int _prev_end;
+	uint64_t _seed;
+	ParallelGibbsSampler(int num_threads, int sync_interval){
+		assert(num_threads > 0);
+		assert(sync_interval >= 0);
+		_num_threads = num_threads;
+		_sync_interval = sync_interval;
+		_workers_synced = false;
+		_round = 0;
+		_num_finished_threads = 0;
+		_exiting = false;
+		_hmm = NULL;
+		_dataset = NULL;
+		_rand_indices = NULL;
+		_begin = 0;
+		_end = 0;
+		_prev_begin = 0;
+		_prev_end = 0;
+		_seed = 0;
+		for(int t = 0;t < num_threads;t++){
+			_workers.push_back(new BayesianHMM());
+		}
+		_prev_tags[0].resize(num_threads);
+		_prev_tags[1].resize(num_threads);
+		_stats.resize(num_threads);
+		for(int t = 0;t < num_threads;t++){
+			_threads.emplace_back(&ParallelGibbsSampler::run_worker, this, t);
+		}
+	}
+	~ParallelGibbsSampler(){
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_exiting = true;
+		}
+		_start_condition.notify_all();
+		for(auto &th: _threads){
+			th.join();
+		}
+		for(auto worker: _workers){
+			delete worker;
+		}
+	}
+	// 各スレッドのモデルは最初に同期した時点の品詞数で確保されるので、品詞数が変わったら作り直す
+	bool is_allocated_for(BayesianHMM* hmm){
+		BayesianHMM* worker = _workers[0];
+		return worker->_ngram_counts == NULL || worker->_num_tags == hmm->_num_tags;
+	}
+	// 本体のカウントが外から書き換えられたら呼ぶ. 次の回で各スレッドのモデルを丸ごと複製し直す
+	void discard_worker_states(){
+		_workers_synced = false;
+	}
+	// 1回の同期までに処理する文の数
+	int get_num_lines_per_round(int num_lines){
+		if(_sync_interval == 0){
+			return num_lines;
+		}
+		return _sync_interval * _num_threads;
+	}
+	// [begin, end)のうちスレッドtが担当する範囲の先頭
+	int get_shard_begin(int begin, int end, int t){
+		return begin + (long long)(end - begin) * t / _num_threads;
+	}
+	// rand_indices[begin, end)の文をスレッドに分けてサンプリングし、差分を反映する
+	void perform_gibbs_sampling(BayesianHMM* hmm, Corpus &dataset, vector<int> &rand_indices, int begin, int end){
+		assert(begin < end);
+		for(int t = 0;t < _num_threads;t++){
+			_workers[t]->_stats = (hmm->_stats != NULL) ? &_stats[t] : NULL;
+		}
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_hmm = hmm;
+			_dataset = &dataset;
+			_rand_indices = &rand_indices;
+			_begin = begin;
+			_end = end;
+			// 乱数のシードは本体の乱数から決め、各スレッドはその系列tを使うので、スレッド数が同じなら再現できる
+			_seed = Sampler::rng();
+			_num_finished_threads = 0;
+			_round += 1;
+		}
+		_start_condition.notify_all();
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_finish_condition.wait(lock, [this]{
+				return _num_finished_threads == _num_threads;
+			});
+		}
+		_workers_synced = true;
+		_prev_begin = begin;
+		_prev_end = end;
+		if(hmm->_stats != NULL){
+			for(int t = 0;t < _num_threads;t++){
+				hmm->_stats->merge(_stats[t]);
+				_stats[t].reset();
+			}
+		}
+		for(int t = 0;t < _num_threads;t++){
+			apply_shard(hmm, t, begin, end, _round % 2);
+		}
+	}
+	// スレッドtがrand_indicesの[begin, end)の担当分で変えた文の品詞をtargetのカウントに反映する
+	void apply_shard(BayesianHMM* target, int t, int begin, int end, int parity){
+		vector<int> &prev_tags = _prev_tags[parity][t];
+		int shard_end = get_shard_begin(begin, end, t + 1);
+		size_t offset = 0;
+		for(int n = get_shard_begin(begin, end, t);n < shard_end;n++){
+			Sentence line = (*_dataset)[(*_rand_indices)[n]];
+			target->replace_tags_of_line(line, &prev_tags[offset]);
+			offset += line.size();
+		}
+	}
+	// 各スレッドで実行される
+	void run_worker(int t){
+		int round = 0;
+		while(true){
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_start_condition.wait(lock, [this, round]{
+					return _exiting || _round != round;
+				});
+				if(_exiting){
+					return;
+				}
+				round = _round;
+			}
+			perform_gibbs_sampling_with_shard(t, round);
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_num_finished_threads += 1;
+			}
+			_finish_condition.notify_one();
+		}
+	}
+	// 文は各スレッドが排他的に持つのでコーパスの品詞は直接書き換えてよい
+	// 直前の回の文と品詞はこの回では誰も書き換えないので、各スレッドから同時に読んでよい
+	void perform_gibbs_sampling_with_shard(int t, int round){
+		Sampler::seed_stream(_seed, t);
+		BayesianHMM* worker = _workers[t];
+		if(_workers_synced){
+			worker->copy_hyperparameters_from(_hmm);
+			for(int u = 0;u < _num_threads;u++){
+				if(u != t){
+					apply_shard(worker, u, _prev_begin, _prev_end, (round + 1) % 2);
+				}
+			}
+		}else{
+			worker->copy_state_from(_hmm);
+		}
+		int shard_begin = get_shard_begin(_begin, _end, t);
+		int shard_end = get_shard_begin(_begin, _end, t + 1);
+		vector<int> &prev_tags = _prev_tags[round % 2][t];
+		prev_tags.clear();
+		for(int n = shard_begin;n < shard_end;n++){
+			Sentence line = (*_dataset)[(*_rand_indices)[n]];
+			prev_tags.insert(prev_tags.end(), line._tag_ids, line._tag_ids + line.size());
+		}
+		if(worker->_stats != NULL){
+			worker->_stats->begin_sweep();
+		}
+		for(int n = shard_begin;n < shard_end;n++){
+			Sentence line = (*_dataset)[(*_rand_indices)[n]];
+			worker->perform_gibbs_sampling_with_line(line);
+		}
+		if(worker->_stats != NULL){
+			worker->_stats->end_sweep();
+		}
+	}
+};
+
+#endif
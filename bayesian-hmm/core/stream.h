@@ -0,0 +1,111 @@
+#ifndef _stream_
+#define _stream_
+#include <algorithm>
+#include <cassert>
+#include <vector>
+#include "bhmm.h"
+#include "cache.h"
+#include "corpus.h"
+#include "sampler.h"
+using namespace std;
+
+// 学習済みのモデルに次々と届く文を追加していく
+// 新しい文は届いた時点で品詞を引き、その後は直近の文と、それより古い文から一様に選んだ文(リザーバ)だけを引き直す
+// 保持する文の数に上限があれば、古い文からカウントごと取り除く
+// 文はdatasetの中の位置ではなく、これまでに追加された全ての文の通し番号で覚えておく
+class IncrementalGibbsSampler{
+public:
+	int _window_size;		// 毎回引き直す直近の文の数
+	int _reservoir_size;	// 直近より古い文から選んでおく文の数
+	int _max_num_lines;		// 保持する文の上限. 0なら取り除かない
+	int _num_evicted_lines;	// これまでに取り除いた文の数. dataset[0]の通し番号になる
+	int _num_candidates;	// 直近から外れてリザーバの候補になった文の数
+	vector<int> _reservoir;	// 選んだ文の通し番号
+	vector<int> _indices;	// 引き直す文のdataset中の位置
+	IncrementalGibbsSampler(){
+		_window_size = 1000;
+		_reservoir_size = 1000;
+		_max_num_lines = 0;
+		_num_evicted_lines = 0;
+		_num_candidates = 0;
+	}
+	// datasetの最後の文が新しく届いた文
+	void add_line(BayesianHMM* hmm, Corpus &dataset){
+		assert(dataset.size() > 0);
+		Sentence line = dataset[dataset.size() - 1];
+		hmm->add_line_by_sequential_sampling(line);
+		hmm->perform_gibbs_sampling_with_line(line);
+		// 直近から外れた文を候補にする
+		int data_index = dataset.size() - 1 - _window_size;
+		if(data_index >= 0){
+			offer_to_reservoir(_num_evicted_lines + data_index);
+		}
+	}
+	// リザーバサンプリング
+	// 候補になった全ての文が等しい確率でリザーバに残る
+	void offer_to_reservoir(int line_id){
+		_num_candidates += 1;
+		if(_reservoir.size() < _reservoir_size){
+			_reservoir.push_back(line_id);
+			return;
+		}
+		int k = Sampler::uniform_int(0, _num_candidates - 1);
+		if(k < _reservoir_size){
+			_reservoir[k] = line_id;
+		}
+	}
+	// 上限を超えた古い文のカウントを除いてdatasetを詰める
+	// 取り除いた文の数を返す
+	int evict_lines(BayesianHMM* hmm, Corpus &dataset){
+		if(_max_num_lines <= 0 || dataset.size() <= _max_num_lines){
+			return 0;
+		}
+		int num_lines = dataset.size() - _max_num_lines;
+		for(int data_index = 0;data_index < num_lines;data_index++){
+			Sentence line = dataset[data_index];
+			hmm->remove_line_from_model_parameters(line);
+		}
+		dataset.erase_front(num_lines);
+		_num_evicted_lines += num_lines;
+		// 取り除いた文はリザーバからも消す
+		int num_evicted_lines = _num_evicted_lines;
+		_reservoir.erase(std::remove_if(_reservoir.begin(), _reservoir.end(), [num_evicted_lines](int line_id){
+			return line_id < num_evicted_lines;
+		}), _reservoir.end());
+		return num_lines;
+	}
+	// 直近の文とリザーバの文の位置をシャッフルして返す
+	const vector<int> &get_lines_to_resample(Corpus &dataset){
+		_indices.clear();
+		int begin = std::max(0, dataset.size() - _window_size);
+		for(int data_index = begin;data_index < dataset.size();data_index++){
+			_indices.push_back(data_index);
+		}
+		for(int line_id: _reservoir){
+			int data_index = line_id - _num_evicted_lines;
+			if(0 <= data_index && data_index < begin){
+				_indices.push_back(data_index);
+			}
+		}
+		shuffle(_indices.begin(), _indices.end(), Sampler::rng);
+		return _indices;
+	}
+	void save_state(CacheWriter &writer){
+		writer.write<int32_t>(_window_size);
+		writer.write<int32_t>(_reservoir_size);
+		writer.write<int32_t>(_max_num_lines);
+		writer.write<int32_t>(_num_evicted_lines);
+		writer.write<int32_t>(_num_candidates);
+		writer.write_vector(_reservoir);
+	}
+	bool load_state(CacheReader &reader){
+		return reader.read(_window_size)
+			&& reader.read(_reservoir_size)
+			&& reader.read(_max_num_lines)
+			&& reader.read(_num_evicted_lines)
+			&& reader.read(_num_candidates)
+			&& reader.read_vector(_reservoir);
+	}
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef _tagger_
+#define _tagger_
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cprintf.h"
+#include "loader.h"
+using namespace std;
+
+// テキストファイルの全ての行に品詞を付け、"単語/品詞ID"を空白区切りで並べて書き出す
+// ファイルはmmapしてスレッド数ぶんの行のまとまりに分け、分かち書き・品詞の推定・書き出す文字列の組み立てを各スレッドで行う
+// 出力の行の順番は入力と同じで、空行は空行のまま残す. 単語は入力のバイト列をそのまま書き出す
+// Decoderはdecode(単語IDの列, 品詞IDの列)を持つクラスで、スレッドごとに1つ使う
+// 複数のスレッドから同時に呼ばれるので、decodeはモデルを書き換えてはいけない
+class FileTagger{
+public:
+	static int get_num_threads(int num_threads){
+		if(num_threads <= 0){
+			return std::max(1, (int)thread::hardware_concurrency());
+		}
+		return num_threads;
+	}
+	// string_to_idは辞書を引くだけの関数. 呼び出したスレッドでのみ呼ぶ
+	// tag_countsには品詞ごとの単語数が入る
+	template <class Decoder, class StringToId>
+	static bool tag(const string &input_path, const string &output_path, vector<Decoder*> &decoders, StringToId string_to_id, vector<int> &tag_counts){
+		assert(decoders.size() > 0);
+		MappedFile file;
+		if(file.open(input_path) == false){
+			c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sを開けません.") % input_path.c_str()).str().c_str());
+			return false;
+		}
+		ofstream ofs(output_path, ios::binary);
+		if(ofs.good() == false){
+			c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sに書き込めません.") % output_path.c_str()).str().c_str());
+			return false;
+		}
+		int num_threads = decoders.size();
+		vector<size_t> boundaries = split_at_line_boundaries(file._data, file._size, num_threads);
+		vector<TokenizedChunk> chunks(num_threads);
+		vector<thread> threads;
+		for(int t = 0;t < num_threads;t++){
+			chunks[t]._skip_empty_lines = false;
+			threads.emplace_back(&TokenizedChunk::tokenize, &chunks[t], file._data + boundaries[t], file._data + boundaries[t + 1]);
+		}
+		for(auto &th: threads){
+			th.join();
+		}
+		threads.clear();
+		// 局所IDを全体のIDに直す表
+		vector<vector<int>> local_to_global(num_threads);
+		for(int t = 0;t < num_threads;t++){
+			TokenizedChunk &chunk = chunks[t];
+			local_to_global[t].resize(chunk._vocabulary.size());
+			for(int local_id = 0;local_id < chunk._vocabulary.size();local_id++){
+				const string &word = chunk._vocabulary[local_id];
+				local_to_global[t][local_id] = string_to_id(utf8_to_wstring(word.data(), word.data() + word.size()));
+			}
+		}
+		vector<string> outputs(num_threads);
+		vector<vector<int>> tag_counts_for_thread(num_threads);
+		for(int t = 0;t < num_threads;t++){
+			threads.emplace_back(&FileTagger::tag_chunk<Decoder>, std::ref(chunks[t]), std::cref(local_to_global[t]), decoders[t], std::ref(outputs[t]), std::ref(tag_counts_for_thread[t]));
+		}
+		for(auto &th: threads){
+			th.join();
+		}
+		tag_counts.clear();
+		for(int t = 0;t < num_threads;t++){
+			ofs.write(outputs[t].data(), outputs[t].size());
+			const vector<int> &counts = tag_counts_for_thread[t];
+			if(counts.size() > tag_counts.size()){
+				tag_counts.resize(counts.size(), 0);
+			}
+			for(int tag = 0;tag < counts.size();tag++){
+				tag_counts[tag] += counts[tag];
+			}
+		}
+		ofs.close();
+		return ofs.good();
+	}
+	// 各スレッドで実行される
+	template <class Decoder>
+	static void tag_chunk(TokenizedChunk &chunk, const vector<int> &local_to_global, Decoder* decoder, string &output, vector<int> &tag_counts){
+		vector<int> word_ids;
+		vector<int> tags;
+		for(int n = 0;n < chunk.get_num_lines();n++){
+			word_ids.clear();
+			for(size_t i = chunk._offsets[n];i < chunk._offsets[n + 1];i++){
+				word_ids.push_back(local_to_global[chunk._word_ids[i]]);
+			}
+			tags.clear();
+			if(word_ids.size() > 0){
+				decoder->decode(word_ids, tags);
+			}
+			assert(tags.size() == word_ids.size());
+			for(int i = 0;i < tags.size();i++){
+				int tag = tags[i];
+				if(i > 0){
+					output += ' ';
+				}
+				output += chunk._vocabulary[chunk._word_ids[chunk._offsets[n] + i]];
+				output += '/';
+				output += std::to_string(tag);
+				if(tag >= tag_counts.size()){
+					tag_counts.resize(tag + 1, 0);
+				}
+				tag_counts[tag] += 1;
+			}
+			output += '\n';
+		}
+	}
+};
+
+#endif
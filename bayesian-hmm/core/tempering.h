@@ -0,0 +1,130 @@
+#ifndef _tempering_
+#define _tempering_
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <thread>
+#include <vector>
+#include "bhmm.h"
+#include "corpus.h"
+#include "sampler.h"
+using namespace std;
+
+// レプリカ交換法(パラレルテンパリング)
+// 温度の異なる複数のモデルをスレッドごとに並行してサンプリングし、隣り合う温度のモデルの状態を確率的に交換する
+// 温度Tのモデルは同時確率P(t,w)^(1/T)からサンプリングしているので、交換の採択率は
+// min(1, exp((1/T_k - 1/T_{k+1}) * (log P_{k+1} - log P_k)))
+// 状態はカウント・ハイパーパラメータ・品詞列の組で、交換はポインタとvectorの入れ替えだけで済む
+// 最も低い温度のモデルは呼び出し側が持つもので、サンプリング中だけ借りる
+class ReplicaExchangeSampler{
+public:
+	int _num_replicas;
+	vector<double> _temperatures;		// 低い順
+	vector<BayesianHMM*> _replicas;		// [0]は呼び出し側のモデルを借りている間だけ入る
+	vector<vector<int>> _tags;			// 各モデルの品詞列. 単語列と文の区切りはコーパスと共有
+	vector<double> _log_Pdata;
+	vector<int> _num_swaps_proposed;	// 温度kとk+1の交換
+	vector<int> _num_swaps_accepted;
+	int _num_rounds;
+	size_t _num_words;
+	// 高温側のモデルは全てcoldの複製から始める
+	ReplicaExchangeSampler(const vector<double> &temperatures, BayesianHMM* cold, Corpus &dataset){
+		assert(temperatures.size() >= 2);
+		_temperatures = temperatures;
+		_num_replicas = temperatures.size();
+		_replicas.resize(_num_replicas, NULL);
+		_tags.resize(_num_replicas);
+		for(int r = 1;r < _num_replicas;r++){
+			_replicas[r] = new BayesianHMM();
+			_replicas[r]->copy_state_from(cold);
+			_replicas[r]->_temperature = temperatures[r];
+			_tags[r] = dataset._tag_ids;
+		}
+		_log_Pdata.resize(_num_replicas, 0);
+		_num_swaps_proposed.resize(_num_replicas - 1, 0);
+		_num_swaps_accepted.resize(_num_replicas - 1, 0);
+		_num_rounds = 0;
+		_num_words = dataset.get_num_words();
+	}
+	~ReplicaExchangeSampler(){
+		for(int r = 1;r < _num_replicas;r++){
+			delete _replicas[r];
+		}
+	}
+	// 全てのモデルを1エポックずつサンプリングしてから交換を試みる
+	// coldは交換の結果、別のモデルに入れ替わることがある
+	void perform_sampling(BayesianHMM* &cold, Corpus &dataset){
+		assert(dataset.get_num_words() == _num_words);
+		_replicas[0] = cold;
+		_tags[0].swap(dataset._tag_ids);
+		cold->_temperature = _temperatures[0];
+		SamplerStats* stats = cold->_stats;	// 計測するのは最も低い温度のモデルだけ
+		// 乱数のシードは本体の乱数から決め、各レプリカはその系列rを使うので再現できる
+		uint64_t seed = Sampler::rng();
+		vector<thread> threads;
+		for(int r = 0;r < _num_replicas;r++){
+			threads.emplace_back(&ReplicaExchangeSampler::perform_gibbs_sampling_with_replica, this, r, seed, std::ref(dataset));
+		}
+		for(auto &th: threads){
+			th.join();
+		}
+		// 偶数番目と奇数番目の組を交互に試す
+		for(int k = _num_rounds % 2;k + 1 < _num_replicas;k += 2){
+			double log_adoption_rate = (1.0 / _temperatures[k] - 1.0 / _temperatures[k + 1]) * (_log_Pdata[k + 1] - _log_Pdata[k]);
+			_num_swaps_proposed[k] += 1;
+			double bernoulli = Sampler::uniform(0, 1);
+			if(log(bernoulli) < log_adoption_rate){
+				_num_swaps_accepted[k] += 1;
+				std::swap(_replicas[k], _replicas[k + 1]);
+				_tags[k].swap(_tags[k + 1]);
+				std::swap(_log_Pdata[k], _log_Pdata[k + 1]);
+				_replicas[k]->_temperature = _temperatures[k];
+				_replicas[k + 1]->_temperature = _temperatures[k + 1];
+			}
+		}
+		_num_rounds += 1;
+		for(int r = 0;r < _num_replicas;r++){
+			_replicas[r]->_stats = (r == 0) ? stats : NULL;
+		}
+		cold = _replicas[0];
+		_replicas[0] = NULL;
+		dataset._tag_ids.swap(_tags[0]);
+	}
+	// 各スレッドで実行される
+	// ハイパーパラメータも状態の一部なので高温側のモデルはここで更新する. 最も低い温度のモデルは呼び出し側が更新する
+	void perform_gibbs_sampling_with_replica(int r, uint64_t seed, Corpus &dataset){
+		Sampler::seed_stream(seed, r);
+		BayesianHMM* hmm = _replicas[r];
+		vector<int> &tags = _tags[r];
+		vector<int> rand_indices(dataset.size());
+		for(int data_index = 0;data_index < dataset.size();data_index++){
+			rand_indices[data_index] = data_index;
+		}
+		shuffle(rand_indices.begin(), rand_indices.end(), Sampler::rng);
+		if(hmm->_stats != NULL){
+			hmm->_stats->begin_sweep();
+		}
+		for(int data_index: rand_indices){
+			size_t begin = dataset._offsets[data_index];
+			Sentence line(&dataset._word_ids[begin], &tags[begin], dataset._offsets[data_index + 1] - begin);
+			hmm->perform_gibbs_sampling_with_line(line);
+		}
+		if(hmm->_stats != NULL){
+			hmm->_stats->end_sweep();
+		}
+		if(r > 0){
+			hmm->sample_new_alpha();
+			hmm->sample_new_beta();
+		}
+		_log_Pdata[r] = hmm->compute_log_Pdata();
+	}
+	double get_swap_acceptance_rate(int k){
+		assert(0 <= k && k < _num_replicas - 1);
+		if(_num_swaps_proposed[k] == 0){
+			return 0;
+		}
+		return _num_swaps_accepted[k] / (double)_num_swaps_proposed[k];
+	}
+};
+
+#endif
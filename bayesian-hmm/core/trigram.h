@@ -0,0 +1,283 @@
+#ifndef _trigram_
+#define _trigram_
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <vector>
+#include <utility>
+#include "stats.h"
+using namespace std;
+
+// これより品詞数が多ければ3-gramのカウントをブロック表現で持つ
+#define TRIGRAM_MAX_DENSE_TAGS 100
+
+// サンプリングで読む3-gramの行の向き
+enum{
+	TRIGRAM_ROW = 0,		// [a][b][*]
+	TRIGRAM_COLUMN,			// [a][*][c]
+	TRIGRAM_FIRST_AXIS,		// [*][b][c]
+	TRIGRAM_NUM_ORIENTATIONS,
+};
+
+// 文脈(行を決める2つの品詞の組)ごとの品詞数ぶんの行
+// EmissionCountsと同じく、多くの品詞が続く文脈だけ密な行で持ち、それ以外は(品詞, 回数)の組を並べた小さな疎な行で持つ
+// 一度も現れていない文脈は空の疎な行なので何も確保しない
+class TrigramRows{
+public:
+	int _num_tags;
+	int _max_sparse_size;	// これを超える数の品詞が続いたら密な行に切り替える
+	vector<int> _dense_index;	// 文脈から密な行の番号へ. 疎な行なら-1
+	vector<int> _dense_counts;	// 密な行をまとめた領域. 行ごとに_num_tags個
+	vector<vector<pair<int, int>>> _sparse_counts;	// 文脈から(品詞, 回数)の組へ
+	TrigramRows(){
+		_num_tags = 0;
+		_max_sparse_size = 0;
+	}
+	void init(int num_tags){
+		assert(num_tags > 0);
+		_num_tags = num_tags;
+		_max_sparse_size = std::max(4, num_tags / 8);
+		_dense_index.assign(num_tags * num_tags, -1);
+		_dense_counts.clear();
+		_sparse_counts.clear();
+		_sparse_counts.resize(num_tags * num_tags);
+	}
+	inline bool is_dense(int context) const {
+		return _dense_index[context] != -1;
+	}
+	inline int* dense_row(int context){
+		return &_dense_counts[0] + (size_t)_dense_index[context] * _num_tags;
+	}
+	inline const int* dense_row(int context) const {
+		return &_dense_counts[0] + (size_t)_dense_index[context] * _num_tags;
+	}
+	// 疎な行を密な行に移す
+	void promote(int context){
+		assert(is_dense(context) == false);
+		SamplerStats::count_allocation();
+		_dense_index[context] = _dense_counts.size() / _num_tags;
+		_dense_counts.resize(_dense_counts.size() + _num_tags, 0);
+		int* row = dense_row(context);
+		vector<pair<int, int>> &sparse = _sparse_counts[context];
+		for(const auto &elem: sparse){
+			row[elem.first] = elem.second;
+		}
+		vector<pair<int, int>>().swap(sparse);
+	}
+	// deltaは負でもよいが、カウントが負になってはいけない
+	void add(int context, int tag, int delta){
+		if(is_dense(context)){
+			int &count = dense_row(context)[tag];
+			count += delta;
+			assert(count >= 0);
+			return;
+		}
+		vector<pair<int, int>> &sparse = _sparse_counts[context];
+		for(int i = 0;i < sparse.size();i++){
+			if(sparse[i].first == tag){
+				sparse[i].second += delta;
+				assert(sparse[i].second >= 0);
+				if(sparse[i].second == 0){
+					sparse[i] = sparse.back();
+					sparse.pop_back();
+				}
+				return;
+			}
+		}
+		assert(delta > 0);
+		if(sparse.size() >= _max_sparse_size){
+			promote(context);
+			dense_row(context)[tag] = delta;
+			return;
+		}
+		if(sparse.size() == sparse.capacity()){
+			SamplerStats::count_allocation();
+		}
+		sparse.push_back(std::make_pair(tag, delta));
+	}
+	int get_count(int context, int tag) const {
+		if(is_dense(context)){
+			return dense_row(context)[tag];
+		}
+		for(const auto &elem: _sparse_counts[context]){
+			if(elem.first == tag){
+				return elem.second;
+			}
+		}
+		return 0;
+	}
+	// 文脈contextの全品詞についてのカウントを返す
+	// 密な行ならその行を、疎な行ならbufferに展開して返す
+	const int* get_row(int context, int* buffer) const {
+		if(is_dense(context)){
+			return dense_row(context);
+		}
+		memset(buffer, 0, _num_tags * sizeof(int));
+		for(const auto &elem: _sparse_counts[context]){
+			buffer[elem.first] = elem.second;
+		}
+		return buffer;
+	}
+	// 一度でもカウントされた文脈か
+	inline bool is_observed(int context) const {
+		return is_dense(context) || _sparse_counts[context].size() > 0;
+	}
+};
+
+// 品詞3-gramのカウント
+// サンプリングでは[t_{i-2}][t_{i-1}][*], [t_{i-1}][*][t_{i+1}], [*][t_{i+1}][t_{i+2}]の3通りの行を読む
+// 品詞数が少なければK^3の配列を2つ持ち(2つ目は後ろ2軸を転置したもの)、[*][b][c]は1つ目をK^2おきに読む
+// 品詞数が多いとK^3のほとんどは0なので、3通りの向きの行をそれぞれTrigramRowsで持つ(ブロック表現)
+// どちらでも行は品詞数ぶんの連続した領域として返すので、サンプリングのカーネルは同じものを使える
+class TrigramCounts{
+public:
+	int _num_tags;
+	bool _blocked;
+	vector<int> _dense;		// 密な表現の[a][b][c]
+	vector<int> _dense_t;	// 密な表現の[a][c][b]
+	TrigramRows _rows[TRIGRAM_NUM_ORIENTATIONS];	// ブロック表現
+	vector<int> _row_buffers;	// 疎な行を展開するためのキャッシュ. 向きごとに品詞数ぶん
+	TrigramCounts(){
+		_num_tags = 0;
+		_blocked = false;
+	}
+	static bool should_use_blocked(int num_tags){
+		return num_tags > TRIGRAM_MAX_DENSE_TAGS;
+	}
+	void init(int num_tags){
+		assert(num_tags > 0);
+		int K = num_tags;
+		_num_tags = K;
+		_blocked = should_use_blocked(K);
+		_row_buffers.assign(TRIGRAM_NUM_ORIENTATIONS * K, 0);
+		if(_blocked){
+			vector<int>().swap(_dense);
+			vector<int>().swap(_dense_t);
+			for(int i = 0;i < TRIGRAM_NUM_ORIENTATIONS;i++){
+				_rows[i].init(K);
+			}
+			return;
+		}
+		_dense.assign((size_t)K * K * K, 0);
+		_dense_t.assign((size_t)K * K * K, 0);
+		for(int i = 0;i < TRIGRAM_NUM_ORIENTATIONS;i++){
+			_rows[i] = TrigramRows();
+		}
+	}
+	// [a][b][*]
+	inline const int* row(int a, int b){
+		if(_blocked){
+			return _rows[TRIGRAM_ROW].get_row(a * _num_tags + b, &_row_buffers[TRIGRAM_ROW * _num_tags]);
+		}
+		return &_dense[0] + (size_t)(a * _num_tags + b) * _num_tags;
+	}
+	// [a][*][c]
+	inline const int* column(int a, int c){
+		if(_blocked){
+			return _rows[TRIGRAM_COLUMN].get_row(a * _num_tags + c, &_row_buffers[TRIGRAM_COLUMN * _num_tags]);
+		}
+		return &_dense_t[0] + (size_t)(a * _num_tags + c) * _num_tags;
+	}
+	// [*][b][c]
+	// 要素の間隔はfirst_axis_stride()
+	inline const int* first_axis(int b, int c){
+		if(_blocked){
+			return _rows[TRIGRAM_FIRST_AXIS].get_row(b * _num_tags + c, &_row_buffers[TRIGRAM_FIRST_AXIS * _num_tags]);
+		}
+		return &_dense[0] + b * _num_tags + c;
+	}
+	inline int first_axis_stride() const {
+		return _blocked ? 1 : _num_tags * _num_tags;
+	}
+	inline int get_count(int a, int b, int c) const {
+		if(_blocked){
+			return _rows[TRIGRAM_ROW].get_count(a * _num_tags + b, c);
+		}
+		return _dense[(size_t)(a * _num_tags + b) * _num_tags + c];
+	}
+	inline void add(int a, int b, int c, int delta){
+		int K = _num_tags;
+		if(_blocked){
+			_rows[TRIGRAM_ROW].add(a * K + b, c, delta);
+			_rows[TRIGRAM_COLUMN].add(a * K + c, b, delta);
+			_rows[TRIGRAM_FIRST_AXIS].add(b * K + c, a, delta);
+			return;
+		}
+		_dense[(size_t)(a * K + b) * K + c] += delta;
+		_dense_t[(size_t)(a * K + c) * K + b] += delta;
+	}
+	inline void increment(int a, int b, int c){
+		add(a, b, c, 1);
+	}
+	inline void decrement(int a, int b, int c){
+		assert(get_count(a, b, c) > 0);
+		add(a, b, c, -1);
+	}
+	// 一度でもカウントされた文脈[a][b]についてfunc(文脈a*K+b, 行)を呼ぶ
+	// 密な表現では全ての文脈について呼ぶ
+	template <typename Function>
+	void enumerate_rows(Function func){
+		int K = _num_tags;
+		for(int context = 0;context < K * K;context++){
+			if(_blocked && _rows[TRIGRAM_ROW].is_observed(context) == false){
+				continue;
+			}
+			func(context, row(context / K, context % K));
+		}
+	}
+	// 0でないカウントを(文脈a*K+b, 品詞c, 回数)の順に並べる
+	void get_nonzero(vector<int> &entries){
+		entries.clear();
+		int K = _num_tags;
+		enumerate_rows([&entries, K](int context, const int* counts){
+			for(int c = 0;c < K;c++){
+				if(counts[c] > 0){
+					entries.push_back(context);
+					entries.push_back(c);
+					entries.push_back(counts[c]);
+				}
+			}
+		});
+	}
+	// get_nonzeroで並べたものから作り直す
+	bool set_nonzero(const vector<int> &entries){
+		int K = _num_tags;
+		if(entries.size() % 3 != 0){
+			return false;
+		}
+		init(K);
+		for(size_t i = 0;i < entries.size();i += 3){
+			int context = entries[i];
+			int c = entries[i + 1];
+			int count = entries[i + 2];
+			if(context < 0 || context >= K * K || c < 0 || c >= K || count <= 0){
+				return false;
+			}
+			add(context / K, context % K, c, count);
+		}
+		return true;
+	}
+	// 密な表現で[a][b][c]の配列を書き換えた後に、転置した[a][c][b]を作り直す
+	// 保存するのは[a][b][c]だけで、読み込んだ後にこれを呼ぶ
+	void rebuild_transpose(){
+		assert(_blocked == false);
+		int K = _num_tags;
+		for(int a = 0;a < K;a++){
+			for(int b = 0;b < K;b++){
+				const int* row = &_dense[0] + (size_t)(a * K + b) * K;
+				for(int c = 0;c < K;c++){
+					_dense_t[(size_t)(a * K + c) * K + b] = row[c];
+				}
+			}
+		}
+	}
+	// 密な[a][b][c]の配列に書き出す. dataはK^3個の0で埋めた領域
+	void fill_dense(int* data){
+		int K = _num_tags;
+		enumerate_rows([data, K](int context, const int* counts){
+			memcpy(data + (size_t)context * K, counts, K * sizeof(int));
+		});
+	}
+};
+
+#endif
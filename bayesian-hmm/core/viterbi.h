@@ -0,0 +1,159 @@
+#ifndef _viterbi_
+#define _viterbi_
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include "bhmm.h"
+using namespace std;
+
+// 学習済みのカウントから作るビタビアルゴリズム用の表
+// 作った後は読むだけなので、複数のスレッドのデコーダで1つを共有できる
+class ViterbiTables{
+public:
+	vector<double> _log_Pt;			// log P(t_i|t_{i-2}, t_{i-1}) [t_{i-2}][t_{i-1}][t_i]
+	vector<double> _log_Pw_t_denominator;	// log(n_t + W_t * beta_t)
+	ViterbiTables(BayesianHMM* hmm){
+		int K = hmm->_num_tags;
+		assert(K > 0);
+		hmm->update_lookup_tables();
+		_log_Pt.resize(K * K * K);
+		for(int ti_2 = 0;ti_2 < K;ti_2++){
+			for(int ti_1 = 0;ti_1 < K;ti_1++){
+				const int* n_ti_2_ti_1_row = hmm->trigram_row(ti_2, ti_1);
+				double log_denominator = log(hmm->get_bigram_count(ti_2, ti_1) + K * hmm->_alpha);
+				double* row = &_log_Pt[(ti_2 * K + ti_1) * K];
+				for(int ti = 0;ti < K;ti++){
+					row[ti] = hmm->_log_alpha_table(n_ti_2_ti_1_row[ti]) - log_denominator;
+				}
+			}
+		}
+		_log_Pw_t_denominator.resize(K);
+		for(int tag = 0;tag < K;tag++){
+			_log_Pw_t_denominator[tag] = log(hmm->_unigram_counts[tag] + hmm->_Wt[tag] * hmm->_beta[tag]);
+		}
+	}
+};
+
+// 学習済みのカウントを使う2次HMMのビタビアルゴリズム
+// 状態は(t_{i-1}, t_i)の組で、1単語あたりO(K^3)
+// 品詞の遷移確率の対数はモデルが変わらない限り使い回す
+// 表を渡して作ったデコーダは作業領域だけを持つので、表を持つデコーダより先に消すこと
+class ViterbiDecoder{
+public:
+	int _num_tags;
+	BayesianHMM* _hmm;
+	const ViterbiTables* _tables;
+	bool _owns_tables;
+	vector<double> _log_Pw_t;		// 今の単語についてのlog P(w_i|t_i)
+	vector<double> _delta;			// [t_{i-1}][t_i]
+	vector<double> _next_delta;
+	vector<int> _backpointer;		// [i][t_{i-1}][t_i]からt_{i-2}へ
+	vector<int> _word_row_buffer;
+	ViterbiDecoder(BayesianHMM* hmm){
+		_tables = new ViterbiTables(hmm);
+		_owns_tables = true;
+		init(hmm);
+	}
+	ViterbiDecoder(BayesianHMM* hmm, const ViterbiTables* tables){
+		_tables = tables;
+		_owns_tables = false;
+		init(hmm);
+	}
+	~ViterbiDecoder(){
+		if(_owns_tables){
+			delete _tables;
+		}
+	}
+	void init(BayesianHMM* hmm){
+		_hmm = hmm;
+		_num_tags = hmm->_num_tags;
+		assert(_tables->_log_Pt.size() == (size_t)_num_tags * _num_tags * _num_tags);
+		int K = _num_tags;
+		_log_Pw_t.resize(K);
+		_delta.resize(K * K);
+		_next_delta.resize(K * K);
+		_word_row_buffer.resize(K);
+	}
+	void compute_log_Pw_t(int word_id){
+		const vector<double> &log_Pw_t_denominator = _tables->_log_Pw_t_denominator;
+		const int* n_wi_row = _hmm->_tag_word_counts.get_row(word_id, &_word_row_buffer[0]);
+		for(int tag = 0;tag < _num_tags;tag++){
+			_log_Pw_t[tag] = _hmm->_log_beta_tables[tag](n_wi_row[tag]) - log_Pw_t_denominator[tag];
+		}
+	}
+	// <bos>と<eos>を除いた単語列の品詞列を返す
+	// <bos>と<eos>の品詞は0
+	void decode(const vector<int> &word_ids, vector<int> &tags){
+		int K = _num_tags;
+		const vector<double> &log_Pt = _tables->_log_Pt;
+		int n = word_ids.size();
+		tags.assign(n, 0);
+		if(n == 0){
+			return;
+		}
+		_backpointer.resize(n * K * K);
+		// 1単語目はt_{i-2} = t_{i-1} = 0
+		compute_log_Pw_t(word_ids[0]);
+		std::fill(_delta.begin(), _delta.end(), -HUGE_VAL);
+		for(int ti = 0;ti < K;ti++){
+			_delta[ti] = log_Pt[ti] + _log_Pw_t[ti];
+		}
+		for(int i = 1;i < n;i++){
+			std::fill(_next_delta.begin(), _next_delta.end(), -HUGE_VAL);
+			for(int ti_2 = 0;ti_2 < K;ti_2++){
+				for(int ti_1 = 0;ti_1 < K;ti_1++){
+					double score = _delta[ti_2 * K + ti_1];
+					if(score == -HUGE_VAL){
+						continue;
+					}
+					const double* log_Pt_row = &log_Pt[(ti_2 * K + ti_1) * K];
+					double* next_row = &_next_delta[ti_1 * K];
+					int* backpointer_row = &_backpointer[(i * K + ti_1) * K];
+					for(int ti = 0;ti < K;ti++){
+						double next_score = score + log_Pt_row[ti];
+						if(next_score > next_row[ti]){
+							next_row[ti] = next_score;
+							backpointer_row[ti] = ti_2;
+						}
+					}
+				}
+			}
+			compute_log_Pw_t(word_ids[i]);
+			for(int ti_1 = 0;ti_1 < K;ti_1++){
+				double* next_row = &_next_delta[ti_1 * K];
+				for(int ti = 0;ti < K;ti++){
+					next_row[ti] += _log_Pw_t[ti];
+				}
+			}
+			_delta.swap(_next_delta);
+		}
+		// <eos>2つへの遷移
+		double max_score = -HUGE_VAL;
+		int argmax_ti_1 = 0;
+		int argmax_ti = 0;
+		for(int ti_1 = 0;ti_1 < K;ti_1++){
+			for(int ti = 0;ti < K;ti++){
+				double score = _delta[ti_1 * K + ti];
+				if(score == -HUGE_VAL){
+					continue;
+				}
+				score += log_Pt[(ti_1 * K + ti) * K] + log_Pt[(ti * K) * K];
+				if(score > max_score){
+					max_score = score;
+					argmax_ti_1 = ti_1;
+					argmax_ti = ti;
+				}
+			}
+		}
+		tags[n - 1] = argmax_ti;
+		if(n == 1){
+			return;
+		}
+		tags[n - 2] = argmax_ti_1;
+		for(int i = n - 1;i >= 2;i--){
+			tags[i - 2] = _backpointer[(i * K + tags[i - 1]) * K + tags[i]];
+		}
+	}
+};
+
+#endif
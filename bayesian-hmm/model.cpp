@@ -11,32 +11,55 @@
 #include <unordered_map>
 #include <functional>
 #include <fstream>
+#include <sstream>
+#include <thread>
+#include <mutex>
 #include <cassert>
 #include "core/bhmm.h"
+#include "core/cache.h"
+#include "core/checkpoint.h"
+#include "core/ffbs.h"
+#include "core/loader.h"
+#include "core/parallel.h"
+#include "core/stream.h"
+#include "core/tagger.h"
+#include "core/tempering.h"
+#include "core/viterbi.h"
+#include "core/vocabulary.h"
 #include "core/util.h"
 using namespace std;
 using namespace boost;
 
-struct value_comparator {
-	bool operator()(const pair<int, int> &a, const pair<int, int> &b) {
-		return a.second > b.second;
-	}   
-};
-
 class PyBayesianHMM{
 private:
 	BayesianHMM* _hmm;
-	unordered_map<int, wstring> _dictionary;
-	unordered_map<wstring, int> _dictionary_inv;
+	ParallelGibbsSampler* _parallel;
+	ViterbiDecoder* _decoder;	// モデルが変わったら作り直す
+	BlockedGibbsSampler* _blocked;
+	std::thread* _checkpoint_thread;	// チェックポイントを書き込み中のスレッド
+	bool _checkpoint_complete;
+	TagSnapshot* _tag_snapshot;			// 書き込み中のチェックポイントの品詞列
+	string _checkpoint_filename;		// 最後に書き込めたチェックポイント
+	uint64_t _checkpoint_corpus_id;		// それが参照するコーパスのファイルの番号. なければ0
+	uint64_t _checkpoint_corpus_revision;	// そのコーパスのファイルを書いた時の_corpus_revision
+	uint64_t _corpus_revision;			// コーパスか辞書を書き換えるたびに増える
+	IncrementalGibbsSampler _incremental;
+	ReplicaExchangeSampler* _tempering;	// 最も低い温度のモデルが_hmm
+	vector<double> _replica_temperatures;
+	SamplerStats _stats;	// 計測が有効なら_hmm->_statsがこれを指す
+	std::mutex _mutex;		// サンプリング中はGILの代わりにこれでモデルを守る
+	int _num_exports;		// Pythonに渡しているテーブルのビューの数
+	Vocabulary _vocabulary;
 	unordered_map<int, int> _word_count;
-	vector<vector<Word*>> _dataset;
+	Corpus _dataset;
 	vector<int> _rand_indices;
-	int _autoincrement;
 	int _bos_id;
 	int _eos_id;
 	int _unk_id;
 	int _max_num_words_in_line;
 	int _min_num_words_in_line;
+	int _num_threads;
+	int _sync_interval;
 public:
 	PyBayesianHMM(){
 		// 日本語周り
@@ -50,103 +73,136 @@ public:
 		wcin.imbue(ctype_default);
 
 		_hmm = new BayesianHMM();
-		_bos_id = 0;
-		_dictionary[_bos_id] = L"<bos>";
-		_eos_id = 1;
-		_dictionary[_eos_id] = L"<eos>";
-		_unk_id = 2;
-		_dictionary[_unk_id] = L"<unk>";
-		_autoincrement = _unk_id + 1;
+		_bos_id = _vocabulary.add_reserved(L"<bos>");
+		_eos_id = _vocabulary.add_reserved(L"<eos>");
+		_unk_id = _vocabulary.add_reserved(L"<unk>");
 
 		_max_num_words_in_line = -1;
 		_min_num_words_in_line = -1;
+
+		_parallel = NULL;
+		_decoder = NULL;
+		_blocked = NULL;
+		_checkpoint_thread = NULL;
+		_checkpoint_complete = true;
+		_tag_snapshot = NULL;
+		_checkpoint_corpus_id = 0;
+		_checkpoint_corpus_revision = 0;
+		_corpus_revision = 0;
+		_tempering = NULL;
+		_num_threads = 1;
+		_sync_interval = 0;
+		_num_exports = 0;
 	}
+	~PyBayesianHMM(){
+		// 書き込み中のスレッドはthisを参照しているので終わるまで待つ
+		finish_checkpoint();
+		discard_decoder();
+		discard_replicas();
+		discard_parallel();
+		delete _blocked;
+		delete _hmm;
+	}
+	// コーパスや辞書を読み書きするメソッドはサンプリングと並行して呼ばれうるのでロックを取る
+	// 中から呼ぶ下請けのメソッド(find_word_id, word_ids_from_line, add_word_ids)は取らない
 	int string_to_word_id(wstring word){
-		auto itr = _dictionary_inv.find(word);
-		if(itr == _dictionary_inv.end()){
+		ModelLock lock(_mutex);
+		return find_word_id(word);
+	}
+	// 辞書にない単語は<unk>
+	int find_word_id(const wstring &word){
+		int word_id = _vocabulary.find(word);
+		if(word_id == -1){
 			return _unk_id;
 		}
-		return itr->second;
+		return word_id;
 	}
 	int add_string(wstring word){
-		auto itr = _dictionary_inv.find(word);
-		if(itr == _dictionary_inv.end()){
-			_dictionary[_autoincrement] = word;
-			_dictionary_inv[word] = _autoincrement;
-			_autoincrement++;
-			return _autoincrement - 1;
-		}
-		return itr->second;
+		ModelLock lock(_mutex);
+		begin_corpus_update();
+		return _vocabulary.add(word);
 	}
 	void load_textfile(string filename){
+		ModelLock lock(_mutex);
+		begin_corpus_update();
 		c_printf("[*]%s\n", (boost::format("%sを読み込んでいます ...") % filename.c_str()).str().c_str());
-		wifstream ifs(filename.c_str());
-		wstring line_str;
-		if (ifs.fail()){
-			c_printf("[R]%s [*]%s", "エラー", (boost::format("%sを開けません.") % filename.c_str()).str().c_str());
-			exit(1);
-		}
-		while (getline(ifs, line_str) && !line_str.empty()){
+		bool complete = CorpusLoader::load(filename, [this](const wstring &word){
+			return _vocabulary.add(word);
+		}, [this](const vector<int> &word_ids){
 			if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
-				return;
+				return false;
 			}
-			add_line(line_str);
+			add_word_ids(word_ids);
+			return true;
+		});
+		if(complete == false){
+			return;
 		}
 		c_printf("[*]%s\n", (boost::format("%sを読み込みました.") % filename.c_str()).str().c_str());
 	}
 	void add_line(wstring line_str){
+		ModelLock lock(_mutex);
+		begin_corpus_update();
+		add_word_ids(word_ids_from_line(line_str));
+	}
+	// スペース区切りの文を単語IDの列にする. 辞書にない単語は登録する
+	vector<int> word_ids_from_line(const wstring &line_str){
 		vector<wstring> word_strs = split_word_by(line_str, L' ');	// スペースで分割
-		int num_words = word_strs.size();
+		vector<int> word_ids;
+		for(auto &word_str: word_strs){
+			if(word_str.size() == 0){
+				continue;
+			}
+			word_ids.push_back(_vocabulary.add(word_str));
+		}
+		return word_ids;
+	}
+	// 辞書に登録済みの単語IDの列を1文として追加
+	void add_word_ids(const vector<int> &word_ids){
+		int num_words = word_ids.size();
 		if(num_words > _max_num_words_in_line){
 			_max_num_words_in_line = num_words;
 		}
 		if(num_words < _max_num_words_in_line || _min_num_words_in_line == -1){
 			_min_num_words_in_line = num_words;
 		}
-		if(word_strs.size() > 0){
-			vector<Word*> words;
+		if(word_ids.size() > 0){
 			// <bos>
 			for(int n = 0;n < 2;n++){
-				Word* bos = new Word();
-				bos->word_id = _bos_id;
-				bos->tag_id = 0;
-				words.push_back(bos);
+				_dataset.add_word(_bos_id, 0);
 				_word_count[_bos_id] += 1;
 			}
-			for(auto &word_str: word_strs){
-				if(word_str.size() == 0){
-					continue;
-				}
-				Word* word = new Word();
-				word->word_id = add_string(word_str);
-				word->tag_id = 0;
-				words.push_back(word);
-				_word_count[word->word_id] += 1;
+			for(int word_id: word_ids){
+				_dataset.add_word(word_id, 0);
+				_word_count[word_id] += 1;
 			}
 			// <eos>も2つ追加しておくとt_{i+1}, t_{i+2}が常に存在するのでギブスサンプリング時に場合分けしなくてもいいかもしれない
 			for(int n = 0;n < 2;n++){
-				Word* eos = new Word();
-				eos->word_id = _eos_id;
-				eos->tag_id = 0;
-				words.push_back(eos);
+				_dataset.add_word(_eos_id, 0);
 				_word_count[_eos_id] += 1;
 			}
 			// 訓練データに追加
-			_dataset.push_back(words);
+			_dataset.end_sentence();
 		}
 	}
 	void initialize(){
+		ModelLock lock(_mutex);
+		if(tables_are_exported()){
+			return;
+		}
+		finish_checkpoint();
+		discard_decoder();
+		discard_replicas();
+		discard_parallel();
 		_hmm->initialize(_dataset);
 	}
 	void mark_low_frequency_words_as_unknown(int threshold = 1){
-		for(int data_index = 0;data_index < _dataset.size();data_index++){
-			vector<Word*> &line = _dataset[data_index];
-			for(auto word = line.begin(), end = line.end();word != end;word++){
-				int word_id = (*word)->word_id;
-				int count = get_count_for_word(word_id);
-				if(count <= threshold){
-					(*word)->word_id = _unk_id;
-				}
+		ModelLock lock(_mutex);
+		begin_corpus_update();
+		for(int &word_id: _dataset._word_ids){
+			int count = get_count_for_word(word_id);
+			if(count <= threshold){
+				word_id = _unk_id;
 			}
 		}
 	}
@@ -158,59 +214,626 @@ public:
 		return itr->second;
 	}
 	bool load(string dirname){
+		ModelLock lock(_mutex);
+		if(tables_are_exported()){
+			return false;
+		}
 		// 辞書を読み込み
+		// mmapするだけなので語彙が大きくてもすぐ終わる
+		// モデルを読み込めるまでは今の辞書を置き換えない
+		Vocabulary vocabulary;
 		string dictionary_filename = dirname + "/hmm.dict";
-		std::ifstream ifs(dictionary_filename);
-		if(ifs.good()){
-			boost::archive::binary_iarchive iarchive(ifs);
-			iarchive >> _dictionary;
-			iarchive >> _dictionary_inv;
-			iarchive >> _autoincrement;
-			ifs.close();
+		bool has_dictionary = std::ifstream(dictionary_filename).good();
+		if(has_dictionary && vocabulary.load(dictionary_filename) == false){
+			return false;
 		}
-		return _hmm->load(dirname);
+		discard_decoder();
+		discard_replicas();
+		discard_parallel();
+		if(_hmm->load(dirname) == false){
+			return false;
+		}
+		// モデルを読み込めた時だけ辞書を置き換える
+		if(has_dictionary){
+			begin_corpus_update();
+			_vocabulary = std::move(vocabulary);
+		}
+		return true;
 	}
 	bool save(string dirname){
+		ModelLock lock(_mutex);
 		// 辞書を保存
-		std::ofstream ofs(dirname + "/hmm.dict");
-		boost::archive::binary_oarchive oarchive(ofs);
-		oarchive << _dictionary;
-		oarchive << _dictionary_inv;
-		oarchive << _autoincrement;
-		ofs.close();
+		if(_vocabulary.save(dirname + "/hmm.dict") == false){
+			return false;
+		}
 		return _hmm->save(dirname);
 	}
+	// 辞書と単語の出現回数を書き出す
+	void write_vocabulary_state(CacheWriter &writer){
+		writer.write<int32_t>(_max_num_words_in_line);
+		writer.write<int32_t>(_min_num_words_in_line);
+		writer.write_vocabulary(_vocabulary);
+		writer.write<uint64_t>(_word_count.size());
+		for(const auto &elem: _word_count){
+			writer.write<int32_t>(elem.first);
+			writer.write<int32_t>(elem.second);
+		}
+	}
+	// 辞書とコーパスを書き出す
+	void write_corpus_state(CacheWriter &writer){
+		write_vocabulary_state(writer);
+		writer.write_corpus(_dataset);
+	}
+	// 全て読めた時だけ置き換える
+	// tag_idsがNULLでなければ品詞列は書かれていないものとして読み、代わりにtag_idsを使う
+	bool read_corpus_state(CacheReader &reader, vector<int>* tag_ids = NULL){
+		int32_t max_num_words_in_line, min_num_words_in_line;
+		uint64_t size;
+		Vocabulary vocabulary;
+		unordered_map<int, int> word_count;
+		Corpus dataset;
+		bool complete = reader.read(max_num_words_in_line) && reader.read(min_num_words_in_line) && reader.read_vocabulary(vocabulary);
+		// 予約語の単語IDは変わらない
+		complete = complete && vocabulary.get_num_reserved() == _vocabulary.get_num_reserved();
+		complete = complete && reader.read(size);
+		for(uint64_t n = 0;complete && n < size;n++){
+			int32_t word_id = 0, count = 0;
+			complete = reader.read(word_id) && reader.read(count);
+			word_count[word_id] = count;
+		}
+		if(tag_ids == NULL){
+			complete = complete && reader.read_corpus(dataset);
+		}else{
+			complete = complete && reader.read_vector(dataset._word_ids) && reader.read_vector(dataset._offsets);
+			complete = complete && dataset._offsets.size() > 0 && dataset._offsets.back() == dataset._word_ids.size() && tag_ids->size() == dataset._word_ids.size();
+			if(complete){
+				dataset._tag_ids.swap(*tag_ids);
+			}
+		}
+		if(complete == false){
+			return false;
+		}
+		begin_corpus_update();
+		_max_num_words_in_line = max_num_words_in_line;
+		_min_num_words_in_line = min_num_words_in_line;
+		_vocabulary = std::move(vocabulary);
+		_word_count = std::move(word_count);
+		_dataset = std::move(dataset);
+		return true;
+	}
+	// コーパスか辞書を書き換える前に呼ぶ
+	// 書き込み中のチェックポイントはそれらを複製せずに読んでいるので終わるまで待ち、次のチェックポイントではコーパスのファイルを書き直す
+	void begin_corpus_update(){
+		finish_checkpoint();
+		discard_decoder();
+		_corpus_revision++;
+	}
+	// 分かち書き済みのコーパスと辞書をバイナリで保存
+	bool save_corpus(string filename){
+		ModelLock lock(_mutex);
+		CacheWriter writer;
+		writer.open("bayesian-hmm");
+		write_corpus_state(writer);
+		if(writer.save(filename) == false){
+			c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sに書き込めません.") % filename.c_str()).str().c_str());
+			return false;
+		}
+		return true;
+	}
+	bool load_corpus(string filename){
+		ModelLock lock(_mutex);
+		CacheReader reader;
+		if(reader.open(filename, "bayesian-hmm") == false){
+			return false;
+		}
+		if(read_corpus_state(reader) == false){
+			c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sが壊れています.") % filename.c_str()).str().c_str());
+			return false;
+		}
+		_rand_indices.clear();
+		discard_decoder();
+		discard_replicas();
+		return true;
+	}
+	// 学習を再開するためのチェックポイント
+	// 品詞の割り当て, カウント, ハイパーパラメータ, 温度, 乱数の状態, データの順番を全て含む
+	// 辞書と単語列はfilename.<番号>.corpusに分けて書き、コーパスが前回のチェックポイントから変わっていなければ書き直さない
+	// ロックを持ったままこのスレッドで複製するのはカウントなどモデルの大きさのものとデータの順番だけで、
+	// 品詞列と辞書, 単語列は別スレッドが複製せずに少しずつ書き出す. 書き出す前に品詞を書き換える文はその直前に退避させる
+	// 書き込み中にコーパスや辞書を書き換えるメソッドを呼ぶと、書き込みが終わるまで待つ
+	// 乱数の状態は呼び出したスレッドのものなので、サンプリングと同じスレッドから呼ぶ
+	bool save_checkpoint(string filename){
+		ModelLock lock(_mutex);
+		if(finish_checkpoint() == false){
+			c_printf("[r]%s [*]%s\n", "エラー", "前回のチェックポイントを書き込めませんでした.");
+		}
+		// コーパスのファイルは、同じファイル名の前回のチェックポイントから変わっていなければ使い回す
+		uint64_t corpus_id = _checkpoint_corpus_id;
+		bool write_corpus = (corpus_id == 0 || _checkpoint_filename != filename || _checkpoint_corpus_revision != _corpus_revision);
+		if(write_corpus){
+			corpus_id = std::max<uint64_t>(chrono::system_clock::now().time_since_epoch().count(), _checkpoint_corpus_id + 1);
+		}
+		uint64_t corpus_revision = _corpus_revision;
+		CacheWriter* writer = new CacheWriter();
+		writer->open("bayesian-hmm-checkpoint-2");
+		_hmm->save_state(*writer);
+		writer->write_vector(_rand_indices);
+		ostringstream rng_state;
+		rng_state << Sampler::rng;
+		writer->write<uint64_t>(Sampler::get_seed());
+		writer->write_string(rng_state.str());
+		writer->write<int32_t>(_num_threads);
+		writer->write<int32_t>(_sync_interval);
+		_incremental.save_state(*writer);
+		writer->write<uint64_t>(corpus_id);
+		_tag_snapshot = new TagSnapshot(&_dataset);
+		_checkpoint_thread = new std::thread([this, writer, filename, corpus_id, corpus_revision, write_corpus](){
+			string corpus_filename = get_checkpoint_corpus_filename(filename, corpus_id);
+			bool complete = true;
+			if(write_corpus){
+				complete = save_checkpoint_corpus(corpus_filename);
+			}
+			complete = complete && writer->save(filename, [this](ostream &os){
+				return _tag_snapshot->write(os);
+			});
+			delete writer;
+			if(complete == false){
+				c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sに書き込めません.") % filename.c_str()).str().c_str());
+				if(write_corpus){
+					remove(corpus_filename.c_str());
+				}
+				_checkpoint_complete = false;
+				return;
+			}
+			// 前回のチェックポイントのコーパスのファイルはもう参照されない
+			if(write_corpus && _checkpoint_corpus_id != 0 && _checkpoint_filename == filename){
+				remove(get_checkpoint_corpus_filename(filename, _checkpoint_corpus_id).c_str());
+			}
+			_checkpoint_filename = filename;
+			_checkpoint_corpus_id = corpus_id;
+			_checkpoint_corpus_revision = corpus_revision;
+			_checkpoint_complete = true;
+		});
+		return true;
+	}
+	static string get_checkpoint_corpus_filename(const string &filename, uint64_t corpus_id){
+		return (boost::format("%s.%016x.corpus") % filename % corpus_id).str();
+	}
+	// 書き込み用のスレッドで呼ぶ. 書き込みが終わるまでコーパスと辞書は書き換えられない
+	bool save_checkpoint_corpus(const string &filename){
+		CacheWriter writer;
+		writer.open("bayesian-hmm-checkpoint-corpus");
+		write_vocabulary_state(writer);
+		// 品詞列はチェックポイントの方に書く
+		return writer.save(filename, [this](ostream &os){
+			CacheWriter::write_vector_to(os, _dataset._word_ids);
+			CacheWriter::write_vector_to(os, _dataset._offsets);
+			return os.good();
+		});
+	}
+	// 書き込み中のチェックポイントがあれば終わるまで待つ
+	// 戻り値は最後のチェックポイントを書き込めたかどうか
+	bool wait_for_checkpoint(){
+		ModelLock lock(_mutex);
+		return finish_checkpoint();
+	}
+	bool finish_checkpoint(){
+		if(_checkpoint_thread != NULL){
+			_checkpoint_thread->join();
+			delete _checkpoint_thread;
+			_checkpoint_thread = NULL;
+			delete _tag_snapshot;
+			_tag_snapshot = NULL;
+		}
+		return _checkpoint_complete;
+	}
+	// 文の品詞を書き換える前に呼ぶ. チェックポイントを書き込み中なら元の品詞列を退避させる
+	inline void preserve_for_checkpoint(int data_index){
+		if(_tag_snapshot != NULL){
+			_tag_snapshot->preserve(data_index);
+		}
+	}
+	// initialize()の代わりに呼ぶとチェックポイントから学習を再開できる
+	bool load_checkpoint(string filename){
+		ModelLock lock(_mutex);
+		if(tables_are_exported()){
+			return false;
+		}
+		finish_checkpoint();
+		CacheReader reader;
+		if(reader.open(filename, "bayesian-hmm-checkpoint-2") == false){
+			return false;
+		}
+		BayesianHMM* hmm = new BayesianHMM();
+		vector<int> rand_indices;
+		uint64_t seed;
+		string rng_state;
+		Xoshiro256 rng;
+		int32_t num_threads = 1, sync_interval = 0;
+		IncrementalGibbsSampler incremental;
+		uint64_t corpus_id = 0;
+		vector<int> tag_ids;
+		bool complete = hmm->load_state(reader)
+			&& reader.read_vector(rand_indices)
+			&& reader.read(seed)
+			&& reader.read_string(rng_state)
+			&& (istringstream(rng_state) >> rng)
+			&& reader.read(num_threads)
+			&& reader.read(sync_interval)
+			&& incremental.load_state(reader)
+			&& reader.read(corpus_id)
+			&& reader.read_vector(tag_ids);
+		CacheReader corpus_reader;
+		complete = complete && corpus_reader.open(get_checkpoint_corpus_filename(filename, corpus_id), "bayesian-hmm-checkpoint-corpus") && read_corpus_state(corpus_reader, &tag_ids);
+		if(complete == false){
+			c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sが壊れています.") % filename.c_str()).str().c_str());
+			delete hmm;
+			return false;
+		}
+		Sampler::set_seed(seed);
+		Sampler::rng = rng;
+		_rand_indices = std::move(rand_indices);
+		_num_threads = num_threads;
+		_sync_interval = sync_interval;
+		_incremental = incremental;
+		// 同じファイル名に書くチェックポイントは、コーパスが変わるまで読み込んだコーパスのファイルを使う
+		_checkpoint_filename = filename;
+		_checkpoint_corpus_id = corpus_id;
+		_checkpoint_corpus_revision = _corpus_revision;
+		// 古いモデルを参照しているものは作り直す
+		discard_decoder();
+		discard_replicas();
+		delete _blocked;
+		_blocked = NULL;
+		discard_parallel();
+		hmm->_stats = _hmm->_stats;
+		delete _hmm;
+		_hmm = hmm;
+		return true;
+	}
+	// サンプリング中はGILを手放すので、Python側の別のスレッドから評価やチェックポイントの書き出しを呼べる
+	// それらはSignalCheckerがロックを手放す合間に割り込む
+	// 合間に追加された文は次のスイープから引く. コーパスを読み込み直されて文が減ったらスイープを打ち切る
 	void perform_gibbs_sampling(){
+		SignalChecker checker(_mutex);
+		discard_decoder();
 		if(_rand_indices.size() != _dataset.size()){
 			_rand_indices.clear();
 			for(int data_index = 0;data_index < _dataset.size();data_index++){
 				_rand_indices.push_back(data_index);
 			}
 		}
-		shuffle(_rand_indices.begin(), _rand_indices.end(), Sampler::mt);	// データをシャッフル
-		for(int n = 0;n < _dataset.size();n++){
-			if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
-				return;
+		shuffle(_rand_indices.begin(), _rand_indices.end(), Sampler::rng);	// データをシャッフル
+		begin_sweep();
+		if(_num_threads > 1){
+			perform_gibbs_sampling_in_parallel(checker);
+		}else{
+			int num_lines = _rand_indices.size();
+			for(int n = 0;n < num_lines;n++){
+				if(checker.interrupted() || _dataset.size() < num_lines){		// ctrl+cが押されたかチェック
+					break;
+				}
+				int data_index = _rand_indices[n];
+				preserve_for_checkpoint(data_index);
+				Sentence line = _dataset[data_index];
+				_hmm->perform_gibbs_sampling_with_line(line);
+			}
+		}
+		end_sweep();
+		// 途中で作られたデコーダは古い
+		discard_decoder();
+	}
+	// 文ごとに品詞列をまとめてサンプリングする
+	// perform_gibbs_sampling()とはepochごとに切り替えてよい
+	void perform_blocked_gibbs_sampling(){
+		SignalChecker checker(_mutex);
+		discard_decoder();
+		if(_blocked == NULL || _blocked->_num_tags != _hmm->_num_tags){
+			delete _blocked;
+			_blocked = new BlockedGibbsSampler(_hmm);
+		}
+		if(_rand_indices.size() != _dataset.size()){
+			_rand_indices.clear();
+			for(int data_index = 0;data_index < _dataset.size();data_index++){
+				_rand_indices.push_back(data_index);
+			}
+		}
+		shuffle(_rand_indices.begin(), _rand_indices.end(), Sampler::rng);	// データをシャッフル
+		_blocked->prepare();
+		begin_sweep();
+		int num_lines = _rand_indices.size();
+		for(int n = 0;n < num_lines;n++){
+			if(checker.interrupted() || _dataset.size() < num_lines){		// ctrl+cが押されたかチェック
+				break;
 			}
 			int data_index = _rand_indices[n];
-			vector<Word*> &line = _dataset[data_index];
+			preserve_for_checkpoint(data_index);
+			Sentence line = _dataset[data_index];
+			_blocked->sample_line(line);
+		}
+		end_sweep();
+		discard_decoder();
+	}
+	// 直前のperform_blocked_gibbs_sampling()での採択率
+	double get_acceptance_rate_of_blocked_sampling(){
+		if(_blocked == NULL){
+			return 0;
+		}
+		return _blocked->get_acceptance_rate();
+	}
+	// 温度の異なるモデルを並行してサンプリングし、隣り合う温度のモデルを交換する
+	// perform_gibbs_sampling()の代わりに呼ぶ. 交換で_hmmが別のモデルに入れ替わることがある
+	void perform_replica_exchange_sampling(){
+		if(_replica_temperatures.size() < 2){
+			c_printf("[r]%s [*]%s\n", "エラー", "先にset_replica_temperatures()で2つ以上の温度を指定してください.");
+			return;
+		}
+		if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
+			return;
+		}
+		if(tables_are_exported()){
+			return;
+		}
+		SignalChecker checker(_mutex);
+		// 品詞列をレプリカと入れ替えるので、書き込み中のチェックポイントを先に終わらせる
+		finish_checkpoint();
+		discard_decoder();
+		if(_tempering != NULL && _tempering->_num_words != _dataset.get_num_words()){
+			discard_replicas();
+		}
+		if(_tempering == NULL){
+			_tempering = new ReplicaExchangeSampler(_replica_temperatures, _hmm, _dataset);
+		}
+		_tempering->perform_sampling(_hmm, _dataset);
+		// 古い_hmmを参照しているもの
+		delete _blocked;
+		_blocked = NULL;
+	}
+	void discard_replicas(){
+		if(_tempering != NULL){
+			delete _tempering;
+			_tempering = NULL;
+		}
+	}
+	// 温度kとk+1のモデルの交換の採択率
+	python::list get_swap_acceptance_rates(){
+		python::list rates;
+		if(_tempering == NULL){
+			return rates;
+		}
+		for(int k = 0;k < _tempering->_num_replicas - 1;k++){
+			rates.append(_tempering->get_swap_acceptance_rate(k));
+		}
+		return rates;
+	}
+	// 学習済みのモデルに文を追加し、届いた時点で品詞を引く
+	// linesはスペース区切りの文のリスト. 追加した文の数を返す
+	int add_lines_incrementally(python::list lines){
+		if(_hmm->_ngram_counts == NULL){
+			c_printf("[r]%s [*]%s\n", "エラー", "先にinitialize()を呼んでください.");
+			return 0;
+		}
+		// GILを手放す前にPythonのオブジェクトから取り出しておく
+		vector<wstring> line_strs;
+		int length = python::len(lines);
+		for(int i = 0;i < length;i++){
+			line_strs.push_back(python::extract<wstring>(lines[i]));
+		}
+		SignalChecker checker(_mutex);
+		begin_corpus_update();
+		discard_decoder();
+		discard_replicas();
+		int num_added = 0;
+		begin_sweep();
+		for(int i = 0;i < length;i++){
+			if(checker.interrupted()){		// ctrl+cが押されたかチェック
+				break;
+			}
+			int num_lines = _dataset.size();
+			add_word_ids(word_ids_from_line(line_strs[i]));
+			if(_dataset.size() == num_lines){	// 空行
+				continue;
+			}
+			_incremental.add_line(_hmm, _dataset);
+			num_added++;
+		}
+		_incremental.evict_lines(_hmm, _dataset);
+		end_sweep();
+		discard_decoder();
+		return num_added;
+	}
+	// 直近の文と、それより古い文から選んだ文だけを引き直す
+	void perform_incremental_gibbs_sampling(){
+		SignalChecker checker(_mutex);
+		discard_decoder();
+		// 合間にadd_lines_incrementally()が呼ばれると_incrementalの中身も文の位置も変わるので、複製しておき変わったら打ち切る
+		vector<int> indices = _incremental.get_lines_to_resample(_dataset);
+		int num_lines = _dataset.size();
+		int num_evicted_lines = _incremental._num_evicted_lines;
+		begin_sweep();
+		for(int data_index: indices){
+			if(checker.interrupted() || _dataset.size() != num_lines || _incremental._num_evicted_lines != num_evicted_lines){		// ctrl+cが押されたかチェック
+				break;
+			}
+			preserve_for_checkpoint(data_index);
+			Sentence line = _dataset[data_index];
 			_hmm->perform_gibbs_sampling_with_line(line);
 		}
+		end_sweep();
+		discard_decoder();
+	}
+	void perform_gibbs_sampling_in_parallel(SignalChecker &checker){
+		if(_parallel == NULL || _parallel->_num_threads != _num_threads || _parallel->_sync_interval != _sync_interval || _parallel->is_allocated_for(_hmm) == false){
+			delete _parallel;
+			_parallel = new ParallelGibbsSampler(_num_threads, _sync_interval);
+		}
+		int num_lines = _rand_indices.size();
+		int num_lines_per_round = _parallel->get_num_lines_per_round(num_lines);
+		for(int begin = 0;begin < num_lines;begin += num_lines_per_round){
+			if(checker.interrupted() || _dataset.size() < num_lines){		// ctrl+cが押されたかチェック
+				return;
+			}
+			int end = std::min(begin + num_lines_per_round, num_lines);
+			for(int n = begin;n < end;n++){
+				preserve_for_checkpoint(_rand_indices[n]);
+			}
+			_parallel->perform_gibbs_sampling(_hmm, _dataset, _rand_indices, begin, end);
+		}
+	}
+	// 計測が有効な時だけ何かする
+	void begin_sweep(){
+		if(_hmm->_stats != NULL){
+			_hmm->_stats->begin_sweep();
+		}
+	}
+	void end_sweep(){
+		if(_hmm->_stats != NULL){
+			_hmm->_stats->end_sweep();
+		}
+	}
+	// 乱数のシードを決める. initialize()より前に呼べば、同じシードとスレッド数で同じ結果になる
+	// 乱数はスレッドごとに持つので、学習を呼び出すのと同じスレッドから呼ぶ
+	void set_seed(uint64_t seed){
+		Sampler::set_seed(seed);
+	}
+	uint64_t get_seed(){
+		return Sampler::get_seed();
+	}
+	// 有効にするとサンプリングの各段階の時間や回数を数える
+	void set_stats_enabled(bool enabled){
+		ModelLock lock(_mutex);
+		_hmm->_stats = enabled ? &_stats : NULL;
+	}
+	bool get_stats_enabled(){
+		ModelLock lock(_mutex);
+		return _hmm->_stats != NULL;
+	}
+	// 最後にreset_stats()を呼んでからの計測結果
+	python::dict get_stats(){
+		ModelLock lock(_mutex);
+		return dict_from_stats(_stats);
+	}
+	void reset_stats(){
+		ModelLock lock(_mutex);
+		_stats.reset();
+	}
+	void discard_parallel(){
+		if(_parallel != NULL){
+			delete _parallel;
+			_parallel = NULL;
+		}
+	}
+	// モデルが書き換えられたら呼ぶ
+	// 並列サンプリングの各スレッドのモデルも、次の同期で丸ごと複製し直させる
+	void discard_decoder(){
+		if(_decoder != NULL){
+			delete _decoder;
+			_decoder = NULL;
+		}
+		if(_parallel != NULL){
+			_parallel->discard_worker_states();
+		}
+	}
+	ViterbiDecoder* get_decoder(){
+		if(_decoder == NULL){
+			_decoder = new ViterbiDecoder(_hmm);
+		}
+		return _decoder;
+	}
+	// 単語IDのリストを受け取りビタビアルゴリズムで品詞IDのリストを返す
+	python::list viterbi_decode(python::list word_ids){
+		ModelLock lock(_mutex);
+		ViterbiDecoder* decoder = get_decoder();
+		vector<int> word_id_vec;
+		vector<int> tags;
+		int length = python::len(word_ids);
+		for(int i = 0;i < length;i++){
+			word_id_vec.push_back(python::extract<int>(word_ids[i]));
+		}
+		decoder->decode(word_id_vec, tags);
+		python::list result;
+		for(int tag: tags){
+			result.append(tag);
+		}
+		return result;
+	}
+	// 単語IDのリストのリストを受け取り、それぞれの品詞IDのリストを返す
+	python::list viterbi_decode_batch(python::list sentences){
+		ModelLock lock(_mutex);
+		ViterbiDecoder* decoder = get_decoder();
+		vector<int> word_id_vec;
+		vector<int> tags;
+		python::list result;
+		int num_sentences = python::len(sentences);
+		for(int n = 0;n < num_sentences;n++){
+			python::list word_ids = python::extract<python::list>(sentences[n]);
+			int length = python::len(word_ids);
+			word_id_vec.clear();
+			for(int i = 0;i < length;i++){
+				word_id_vec.push_back(python::extract<int>(word_ids[i]));
+			}
+			decoder->decode(word_id_vec, tags);
+			python::list tag_list;
+			for(int tag: tags){
+				tag_list.append(tag);
+			}
+			result.append(tag_list);
+		}
+		return result;
+	}
+	// input_pathの各行の品詞をビタビアルゴリズムで推定し、"単語/品詞ID"を空白区切りで並べてoutput_pathに書き出す
+	// 単語はfind_word_id()で引くので、辞書にない単語は<unk>として扱う
+	// num_threadsが0以下ならコア数ぶんのスレッドを使う. 品詞ごとの単語数のリストを返す
+	python::list tag_file(string input_path, string output_path, int num_threads){
+		ModelLock lock(_mutex);
+		python::list result;
+		if(_hmm->_ngram_counts == NULL){
+			c_printf("[r]%s [*]%s\n", "エラー", "先にinitialize()かload()を呼んでください.");
+			return result;
+		}
+		vector<int> tag_counts;
+		bool complete;
+		{
+			// 遷移確率の表は1つだけ作って全てのスレッドで共有し、スレッドごとには作業領域だけを持つ
+			const ViterbiTables* tables = get_decoder()->_tables;
+			ReleaseGIL release;
+			vector<ViterbiDecoder*> decoders;
+			for(int t = 0;t < FileTagger::get_num_threads(num_threads);t++){
+				decoders.push_back(new ViterbiDecoder(_hmm, tables));
+			}
+			complete = FileTagger::tag(input_path, output_path, decoders, [this](const wstring &word){
+				return find_word_id(word);
+			}, tag_counts);
+			for(ViterbiDecoder* decoder: decoders){
+				delete decoder;
+			}
+		}
+		if(complete == false){
+			return result;
+		}
+		tag_counts.resize(_hmm->_num_tags, 0);
+		return list_from_vector(tag_counts);
 	}
 	int sample_tag_from_Pt_w(int ti_2, int ti_1, int wi){
+		ModelLock lock(_mutex);
 		return _hmm->sample_tag_from_Pt_w(ti_2, ti_1, wi);
 	}
 	int argmax_tag_from_Pt_w(int ti_2, int ti_1, int wi){
+		ModelLock lock(_mutex);
 		return _hmm->argmax_tag_from_Pt_w(ti_2, ti_1, wi);
 	}
 	void sample_new_alpha(){
-		_hmm->sample_new_alpha(_dataset);
+		ModelLock lock(_mutex);
+		discard_decoder();
+		_hmm->sample_new_alpha();
 	}
 	void show_alpha(){
 		cout << (boost::format("alpha <- %e") % _hmm->_alpha).str() << endl;
 	}
 	void sample_new_beta(){
-		_hmm->sample_new_beta(_dataset);
+		ModelLock lock(_mutex);
+		discard_decoder();
+		_hmm->sample_new_beta();
 	}
 	void show_beta(){
 		for(int tag = 0;tag < _hmm->_num_tags;tag++){
@@ -218,65 +841,159 @@ public:
 		}
 	}
 	void show_random_line(int num_to_show, bool show_most_co_occurring_tag = true){
+		ModelLock lock(_mutex);
 		for(int n = 0;n < num_to_show;n++){
 			int data_index = Sampler::uniform_int(0, _dataset.size() - 1);
-			vector<Word*> &line = _dataset[data_index];
+			Sentence line = _dataset[data_index];
 			for(int pos = 2;pos < line.size() - 2;pos++){
-				Word* word = line[pos];
-				int tag_id = word->tag_id;
+				int word_id = line.word_id(pos);
+				int tag_id = line.tag_id(pos);
 				if(show_most_co_occurring_tag){
-					tag_id = _hmm->get_most_co_occurring_tag(word->word_id);
+					tag_id = _hmm->get_most_co_occurring_tag(word_id);
 				}
-				wcout << _dictionary[word->word_id] << L"/" << tag_id << L" ";
+				wcout << _vocabulary.get_wstring(word_id) << L"/" << tag_id << L" ";
 			}
 			wcout << endl;
 		}
 	}
 	python::list get_all_words_for_each_tag(int threshold = 0){
+		ModelLock lock(_mutex);
 		vector<python::list> result;
+		vector<vector<pair<int, int>>> words_for_tag;
+		_hmm->_tag_word_counts.get_words_for_each_tag(words_for_tag);
 		for(int tag = 0;tag < _hmm->_num_tags;tag++){
+			vector<pair<int, int>> &word_counts = words_for_tag[tag];
+			word_counts.erase(std::remove_if(word_counts.begin(), word_counts.end(), [threshold](const pair<int, int> &elem){
+				return elem.second <= threshold;
+			}), word_counts.end());
+			std::sort(word_counts.begin(), word_counts.end(), TopKRanking::is_higher);
 			vector<python::tuple> words;
-			unordered_map<int, int> &word_counts = _hmm->_tag_word_counts[tag];
-			multiset<pair<int, int>, value_comparator> ranking;
 			for(auto elem: word_counts){
-				ranking.insert(std::make_pair(elem.first, elem.second));
-			}
-			for(auto elem: ranking){
-				if(elem.second <= threshold){
-					continue;
-				}
-				wstring word = _dictionary[elem.first];
+				wstring word = _vocabulary.get_wstring(elem.first);
 				words.push_back(python::make_tuple(word, elem.second));
 			}
 			result.push_back(list_from_vector(words));
 		}
 		return list_from_vector(result);
 	}
+	// 以下はカウントとハイパーパラメータをコピーせずに読み取り専用のmemoryviewで返す
+	// numpy.asarray()にそのまま渡せる. 値はサンプリングのたびに書き換わる
+	// ビューが残っている間はテーブルを確保し直す操作(initialize, load, load_checkpoint, set_num_tags, レプリカ交換法)はできない
+	// 品詞3-gramのカウント [t_{i-2}][t_{i-1}][t_i]
+	// 品詞数が多く3-gramをブロック表現で持っている時はK^3の配列がないので、呼び出した時点の値を書き出したものを返す
+	static python::object get_trigram_counts(python::object self){
+		PyBayesianHMM &model = python::extract<PyBayesianHMM&>(self);
+		ModelLock lock(model._mutex);
+		if(model.can_export_tables() == false){
+			return python::object();
+		}
+		TrigramCounts &counts = model._hmm->_trigram_counts;
+		int K = model._hmm->_num_tags;
+		vector<Py_ssize_t> shape(3, K);
+		if(counts._blocked){
+			int* data = (int*)calloc((size_t)K * K * K, sizeof(int));
+			counts.fill_dense(data);
+			return table_view(data, shape, NULL, NULL);
+		}
+		return table_view(counts._dense.data(), shape, self.ptr(), &model._num_exports);
+	}
+	// 品詞2-gramのカウント [t_{i-1}][t_i]
+	static python::object get_bigram_counts(python::object self){
+		PyBayesianHMM &model = python::extract<PyBayesianHMM&>(self);
+		return model.export_table(self, &BayesianHMM::_bigram_counts, 2);
+	}
+	// 品詞1-gramのカウント
+	static python::object get_unigram_counts(python::object self){
+		PyBayesianHMM &model = python::extract<PyBayesianHMM&>(self);
+		return model.export_table(self, &BayesianHMM::_unigram_counts, 1);
+	}
+	// 各品詞の可能な単語数
+	static python::object get_Wt(python::object self){
+		PyBayesianHMM &model = python::extract<PyBayesianHMM&>(self);
+		return model.export_table(self, &BayesianHMM::_Wt, 1);
+	}
+	static python::object get_beta(python::object self){
+		PyBayesianHMM &model = python::extract<PyBayesianHMM&>(self);
+		return model.export_table(self, &BayesianHMM::_beta, 1);
+	}
+	double get_alpha(){
+		return _hmm->_alpha;
+	}
+	// 品詞と単語のペアの出現頻度を、単語を行・品詞を列とするCSR形式の(indptr, indices, data)で返す
+	// scipy.sparse.csr_matrix((data, indices, indptr))で読める
+	// カウントは密な行と疎な行が混ざっているので呼び出した時点のものをC++側で並べ直すが、Pythonのオブジェクトは要素ごとに作らない
+	python::object get_emission_counts_csr(){
+		ModelLock lock(_mutex);
+		if(_hmm->_ngram_counts == NULL){
+			c_printf("[r]%s [*]%s\n", "エラー", "先にinitialize()を呼んでください.");
+			return python::object();
+		}
+		EmissionCounts &counts = _hmm->_tag_word_counts;
+		Py_ssize_t num_rows = counts._dense_index.size();
+		Py_ssize_t num_nonzero = counts.get_num_nonzero();
+		// 空の配列でもNULLにならないよう1要素多く確保する
+		int* indptr = (int*)malloc((num_rows + 1) * sizeof(int));
+		int* indices = (int*)malloc((num_nonzero + 1) * sizeof(int));
+		int* data = (int*)malloc((num_nonzero + 1) * sizeof(int));
+		counts.fill_csr(indptr, indices, data);
+		return python::make_tuple(
+			table_view(indptr, {num_rows + 1}, NULL, NULL),
+			table_view(indices, {num_nonzero}, NULL, NULL),
+			table_view(data, {num_nonzero}, NULL, NULL));
+	}
+	template<class T>
+	python::object export_table(python::object self, T* BayesianHMM::*table, int ndim){
+		ModelLock lock(_mutex);
+		if(can_export_tables() == false){
+			return python::object();
+		}
+		vector<Py_ssize_t> shape(ndim, _hmm->_num_tags);
+		return table_view(_hmm->*table, shape, self.ptr(), &_num_exports);
+	}
+	bool can_export_tables(){
+		if(_hmm->_ngram_counts == NULL){
+			c_printf("[r]%s [*]%s\n", "エラー", "先にinitialize()を呼んでください.");
+			return false;
+		}
+		// 交換で_hmmが別のモデルに入れ替わるので参照を渡せない
+		if(_tempering != NULL){
+			c_printf("[r]%s [*]%s\n", "エラー", "レプリカ交換法を使っている間はテーブルのビューを作れません.");
+			return false;
+		}
+		return true;
+	}
+	bool tables_are_exported(){
+		if(_num_exports == 0){
+			return false;
+		}
+		c_printf("[r]%s [*]%s\n", "エラー", "テーブルのビューが残っているので作り直せません. 先にdelやrelease()でビューを解放してください.");
+		return true;
+	}
 	void show_typical_words_for_each_tag(int number_to_show_for_each_tag){
+		ModelLock lock(_mutex);
+		vector<vector<pair<int, int>>> top_words;
+		_hmm->_tag_word_counts.get_top_words_for_each_tag(number_to_show_for_each_tag, top_words);
 		for(int tag = 0;tag < _hmm->_num_tags;tag++){
-			unordered_map<int, int> &word_counts = _hmm->_tag_word_counts[tag];
-			int n = 0;
 			c_printf("[*]%s\n", (boost::format("tag %d:") % tag).str().c_str());
 			wcout << L"\t";
-			multiset<pair<int, int>, value_comparator> ranking;
-			for(auto elem: word_counts){
-				ranking.insert(std::make_pair(elem.first, elem.second));
-			}
-			for(auto elem: ranking){
-				wstring word = _dictionary[elem.first];
+			for(auto elem: top_words[tag]){
+				wstring word = _vocabulary.get_wstring(elem.first);
 				wcout << word << L"/" << elem.second << L", ";
-				n++;
-				if(n > number_to_show_for_each_tag){
-					break;
-				}
 			}
 			wcout << endl;
 		}
 	}
 	void set_alpha(double alpha){
+		ModelLock lock(_mutex);
+		discard_decoder();
 		_hmm->_alpha = alpha;
 	}
 	void set_num_tags(int number){
+		ModelLock lock(_mutex);
+		if(tables_are_exported()){
+			return;
+		}
+		discard_decoder();
 		_hmm->_num_tags = number;
 	}
 	int get_num_tags(){
@@ -286,60 +1003,220 @@ public:
 		return _hmm->_temperature;
 	}
 	void set_temperature(double temperature){
+		ModelLock lock(_mutex);
 		_hmm->_temperature = temperature;
 	}
 	void set_Wt(python::list Wt){
+		ModelLock lock(_mutex);
+		discard_decoder();
 		int length = python::len(Wt);
 		for(int tag = 0;tag < length;tag++){
 			_hmm->set_Wt_for_tag(tag, python::extract<int>(Wt[tag]));
 		}
 	}
+	int get_num_threads(){
+		return _num_threads;
+	}
+	void set_num_threads(int num_threads){
+		if(num_threads < 1){
+			PyErr_SetString(PyExc_ValueError, "スレッド数は1以上を指定してください.");
+			python::throw_error_already_set();
+		}
+		ModelLock lock(_mutex);
+		_num_threads = num_threads;
+	}
+	bool get_use_mh_sampler(){
+		return _hmm->_use_mh_sampler;
+	}
+	// trueならエイリアス法とMH法による近似サンプラーを使う. falseなら厳密なGibbsサンプラー
+	void set_use_mh_sampler(bool use){
+		ModelLock lock(_mutex);
+		_hmm->_use_mh_sampler = use;
+	}
+	int get_num_mh_steps(){
+		return _hmm->_num_mh_steps;
+	}
+	void set_num_mh_steps(int steps){
+		if(steps < 1){
+			PyErr_SetString(PyExc_ValueError, "MH法のステップ数は1以上を指定してください.");
+			python::throw_error_already_set();
+		}
+		ModelLock lock(_mutex);
+		_hmm->_num_mh_steps = steps;
+	}
+	int get_sync_interval(){
+		return _sync_interval;
+	}
+	// 1スレッドあたり何文ごとにカウントを同期するか. 0ならエポックごと
+	void set_sync_interval(int interval){
+		if(interval < 0){
+			PyErr_SetString(PyExc_ValueError, "同期間隔は0以上を指定してください.");
+			python::throw_error_already_set();
+		}
+		ModelLock lock(_mutex);
+		_sync_interval = interval;
+	}
+	python::list get_replica_temperatures(){
+		python::list temperatures;
+		for(double temperature: _replica_temperatures){
+			temperatures.append(temperature);
+		}
+		return temperatures;
+	}
+	// レプリカ交換法で使う温度を低い順に指定する. 最初の温度が_hmmのモデルの温度になる
+	void set_replica_temperatures(python::list temperatures){
+		vector<double> ladder;
+		int length = python::len(temperatures);
+		for(int r = 0;r < length;r++){
+			double temperature = python::extract<double>(temperatures[r]);
+			if(temperature <= 0 || (r > 0 && temperature <= ladder.back())){
+				PyErr_SetString(PyExc_ValueError, "温度は正の値を低い順に指定してください.");
+				python::throw_error_already_set();
+			}
+			ladder.push_back(temperature);
+		}
+		ModelLock lock(_mutex);
+		discard_replicas();
+		_replica_temperatures = ladder;
+	}
+	int get_recent_window_size(){
+		return _incremental._window_size;
+	}
+	// perform_incremental_gibbs_sampling()で毎回引き直す直近の文の数
+	void set_recent_window_size(int size){
+		if(size < 0){
+			PyErr_SetString(PyExc_ValueError, "直近の文の数は0以上を指定してください.");
+			python::throw_error_already_set();
+		}
+		ModelLock lock(_mutex);
+		_incremental._window_size = size;
+	}
+	int get_reservoir_size(){
+		return _incremental._reservoir_size;
+	}
+	// 直近より古い文から一様に選んで引き直す文の数
+	void set_reservoir_size(int size){
+		if(size < 0){
+			PyErr_SetString(PyExc_ValueError, "リザーバの大きさは0以上を指定してください.");
+			python::throw_error_already_set();
+		}
+		ModelLock lock(_mutex);
+		_incremental._reservoir_size = size;
+		if(_incremental._reservoir.size() > size){
+			_incremental._reservoir.resize(size);
+		}
+	}
+	int get_max_num_lines(){
+		return _incremental._max_num_lines;
+	}
+	// add_lines_incrementally()で保持する文の上限. 超えたら古い文からカウントごと取り除く. 0なら取り除かない
+	void set_max_num_lines(int num_lines){
+		if(num_lines < 0){
+			PyErr_SetString(PyExc_ValueError, "文の上限は0以上を指定してください.");
+			python::throw_error_already_set();
+		}
+		ModelLock lock(_mutex);
+		_incremental._max_num_lines = num_lines;
+	}
+	int get_num_lines(){
+		ModelLock lock(_mutex);
+		return _dataset.size();
+	}
 	void set_minimum_temperature(double temperature){
+		ModelLock lock(_mutex);
 		_hmm->_minimum_temperature = temperature;
 	}
 	void anneal_temperature(double temperature){
+		ModelLock lock(_mutex);
 		_hmm->anneal_temperature(temperature);
 	}
 	int get_max_num_words_in_line(){
+		ModelLock lock(_mutex);
 		return _max_num_words_in_line;
 	}
 	int get_min_num_words_in_line(){
+		ModelLock lock(_mutex);
 		return _min_num_words_in_line;
 	}
 	int get_vocabrary_size(){
-		return _dictionary_inv.size();
+		ModelLock lock(_mutex);
+		return _vocabulary.get_num_searchable();
 	}
 };
 
 BOOST_PYTHON_MODULE(model){
-	python::class_<PyBayesianHMM>("bayesian_hmm")
+	python::class_<PyBayesianHMM, boost::noncopyable>("bayesian_hmm")
 	.def("string_to_word_id", &PyBayesianHMM::string_to_word_id)
 	.def("add_string", &PyBayesianHMM::add_string)
 	.def("perform_gibbs_sampling", &PyBayesianHMM::perform_gibbs_sampling)
+	.def("perform_blocked_gibbs_sampling", &PyBayesianHMM::perform_blocked_gibbs_sampling)
+	.def("perform_replica_exchange_sampling", &PyBayesianHMM::perform_replica_exchange_sampling)
 	.def("initialize", &PyBayesianHMM::initialize)
 	.def("mark_low_frequency_words_as_unknown", &PyBayesianHMM::mark_low_frequency_words_as_unknown)
 	.def("load", &PyBayesianHMM::load)
 	.def("save", &PyBayesianHMM::save)
 	.def("get_num_tags", &PyBayesianHMM::get_num_tags)
+	.def("get_stats", &PyBayesianHMM::get_stats)
+	.def("get_stats_enabled", &PyBayesianHMM::get_stats_enabled)
 	.def("get_all_words_for_each_tag", &PyBayesianHMM::get_all_words_for_each_tag)
+	.def("get_trigram_counts", &PyBayesianHMM::get_trigram_counts)
+	.def("get_bigram_counts", &PyBayesianHMM::get_bigram_counts)
+	.def("get_unigram_counts", &PyBayesianHMM::get_unigram_counts)
+	.def("get_Wt", &PyBayesianHMM::get_Wt)
+	.def("get_alpha", &PyBayesianHMM::get_alpha)
+	.def("get_beta", &PyBayesianHMM::get_beta)
+	.def("get_emission_counts_csr", &PyBayesianHMM::get_emission_counts_csr)
 	.def("get_temperature", &PyBayesianHMM::get_temperature)
+	.def("get_acceptance_rate_of_blocked_sampling", &PyBayesianHMM::get_acceptance_rate_of_blocked_sampling)
+	.def("get_num_threads", &PyBayesianHMM::get_num_threads)
+	.def("get_replica_temperatures", &PyBayesianHMM::get_replica_temperatures)
+	.def("get_swap_acceptance_rates", &PyBayesianHMM::get_swap_acceptance_rates)
+	.def("get_recent_window_size", &PyBayesianHMM::get_recent_window_size)
+	.def("get_reservoir_size", &PyBayesianHMM::get_reservoir_size)
+	.def("get_max_num_lines", &PyBayesianHMM::get_max_num_lines)
+	.def("get_num_lines", &PyBayesianHMM::get_num_lines)
+	.def("get_sync_interval", &PyBayesianHMM::get_sync_interval)
+	.def("get_use_mh_sampler", &PyBayesianHMM::get_use_mh_sampler)
+	.def("get_num_mh_steps", &PyBayesianHMM::get_num_mh_steps)
 	.def("get_max_num_words_in_line", &PyBayesianHMM::get_max_num_words_in_line)
 	.def("get_min_num_words_in_line", &PyBayesianHMM::get_min_num_words_in_line)
 	.def("get_vocabrary_size", &PyBayesianHMM::get_vocabrary_size)
 	.def("set_temperature", &PyBayesianHMM::set_temperature)
+	.def("set_seed", &PyBayesianHMM::set_seed)
+	.def("get_seed", &PyBayesianHMM::get_seed)
+	.def("set_stats_enabled", &PyBayesianHMM::set_stats_enabled)
+	.def("reset_stats", &PyBayesianHMM::reset_stats)
 	.def("set_num_tags", &PyBayesianHMM::set_num_tags)
 	.def("set_minimum_temperature", &PyBayesianHMM::set_minimum_temperature)
+	.def("set_num_threads", &PyBayesianHMM::set_num_threads)
+	.def("set_replica_temperatures", &PyBayesianHMM::set_replica_temperatures)
+	.def("set_recent_window_size", &PyBayesianHMM::set_recent_window_size)
+	.def("set_reservoir_size", &PyBayesianHMM::set_reservoir_size)
+	.def("set_max_num_lines", &PyBayesianHMM::set_max_num_lines)
+	.def("set_sync_interval", &PyBayesianHMM::set_sync_interval)
+	.def("set_use_mh_sampler", &PyBayesianHMM::set_use_mh_sampler)
+	.def("set_num_mh_steps", &PyBayesianHMM::set_num_mh_steps)
 	.def("set_Wt", &PyBayesianHMM::set_Wt)
 	.def("set_alpha", &PyBayesianHMM::set_alpha)
 	.def("add_line", &PyBayesianHMM::add_line)
+	.def("add_lines_incrementally", &PyBayesianHMM::add_lines_incrementally)
+	.def("perform_incremental_gibbs_sampling", &PyBayesianHMM::perform_incremental_gibbs_sampling)
 	.def("sample_new_alpha", &PyBayesianHMM::sample_new_alpha)
 	.def("sample_new_beta", &PyBayesianHMM::sample_new_beta)
 	.def("sample_tag_from_Pt_w", &PyBayesianHMM::sample_tag_from_Pt_w)
 	.def("argmax_tag_from_Pt_w", &PyBayesianHMM::argmax_tag_from_Pt_w)
+	.def("viterbi_decode", &PyBayesianHMM::viterbi_decode)
+	.def("viterbi_decode_batch", &PyBayesianHMM::viterbi_decode_batch)
+	.def("tag_file", &PyBayesianHMM::tag_file)
 	.def("anneal_temperature", &PyBayesianHMM::anneal_temperature)
 	.def("show_typical_words_for_each_tag", &PyBayesianHMM::show_typical_words_for_each_tag)
 	.def("show_random_line", &PyBayesianHMM::show_random_line)
 	.def("show_alpha", &PyBayesianHMM::show_alpha)
 	.def("show_beta", &PyBayesianHMM::show_beta)
-	.def("load_textfile", &PyBayesianHMM::load_textfile);
+	.def("load_textfile", &PyBayesianHMM::load_textfile)
+	.def("save_corpus", &PyBayesianHMM::save_corpus)
+	.def("load_corpus", &PyBayesianHMM::load_corpus)
+	.def("save_checkpoint", &PyBayesianHMM::save_checkpoint)
+	.def("load_checkpoint", &PyBayesianHMM::load_checkpoint)
+	.def("wait_for_checkpoint", &PyBayesianHMM::wait_for_checkpoint);
 }
\ No newline at end of file
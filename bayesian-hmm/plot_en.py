@@ -22,26 +22,35 @@ def main(args):
 	num_occurrence_of_pos_for_tag = {}
 	all_types_of_pos = set()
 	tagger = treetaggerwrapper.TreeTagger(TAGLANG="en")
+	pos_lists = []
+	word_id_lists = []
 	with codecs.open(args.filename, "r", "utf-8") as f:
 		for i, line in enumerate(f):
 			if i % 500 == 0:
 				sys.stdout.write("\r{}行目を処理中です ...".format(i))
 				sys.stdout.flush()
-			tag_ids = [0, 0]	# <bos>の品詞IDは0. 3-gramなので文脈は2つ
 			line = re.sub(ur"\n", "", line)	# 開業を消す
 			poses = tagger.tag_text(line)	# 形態素解析
+			pos_list = []
+			word_ids = []
 			for i, word_pos_lowercase in enumerate(poses):
 				pos = collapse_pos(word_pos_lowercase.split("\t")[1])
 				lowercase = collapse_pos(word_pos_lowercase.split("\t")[2])
 				all_types_of_pos.add(pos)
-				word_id = hmm.string_to_word_id(lowercase)
-				tag_id = hmm.argmax_tag_from_Pt_w(tag_ids[-2], tag_ids[-1], word_id)
-				tag_ids.append(tag_id)
-				if tag_id not in num_occurrence_of_pos_for_tag:
-					num_occurrence_of_pos_for_tag[tag_id] = {}
-				if pos not in num_occurrence_of_pos_for_tag[tag_id]:
-					num_occurrence_of_pos_for_tag[tag_id][pos] = 0
-				num_occurrence_of_pos_for_tag[tag_id][pos] += 1
+				pos_list.append(pos)
+				word_ids.append(hmm.string_to_word_id(lowercase))
+			pos_lists.append(pos_list)
+			word_id_lists.append(word_ids)
+
+	# 全ての文をまとめてビタビアルゴリズムで品詞を推定
+	tag_id_lists = hmm.viterbi_decode_batch(word_id_lists)
+	for pos_list, tag_ids in zip(pos_lists, tag_id_lists):
+		for pos, tag_id in zip(pos_list, tag_ids):
+			if tag_id not in num_occurrence_of_pos_for_tag:
+				num_occurrence_of_pos_for_tag[tag_id] = {}
+			if pos not in num_occurrence_of_pos_for_tag[tag_id]:
+				num_occurrence_of_pos_for_tag[tag_id][pos] = 0
+			num_occurrence_of_pos_for_tag[tag_id][pos] += 1
 
 	# 存在しない部分を0埋め
 	for tag, occurrence in num_occurrence_of_pos_for_tag.items():
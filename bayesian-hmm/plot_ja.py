@@ -21,14 +21,17 @@ def main(args):
 	num_occurrence_of_pos_for_tag = {}
 	all_types_of_pos = set()
 	major_pos_count = set()	# 品詞数（大分類）
+	pos_lists = []
+	word_id_lists = []
 	with codecs.open(args.filename, "r", "utf-8") as f:
 		tagger = MeCab.Tagger()
 		for i, line in enumerate(f):
 			if i % 500 == 0:
 				sys.stdout.write("\r{}行目を処理中です ...".format(i))
 				sys.stdout.flush()
-			tag_ids = [0, 0]	# <bos>の品詞IDは0. 3-gramなので文脈は2つ
 			line = re.sub(ur"\n", "", line)	# 開業を消す
+			pos_list = []
+			word_ids = []
 			string = line.encode("utf-8")
 			m = tagger.parseToNode(string)
 			while m:
@@ -45,14 +48,21 @@ def main(args):
 				if args.major:	# 品詞の大分類を使う場合
 					pos = major_pos
 				all_types_of_pos.add(pos)
-				tag_id = hmm.argmax_tag_from_Pt_w(tag_ids[-2], tag_ids[-1], word_id)
-				tag_ids.append(tag_id)
-				if tag_id not in num_occurrence_of_pos_for_tag:
-					num_occurrence_of_pos_for_tag[tag_id] = {}
-				if pos not in num_occurrence_of_pos_for_tag[tag_id]:
-					num_occurrence_of_pos_for_tag[tag_id][pos] = 0
-				num_occurrence_of_pos_for_tag[tag_id][pos] += 1
+				pos_list.append(pos)
+				word_ids.append(word_id)
 				m = m.next
+			pos_lists.append(pos_list)
+			word_id_lists.append(word_ids)
+
+	# 全ての文をまとめてビタビアルゴリズムで品詞を推定
+	tag_id_lists = hmm.viterbi_decode_batch(word_id_lists)
+	for pos_list, tag_ids in zip(pos_lists, tag_id_lists):
+		for pos, tag_id in zip(pos_list, tag_ids):
+			if tag_id not in num_occurrence_of_pos_for_tag:
+				num_occurrence_of_pos_for_tag[tag_id] = {}
+			if pos not in num_occurrence_of_pos_for_tag[tag_id]:
+				num_occurrence_of_pos_for_tag[tag_id][pos] = 0
+			num_occurrence_of_pos_for_tag[tag_id][pos] += 1
 
 	# 存在しない部分を0埋め
 	for tag, occurrence in num_occurrence_of_pos_for_tag.items():
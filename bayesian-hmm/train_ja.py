@@ -8,6 +8,41 @@ class stdout:
 	END = "\033[0m"
 	CLEAR = "\033[2K"
 
+def train(hmm, args):
+	if args.replica_temperatures is not None:
+		# 温度は固定するので焼きなましは行わない
+		hmm.set_replica_temperatures([float(temperature) for temperature in args.replica_temperatures.split(",")])
+	for epoch in xrange(1, args.epoch + 1):
+		start = time.time()
+
+		if args.replica_temperatures is not None:
+			hmm.perform_replica_exchange_sampling()	# 温度の異なるモデルを並行してサンプリングして交換する
+		elif args.blocked_interval > 0 and epoch % args.blocked_interval == 0:
+			hmm.perform_blocked_gibbs_sampling()	# 文ごとに品詞列をまとめてサンプリング
+		else:
+			hmm.perform_gibbs_sampling()
+		hmm.sample_new_alpha()
+		hmm.sample_new_beta()
+
+		elapsed_time = time.time() - start
+		sys.stdout.write("\rEpoch {} / {} - {:.3f} sec".format(epoch, args.epoch, elapsed_time))		
+		sys.stdout.flush()
+		if args.replica_temperatures is None:
+			hmm.anneal_temperature(args.anneal)	# 温度を下げる
+		if epoch % 10 == 0:
+			print "\n"
+			hmm.show_alpha()
+			hmm.show_beta()
+			hmm.show_random_line(20, True);	# ランダムなn個の文と推定結果のタグを表示
+			hmm.show_typical_words_for_each_tag(20);	# それぞれのタグにつき上位n個の単語を表示
+			print "temperature: ", hmm.get_temperature()
+			if args.replica_temperatures is not None:
+				print "swap: ", hmm.get_swap_acceptance_rates()
+			hmm.save(args.model);
+		if args.checkpoint_interval > 0 and epoch % args.checkpoint_interval == 0:
+			hmm.save_checkpoint(os.path.join(args.model, "checkpoint.bin"))	# 書き込みは裏で行われる
+	hmm.wait_for_checkpoint()
+
 def main(args):
 	if args.filename is None:
 		raise Exception()
@@ -17,6 +52,12 @@ def main(args):
 		pass
 
 	hmm = model.bayesian_hmm()
+	# 前回のチェックポイントから再開する場合は初期化を飛ばす
+	if args.resume and hmm.load_checkpoint(os.path.join(args.model, "checkpoint.bin")):
+		print stdout.BOLD + "チェックポイントから再開します" + stdout.END
+		train(hmm, args)
+		return
+
 	# 訓練データを分かち書きする
 	print stdout.BOLD + "データを準備しています ..." + stdout.END
 	word_count = set()	# 単語の種類の総数
@@ -73,25 +114,7 @@ def main(args):
 
 	hmm.set_temperature(args.start_temperature)	# 温度の初期設定
 	hmm.set_minimum_temperature(args.min_temperature)	# 温度の下限
-	for epoch in xrange(1, args.epoch + 1):
-		start = time.time()
-
-		hmm.perform_gibbs_sampling()
-		hmm.sample_new_alpha()
-		hmm.sample_new_beta()
-
-		elapsed_time = time.time() - start
-		sys.stdout.write("\rEpoch {} / {} - {:.3f} sec".format(epoch, args.epoch, elapsed_time))		
-		sys.stdout.flush()
-		hmm.anneal_temperature(args.anneal)	# 温度を下げる
-		if epoch % 10 == 0:
-			print "\n"
-			hmm.show_alpha()
-			hmm.show_beta()
-			hmm.show_random_line(20, True);	# ランダムなn個の文と推定結果のタグを表示
-			hmm.show_typical_words_for_each_tag(20);	# それぞれのタグにつき上位n個の単語を表示
-			print "temperature: ", hmm.get_temperature()
-			hmm.save(args.model);
+	train(hmm, args)
 
 if __name__ == "__main__":
 	parser = argparse.ArgumentParser()
@@ -104,4 +127,8 @@ if __name__ == "__main__":
 	parser.add_argument("--start-temperature", type=float, default=2, help="開始温度.")
 	parser.add_argument("--min-temperature", type=float, default=0.08, help="最小温度.")
 	parser.add_argument("--anneal", type=float, default=0.9989, help="温度の減少に使う係数.")
+	parser.add_argument("--blocked-interval", type=int, default=0, help="このepochごとに文単位のブロック化ギブスサンプリングを行う. 0なら行わない.")
+	parser.add_argument("--replica-temperatures", type=str, default=None, help="レプリカ交換法で使う温度を低い順にカンマ区切りで指定する(例: 1,1.02,1.04,1.06). 指定しなければ焼きなましを行う.")
+	parser.add_argument("--checkpoint-interval", type=int, default=0, help="このepochごとに学習を再開するためのチェックポイントを保存する. 0なら保存しない.")
+	parser.add_argument("--resume", dest="resume", default=False, action="store_true", help="保存フォルダのチェックポイントから学習を再開する.")
 	main(parser.parse_args())
\ No newline at end of file
@@ -0,0 +1,140 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "core/bench.h"
+#include "core/corpus.h"
+#include "core/hpylm.h"
+#include "core/lattice.h"
+#include "core/sampler.h"
+using namespace std;
+
+volatile double sink;
+
+// PyHpylmHMMのモデルを作るところだけを抜き出したもの
+class HpylmHMMFixture{
+public:
+	HPYLM* _pos_hpylm;
+	HPYLM** _word_hpylm_for_tag;
+	Lattice* _lattice;
+	Corpus _dataset;
+	int _num_tags;
+	// 文頭に<bos>を2つ、文末に<eos>を1つ置き、品詞をランダムに割り当ててモデルに追加する
+	HpylmHMMFixture(const BenchmarkCorpus &corpus, int num_tags){
+		Sampler::set_seed(0);
+		_num_tags = num_tags;
+		_pos_hpylm = new HPYLM(3);
+		_pos_hpylm->set_g0(1.0 / num_tags);
+		_word_hpylm_for_tag = new HPYLM*[num_tags];
+		for(int tag = 0;tag < num_tags;tag++){
+			_word_hpylm_for_tag[tag] = new HPYLM(3);
+			_word_hpylm_for_tag[tag]->set_g0(1.0 / corpus._num_word_types);
+		}
+		int max_num_words_in_sentence = 0;
+		for(const auto &words: corpus._lines){
+			for(int n = 0;n < 2;n++){
+				_dataset.add_word(BEGIN_OF_SENTENSE, BEGIN_OF_POS);
+			}
+			for(int word_id: words){
+				_dataset.add_word(word_id, Sampler::uniform_int(0, num_tags - 1));
+			}
+			_dataset.add_word(END_OF_SENTENSE, END_OF_POS);
+			_dataset.end_sentence();
+			max_num_words_in_sentence = std::max(max_num_words_in_sentence, (int)words.size() + 3);
+		}
+		vector<int> token_ids = {0, 0, 0};
+		for(int data_index = 0;data_index < _dataset.size();data_index++){
+			Sentence sentence = _dataset[data_index];
+			for(int t = 2;t < sentence.size();t++){
+				for(int n = 0;n < 3;n++){
+					token_ids[n] = sentence.tag_id(t - 2 + n);
+				}
+				_pos_hpylm->add_customer_at_timestep(token_ids, 2);
+				for(int n = 0;n < 3;n++){
+					token_ids[n] = sentence.word_id(t - 2 + n);
+				}
+				_word_hpylm_for_tag[sentence.tag_id(t)]->add_customer_at_timestep(token_ids, 2);
+			}
+		}
+		_lattice = new Lattice(max_num_words_in_sentence, num_tags, _pos_hpylm, _word_hpylm_for_tag);
+	}
+	~HpylmHMMFixture(){
+		delete _lattice;
+		delete _pos_hpylm;
+		for(int tag = 0;tag < _num_tags;tag++){
+			delete _word_hpylm_for_tag[tag];
+		}
+		delete[] _word_hpylm_for_tag;
+	}
+};
+void add_params(BenchmarkResult &result, const BenchmarkCorpus &corpus, int num_tags){
+	result.add_param("corpus", corpus._name);
+	result.add_param("num_tags", num_tags);
+	result.add_param("mean_line_length", corpus.get_mean_line_length());
+	result.add_param("num_words", (int)corpus.get_num_words());
+}
+// 1回で1文の前向き確率を計算し、次は続きの文から始める
+// 文末の<eos>は数えない
+void bench_forward_filtering(Benchmark &bench, const BenchmarkCorpus &corpus, int num_tags){
+	HpylmHMMFixture fixture(corpus, num_tags);
+	BenchmarkResult result("Lattice::forward_filtering", "token");
+	add_params(result, corpus, num_tags);
+	int data_index = 0;
+	bench.measure(result, [&](){
+		Sentence sentence = fixture._dataset[data_index];
+		fixture._lattice->forward_filtering(sentence);
+		data_index = (data_index + 1) % fixture._dataset.size();
+		return (uint64_t)(sentence.size() - 3);
+	});
+}
+// 学習中と同じく、単語とその前の2単語を今の品詞の単語HPYLMで引く
+void bench_compute_Pw_h(Benchmark &bench, const BenchmarkCorpus &corpus, int num_tags){
+	HpylmHMMFixture fixture(corpus, num_tags);
+	Corpus &dataset = fixture._dataset;
+	mt19937 mt(0);
+	uniform_int_distribution<int> line(0, dataset.size() - 1);
+	vector<pair<HPYLM*, vector<int>>> queries(1 << 14);
+	for(auto &query: queries){
+		Sentence sentence = dataset[line(mt)];
+		int t = uniform_int_distribution<int>(2, sentence.size() - 1)(mt);
+		query.first = fixture._word_hpylm_for_tag[sentence.tag_id(t)];
+		query.second = {sentence.word_id(t - 2), sentence.word_id(t - 1), sentence.word_id(t)};
+	}
+	BenchmarkResult result("HPYLM::compute_Pw_h", "lookup");
+	add_params(result, corpus, num_tags);
+	bench.measure(result, [&](){
+		double sum = 0;
+		for(auto &query: queries){
+			sum += query.first->compute_Pw_h(query.second[2], query.second);
+		}
+		sink = sum;
+		return (uint64_t)queries.size();
+	});
+}
+// usage: ./model.bench <テキストファイル> <出力するJSON> [1試行の秒数]
+int main(int argc, char** argv){
+	if(argc < 3){
+		cerr << "usage: " << argv[0] << " <textfile> <output.json> [min_seconds]" << endl;
+		return 1;
+	}
+	Benchmark bench;
+	if(argc > 3){
+		bench._min_seconds = atof(argv[3]);
+	}
+	vector<BenchmarkCorpus> corpora;
+	corpora.push_back(BenchmarkCorpus::load_textfile(argv[1], END_OF_SENTENSE + 1));
+	for(int line_length: {10, 30, 100}){
+		corpora.push_back(BenchmarkCorpus::generate(30000, line_length, 5000, END_OF_SENTENSE + 1));
+	}
+	for(const auto &corpus: corpora){
+		for(int num_tags: {5, 10, 20}){
+			bench_forward_filtering(bench, corpus, num_tags);
+			bench_compute_Pw_h(bench, corpus, num_tags);
+		}
+	}
+	if(bench.write_json(argv[2], BENCH_REVISION) == false){
+		c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sに書き込めません.") % argv[2]).str().c_str());
+		return 1;
+	}
+	return 0;
+}
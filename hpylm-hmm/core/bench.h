@@ -0,0 +1,176 @@
+#ifndef _bench_
+#define _bench_
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "loader.h"
+using namespace std;
+
+// カーネル単体のベンチマーク
+// Pythonに依存しないのでコアのヘッダだけでビルドできる
+// 結果はコミット間で比べられるようにJSONで書き出す
+
+// 1つの計測結果
+// 値はJSONに書き出す形で持つ
+class BenchmarkResult{
+public:
+	string _kernel;
+	string _unit;		// 1回の処理で数える単位. tokenなど
+	vector<pair<string, string>> _params;
+	vector<double> _ns_per_unit;	// 試行ごと
+	uint64_t _num_units;
+	BenchmarkResult(const string &kernel, const string &unit){
+		_kernel = kernel;
+		_unit = unit;
+		_num_units = 0;
+	}
+	void add_param(const string &name, int value){
+		_params.push_back(std::make_pair(name, to_string(value)));
+	}
+	void add_param(const string &name, double value){
+		char buffer[64];
+		snprintf(buffer, sizeof(buffer), "%.3f", value);
+		_params.push_back(std::make_pair(name, string(buffer)));
+	}
+	void add_param(const string &name, const string &value){
+		_params.push_back(std::make_pair(name, "\"" + value + "\""));
+	}
+	double get_min(){
+		return *std::min_element(_ns_per_unit.begin(), _ns_per_unit.end());
+	}
+	double get_median(){
+		vector<double> sorted = _ns_per_unit;
+		std::sort(sorted.begin(), sorted.end());
+		return sorted[sorted.size() / 2];
+	}
+};
+
+class Benchmark{
+public:
+	double _min_seconds;	// 1試行の最低時間
+	int _num_trials;
+	vector<BenchmarkResult> _results;
+	Benchmark(){
+		_min_seconds = 0.2;
+		_num_trials = 5;
+	}
+	// funcは1回呼ぶごとに処理した単位の数を返す
+	// 1度空回ししてから、最低時間に達するまで呼ぶ試行を繰り返す
+	template <class Func>
+	BenchmarkResult &measure(BenchmarkResult result, Func func){
+		func();
+		for(int trial = 0;trial < _num_trials;trial++){
+			uint64_t num_units = 0;
+			double elapsed = 0;
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			while(elapsed < _min_seconds){
+				num_units += func();
+				elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			}
+			result._ns_per_unit.push_back(elapsed * 1e9 / std::max((uint64_t)1, num_units));
+			result._num_units += num_units;
+		}
+		_results.push_back(result);
+		BenchmarkResult &last = _results.back();
+		fprintf(stderr, "%s", last._kernel.c_str());
+		for(const auto &param: last._params){
+			fprintf(stderr, " %s=%s", param.first.c_str(), param.second.c_str());
+		}
+		fprintf(stderr, ": %.1f ns/%s\n", last.get_min(), last._unit.c_str());
+		return last;
+	}
+	bool write_json(const string &filename, const string &revision){
+		FILE* fp = fopen(filename.c_str(), "w");
+		if(fp == NULL){
+			return false;
+		}
+		fprintf(fp, "{\n\t\"revision\": \"%s\",\n\t\"min_seconds\": %.3f,\n\t\"trials\": %d,\n\t\"results\": [", revision.c_str(), _min_seconds, _num_trials);
+		for(int n = 0;n < _results.size();n++){
+			BenchmarkResult &result = _results[n];
+			fprintf(fp, "%s\n\t\t{\"kernel\": \"%s\", \"params\": {", (n == 0) ? "" : ",", result._kernel.c_str());
+			for(int k = 0;k < result._params.size();k++){
+				fprintf(fp, "%s\"%s\": %s", (k == 0) ? "" : ", ", result._params[k].first.c_str(), result._params[k].second.c_str());
+			}
+			double min = result.get_min();
+			fprintf(fp, "}, \"unit\": \"%s\", \"ns_per_unit_min\": %.3f, \"ns_per_unit_median\": %.3f, \"units_per_sec\": %.1f, \"units\": %llu}",
+				result._unit.c_str(), min, result.get_median(), 1e9 / min, (unsigned long long)result._num_units);
+		}
+		fprintf(fp, "\n\t]\n}\n");
+		return fclose(fp) == 0;
+	}
+};
+
+// 行ごとの単語IDの列
+// 単語IDはfirst_word_idから振る. それより小さいIDは各モデルの<bos>などに使う
+class BenchmarkCorpus{
+public:
+	string _name;
+	vector<vector<int>> _lines;
+	int _num_word_types;
+	BenchmarkCorpus(){
+		_num_word_types = 0;
+	}
+	size_t get_num_words() const {
+		size_t num_words = 0;
+		for(const auto &words: _lines){
+			num_words += words.size();
+		}
+		return num_words;
+	}
+	double get_mean_line_length() const {
+		return _lines.size() > 0 ? get_num_words() / (double)_lines.size() : 0;
+	}
+	// 長さがmax_line_lengthを超える行は捨てる
+	static BenchmarkCorpus load_textfile(const string &filename, int first_word_id, int max_line_length = 0){
+		BenchmarkCorpus corpus;
+		corpus._name = filename.substr(filename.find_last_of('/') + 1);
+		unordered_map<wstring, int> dictionary;
+		CorpusLoader::load(filename, [&](const wstring &word){
+			auto itr = dictionary.find(word);
+			if(itr != dictionary.end()){
+				return itr->second;
+			}
+			int word_id = first_word_id + dictionary.size();
+			dictionary[word] = word_id;
+			return word_id;
+		}, [&](const vector<int> &word_ids){
+			if(word_ids.size() > 0 && (max_line_length <= 0 || word_ids.size() <= max_line_length)){
+				corpus._lines.push_back(word_ids);
+			}
+			return true;
+		});
+		corpus._num_word_types = dictionary.size();
+		return corpus;
+	}
+	// 単語の頻度がZipf則に従う人工コーパス
+	// 同じ引数なら常に同じものを作る
+	static BenchmarkCorpus generate(int num_words, int line_length, int num_word_types, int first_word_id, unsigned int seed = 0){
+		BenchmarkCorpus corpus;
+		corpus._name = "synthetic";
+		corpus._num_word_types = num_word_types;
+		vector<double> weights(num_word_types);
+		for(int rank = 0;rank < num_word_types;rank++){
+			weights[rank] = 1.0 / (rank + 1);
+		}
+		mt19937 mt(seed);
+		discrete_distribution<int> zipf(weights.begin(), weights.end());
+		int num_lines = std::max(1, num_words / line_length);
+		corpus._lines.resize(num_lines);
+		for(auto &words: corpus._lines){
+			for(int pos = 0;pos < line_length;pos++){
+				words.push_back(first_word_id + zipf(mt));
+			}
+		}
+		return corpus;
+	}
+};
+
+#ifndef BENCH_REVISION
+#define BENCH_REVISION "unknown"
+#endif
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef _cache_
+#define _cache_
+#include <boost/format.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "corpus.h"
+#include "cprintf.h"
+#include "loader.h"
+#include "vocabulary.h"
+using namespace std;
+
+// 分かち書き済みのコーパスのキャッシュファイル
+// 先頭にマジックナンバー, バージョン, モデルの種類を置き、その後に各モデルが必要なものを順に書く
+// 数値はそのままのバイト列で書くので、同じアーキテクチャでしか読めない
+#define CORPUS_CACHE_MAGIC "UPOSCRPS"
+#define CORPUS_CACHE_VERSION 2
+
+// 内容はメモリ上に書き溜めておき、save()で一時ファイルに書いてから名前を変える
+// 途中で落ちても前のファイルは壊れず、書き出しを別スレッドに任せることもできる
+class CacheWriter{
+public:
+	string _buffer;
+	void open(const string &kind){
+		_buffer.clear();
+		_buffer.append(CORPUS_CACHE_MAGIC, 8);
+		write<uint32_t>(CORPUS_CACHE_VERSION);
+		write_string(kind);
+	}
+	template <typename T>
+	void write(const T &value){
+		_buffer.append((const char*)&value, sizeof(T));
+	}
+	template <typename T>
+	void write_vector(const vector<T> &values){
+		write<uint64_t>(values.size());
+		write_array(values.data(), values.size());
+	}
+	template <typename T>
+	void write_array(const T* values, size_t size){
+		if(size > 0){
+			_buffer.append((const char*)values, size * sizeof(T));
+		}
+	}
+	// write_vectorと同じ形式で、溜めずにosへ直接書く
+	template <typename T>
+	static void write_vector_to(ostream &os, const vector<T> &values){
+		uint64_t size = values.size();
+		os.write((const char*)&size, sizeof(size));
+		if(size > 0){
+			os.write((const char*)values.data(), size * sizeof(T));
+		}
+	}
+	void write_string(const string &str){
+		write<uint32_t>(str.size());
+		_buffer.append(str.data(), str.size());
+	}
+	void write_wstring(const wstring &str){
+		write_string(wstring_to_utf8(str));
+	}
+	// ハッシュ表は読む時に作り直すので書かない
+	void write_vocabulary(const Vocabulary &vocabulary){
+		write<int32_t>(vocabulary.get_num_reserved());
+		write<uint64_t>(vocabulary.size() + 1);
+		write_array(vocabulary._offsets_view, vocabulary.size() + 1);
+		write<uint64_t>(vocabulary._offsets_view[vocabulary.size()]);
+		write_array(vocabulary._arena_view, vocabulary._offsets_view[vocabulary.size()]);
+	}
+	void write_corpus(const Corpus &corpus){
+		write_vector(corpus._word_ids);
+		write_vector(corpus._tag_ids);
+		write_vector(corpus._offsets);
+	}
+	bool save(const string &filename){
+		return save(filename, [](ostream &os){
+			return true;
+		});
+	}
+	// 溜めた内容の後に、大きくて複製したくないものをappendで直接書いてから名前を変える
+	template <typename Append>
+	bool save(const string &filename, Append append){
+		string tmp_filename = filename + ".tmp";
+		ofstream ofs(tmp_filename, ios::binary);
+		if(ofs.good() == false){
+			return false;
+		}
+		ofs.write(_buffer.data(), _buffer.size());
+		if(append(ofs) == false){
+			ofs.close();
+			remove(tmp_filename.c_str());
+			return false;
+		}
+		ofs.close();
+		if(ofs.fail()){
+			return false;
+		}
+		return rename(tmp_filename.c_str(), filename.c_str()) == 0;
+	}
+};
+
+// ファイルをmmapして先頭から順に読む
+class CacheReader{
+public:
+	MappedFile _file;
+	size_t _pos;
+	CacheReader(){
+		_pos = 0;
+	}
+	bool open(const string &filename, const string &kind){
+		if(_file.open(filename) == false){
+			return false;
+		}
+		if(_file._size < 8 || memcmp(_file._data, CORPUS_CACHE_MAGIC, 8) != 0){
+			c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sはコーパスのキャッシュではありません.") % filename.c_str()).str().c_str());
+			return false;
+		}
+		_pos = 8;
+		uint32_t version;
+		if(read(version) == false || version != CORPUS_CACHE_VERSION){
+			c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sはバージョンが異なります.") % filename.c_str()).str().c_str());
+			return false;
+		}
+		string file_kind;
+		if(read_string(file_kind) == false || file_kind != kind){
+			c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sは%s用のキャッシュではありません.") % filename.c_str() % kind.c_str()).str().c_str());
+			return false;
+		}
+		return true;
+	}
+	template <typename T>
+	bool read(T &value){
+		if(_pos + sizeof(T) > _file._size){
+			return false;
+		}
+		memcpy(&value, _file._data + _pos, sizeof(T));
+		_pos += sizeof(T);
+		return true;
+	}
+	template <typename T>
+	bool read_vector(vector<T> &values){
+		uint64_t size;
+		if(read(size) == false || size > (_file._size - _pos) / sizeof(T)){
+			return false;
+		}
+		values.resize(size);
+		if(size > 0){
+			memcpy(&values[0], _file._data + _pos, size * sizeof(T));
+		}
+		_pos += size * sizeof(T);
+		return true;
+	}
+	template <typename T>
+	bool read_array(T* values, size_t size){
+		if(size > (_file._size - _pos) / sizeof(T)){
+			return false;
+		}
+		if(size > 0){
+			memcpy(values, _file._data + _pos, size * sizeof(T));
+		}
+		_pos += size * sizeof(T);
+		return true;
+	}
+	bool read_string(string &str){
+		uint32_t size;
+		if(read(size) == false || size > _file._size - _pos){
+			return false;
+		}
+		str.assign(_file._data + _pos, size);
+		_pos += size;
+		return true;
+	}
+	bool read_wstring(wstring &str){
+		uint32_t size;
+		if(read(size) == false || size > _file._size - _pos){
+			return false;
+		}
+		str = utf8_to_wstring(_file._data + _pos, _file._data + _pos + size);
+		_pos += size;
+		return true;
+	}
+	bool read_vocabulary(Vocabulary &vocabulary){
+		int32_t num_reserved;
+		vector<uint64_t> offsets;
+		vector<char> arena;
+		if(read(num_reserved) == false || read_vector(offsets) == false || read_vector(arena) == false){
+			return false;
+		}
+		return vocabulary.assign(num_reserved, offsets, arena);
+	}
+	bool read_corpus(Corpus &corpus){
+		if(read_vector(corpus._word_ids) == false){
+			return false;
+		}
+		if(read_vector(corpus._tag_ids) == false){
+			return false;
+		}
+		if(read_vector(corpus._offsets) == false){
+			return false;
+		}
+		// 配列の長さが合っているか確認
+		if(corpus._offsets.size() == 0 || corpus._tag_ids.size() != corpus._word_ids.size() || corpus._offsets.back() != corpus._word_ids.size()){
+			return false;
+		}
+		return true;
+	}
+};
+
+#endif
@@ -13,9 +13,4 @@
 #define BEGIN_OF_POS 0
 #define END_OF_POS 0
 
-typedef struct Word {
-	int word_id;
-	int tag_id;
-} Word;
-
 #endif
\ No newline at end of file
@@ -10,6 +10,7 @@
 #include <unordered_map> 
 #include <cstdlib>
 #include <cassert>
+#include <fstream>
 #include "cprintf.h"
 #include "node.h"
 #include "const.h"
@@ -42,6 +43,7 @@ public:
 	// 深さmのノードに関するパラメータ
 	vector<double> _d_m;		// Pitman-Yor過程のディスカウント係数
 	vector<double> _theta_m;	// Pitman-Yor過程の集中度
+	vector<InverseTable> _inverse_theta_m;	// 1 / (θ + 客数)の表. θが変わった時だけ作り直す
 
 	// "A Bayesian Interpretation of Interpolated Kneser-Ney" Appendix C参照
 	// http://www.gatsby.ucl.ac.uk/~ywteh/research/compling/hpylm.pdf
@@ -134,6 +136,14 @@ public:
 		}
 		return p;
 	}
+	void update_lookup_tables(){
+		if(_inverse_theta_m.size() != _theta_m.size()){
+			_inverse_theta_m.resize(_theta_m.size());
+		}
+		for(int depth = 0;depth < _theta_m.size();depth++){
+			_inverse_theta_m[depth].update(_theta_m[depth]);
+		}
+	}
 	// 式に忠実な実装
 	double _compute_Pw_h(int token_id, vector<int> &context_token_ids){
 		// HPYLMでは深さは固定
@@ -152,18 +162,19 @@ public:
 	// 親の確率を計算しながら子を辿る
 	double compute_Pw_h(int token_id, vector<int> &context_token_ids){
 		assert(context_token_ids.size() >= _hpylm_depth);
+		update_lookup_tables();
 		double parent_Pw = _g0;
 		Node* node = _root;
 		for(int depth = 1;depth <= _hpylm_depth;depth++){
 			int context_token_id = context_token_ids[2 - depth];
 			Node* child = node->find_child_node(context_token_id, false);
-			parent_Pw = node->_compute_Pw(token_id, parent_Pw, _d_m, _theta_m);
+			parent_Pw = node->_compute_Pw(token_id, parent_Pw, _d_m, _theta_m, _inverse_theta_m);
 			if(child == NULL){
 				return parent_Pw;
 			}
 			node = child;
 		}
-		return node->_compute_Pw(token_id, parent_Pw, _d_m, _theta_m);
+		return node->_compute_Pw(token_id, parent_Pw, _d_m, _theta_m, _inverse_theta_m);
 	}
 	double compute_Pw(int token_id){
 		return _root->compute_Pw(token_id, _g0, _d_m, _theta_m);
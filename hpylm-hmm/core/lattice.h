@@ -7,6 +7,7 @@
 #include <cassert>
 #include <array>
 #include <cfloat>
+#include "corpus.h"
 #include "hpylm.h"
 #include "sampler.h"
 #include "cprintf.h"
@@ -21,12 +22,14 @@ public:
 	vector<int> _word_context;
 	int _max_num_words_in_sentence;
 	int _num_tags;
+	SamplerStats* _stats;	// 計測しないならNULL
 	// max_sentence_lengthは1文に含まれる最大単語数
 	Lattice(int max_num_words_in_sentence, int num_tags, HPYLM* pos_hpylm, HPYLM** word_hpylm_for_tag){
 		_num_tags = num_tags;
 		_max_num_words_in_sentence = max_num_words_in_sentence;
 		_word_hpylm_for_tag = word_hpylm_for_tag;
 		_pos_hpylm = pos_hpylm;
+		_stats = NULL;
 		_pos_context.push_back(0);
 		_pos_context.push_back(0);
 		_word_context.push_back(0);
@@ -34,8 +37,7 @@ public:
 		init_sampling_table(max_num_words_in_sentence, num_tags);
 	}
 	~Lattice(){
-		int size = _max_num_words_in_sentence + 1;
-		_alpha = new double**[size];
+		int size = _max_num_words_in_sentence;
 		for(int t = 0;t < size;t++){
 			for(int r = 0;r < _num_tags;r++){
 				delete[] _alpha[t][r];
@@ -70,9 +72,9 @@ public:
 	// word: j -> k -> t
 	// pos:  z -> q -> r
 	// 位置tの単語が品詞rから生成され、かつtより1つ前の単語が品詞qから生成される確率
-	void compute_alpha_t_r_q(vector<Word*> &sentence, int t, int r, int q){
+	void compute_alpha_t_r_q(Sentence &sentence, int t, int r, int q){
 		assert(t >= 2);
-		int token_t_id = sentence[t]->word_id;
+		int token_t_id = sentence.word_id(t);
 		// <bos>2つの場合
 		if(t == 2){
 			if(q != BEGIN_OF_POS){
@@ -97,7 +99,7 @@ public:
 			double Pz_qr = _pos_hpylm->compute_Pw_h(r, _pos_context);
 			HPYLM* word_hpylm = _word_hpylm_for_tag[r];
 			_word_context[0] = BEGIN_OF_SENTENSE;
-			_word_context[1] = sentence[t - 1]->word_id;
+			_word_context[1] = sentence.word_id(t - 1);
 			double Pt_h = word_hpylm->compute_Pw_h(token_t_id, _word_context);
 			_alpha[t][r][q] = Pt_h * Pz_qr * _alpha[t - 1][q][BEGIN_OF_POS];
 			// cout << (boost::format("_alpha[%d][%d][%d] <- %f * %f * %f") % t % r % q % Pt_h % Pz_qr % _alpha[t - 1][BEGIN_OF_POS][BEGIN_OF_POS]).str() << endl;
@@ -109,8 +111,8 @@ public:
 		for(int z = 0;z < _num_tags;z++){
 			HPYLM* word_hpylm = _word_hpylm_for_tag[z];
 			double Pz_qr = _pos_hpylm->compute_Pw_h(z, _pos_context);
-			_word_context[0] = sentence[t - 2]->word_id;
-			_word_context[1] = sentence[t - 1]->word_id;
+			_word_context[0] = sentence.word_id(t - 2);
+			_word_context[1] = sentence.word_id(t - 1);
 			double Pt_h = word_hpylm->compute_Pw_h(token_t_id, _word_context);
 			sum += Pt_h * Pz_qr * _alpha[t - 1][q][z];
 			// cout << (boost::format("sum += %f * %f * %f") % Pt_h % Pz_qr % _alpha[t - 1][q][z]).str() << endl;
@@ -118,7 +120,7 @@ public:
 		// cout << (boost::format("_alpha[%d][%d][%d] <- %f") % t % r % q % sum).str() << endl;
 		_alpha[t][r][q] = sum;
 	}
-	void forward_filtering(vector<Word*> &sentence){
+	void forward_filtering(Sentence &sentence){
 		// <bow>と<eos>の間の部分だけ考える
 		for(int t = 2;t < sentence.size() - 1;t++){
 			for(int r = 0;r < _num_tags;r++){
@@ -128,15 +130,15 @@ public:
 			}
 		}
 	}
-	void backward_sampling(vector<Word*> &sentence, bool argmax = false){
+	void backward_sampling(Sentence &sentence, bool argmax = false){
 		int r = 0;
 		int q = 0;
 		// <eop>に繋がる確率からサンプリング
-		sample_starting_r_and_q(sentence, r, q);
+		sample_starting_r_and_q(sentence, r, q, argmax);
 		int t = sentence.size() - 1;
-		sentence[t]->tag_id = r;
+		sentence.tag_id(t) = r;
 		t--;
-		sentence[t]->tag_id = q;
+		sentence.tag_id(t) = q;
 		t--;
 		// 後ろからサンプリング
 		while(t >= 2){
@@ -145,18 +147,19 @@ public:
 			}else{
 				sample_backward_r_and_q(sentence, t, r, q);
 			}
-			sentence[t]->tag_id = r;
+			sentence.tag_id(t) = r;
 			t--;
 			if(t < 2){	// <bos>を書き換えてはいけない
 				assert(q == BEGIN_OF_POS);
 				break;
 			}
-			sentence[t]->tag_id = q;
+			sentence.tag_id(t) = q;
 			t--;
 		}
 	}
 	// <eos>, EOPに接続する確率をもとにrとqをサンプリング
-	void sample_starting_r_and_q(vector<Word*> &sentence, int &sampled_r, int &sampled_q){
+	// argmaxがtrueなら最も確率の高い組を選ぶ
+	void sample_starting_r_and_q(Sentence &sentence, int &sampled_r, int &sampled_q, bool argmax = false){
 		double sum_p = 0;
 		int t = sentence.size() - 2;	// <eos>の1つ前
 		for(int r = 0;r < _num_tags;r++){
@@ -165,8 +168,8 @@ public:
 				_pos_context[1] = r;
 				double Pend_qr = _pos_hpylm->compute_Pw_h(END_OF_POS, _pos_context);
 				HPYLM* word_hpylm = _word_hpylm_for_tag[r];
-				_word_context[0] = sentence[t - 2]->word_id;
-				_word_context[1] = sentence[t - 1]->word_id;
+				_word_context[0] = sentence.word_id(t - 2);
+				_word_context[1] = sentence.word_id(t - 1);
 				double Pend_h = word_hpylm->compute_Pw_h(END_OF_SENTENSE, _word_context);
 				double p = Pend_h * Pend_qr * _alpha[t][r][q];
 				assert(p >= 0);
@@ -174,6 +177,10 @@ public:
 				sum_p += p;
 			}
 		}
+		if(argmax){
+			argmax_r_and_q(_sampling_table, sampled_r, sampled_q);
+			return;
+		}
 		double normalizer = 1.0 / sum_p;
 		double bernoulli = Sampler::uniform(0, 1);
 		sum_p = 0;
@@ -190,7 +197,7 @@ public:
 		sampled_r = _num_tags - 1;
 		sampled_q = _num_tags - 1;
 	}
-	void sample_backward_r_and_q(vector<Word*> &sentence, int t, int &sampled_r, int &sampled_q){
+	void sample_backward_r_and_q(Sentence &sentence, int t, int &sampled_r, int &sampled_q){
 		double sum_p = 0;
 		for(int r = 0;r < _num_tags;r++){
 			for(int q = 0;q < _num_tags;q++){
@@ -213,12 +220,18 @@ public:
 		sampled_r = _num_tags - 1;
 		sampled_q = (t == 3) ? END_OF_POS : _num_tags - 1;
 	}
-	void argmax_backward_r_and_q(vector<Word*> &sentence, int t, int &sampled_r, int &sampled_q){
+	void argmax_backward_r_and_q(Sentence &sentence, int t, int &sampled_r, int &sampled_q){
+		argmax_r_and_q(_alpha[t], sampled_r, sampled_q);
+	}
+	// table[r][q]が最大になるrとqを選ぶ
+	// 全て0(長い文でアンダーフローした場合など)ならsample_backward_r_and_qと同じく最後の品詞にする
+	void argmax_r_and_q(double** table, int &max_r, int &max_q){
 		double max_p = 0;
-		int max_r = -1, max_q = -1;
+		max_r = _num_tags - 1;
+		max_q = _num_tags - 1;
 		for(int r = 0;r < _num_tags;r++){
 			for(int q = 0;q < _num_tags;q++){
-				double p = _alpha[t][r][q];
+				double p = table[r][q];
 				if(p > max_p){
 					max_p = p;
 					max_r = r;
@@ -226,16 +239,63 @@ public:
 				}
 			}
 		}
-		sampled_r = max_r;
-		sampled_q = max_q;
-		assert(max_r != -1);
-		assert(max_q != -1);
 	}
-	void perform_blocked_gibbs_sampling(vector<Word*> &sentence, bool argmax = false){
+	void perform_blocked_gibbs_sampling(Sentence &sentence, bool argmax = false){
+		if(_stats != NULL){
+			_stats->begin_phase(STATS_PHASE_SCORE);
+		}
 		this->forward_filtering(sentence);
+		if(_stats != NULL){
+			_stats->begin_phase(STATS_PHASE_SAMPLE);
+		}
 		this->backward_sampling(sentence, argmax);
 	}
 };
 
+// 学習済みのHPYLMで各文の品詞の最大事後確率の列を求める
+// モデルは読むだけなので、スレッドごとに1つ作れば同時に使える
+// ラティスは今までで最も長い文に合わせて確保し、文ごとには作り直さない
+class LatticeDecoder{
+public:
+	HPYLM** _word_hpylm_for_tag;
+	HPYLM* _pos_hpylm;
+	Lattice* _lattice;
+	int _num_tags;
+	vector<int> _word_ids;	// <bos>2つと<eos>を付けたもの
+	vector<int> _tag_ids;
+	LatticeDecoder(int num_tags, HPYLM* pos_hpylm, HPYLM** word_hpylm_for_tag){
+		_num_tags = num_tags;
+		_pos_hpylm = pos_hpylm;
+		_word_hpylm_for_tag = word_hpylm_for_tag;
+		_lattice = NULL;
+		// 表の作り直しが各スレッドで起きないよう先に済ませておく
+		pos_hpylm->update_lookup_tables();
+		for(int tag = 0;tag < num_tags;tag++){
+			word_hpylm_for_tag[tag]->update_lookup_tables();
+		}
+	}
+	~LatticeDecoder(){
+		delete _lattice;
+	}
+	void decode(const vector<int> &word_ids, vector<int> &tags){
+		_word_ids.assign(2, BEGIN_OF_SENTENSE);
+		_tag_ids.assign(2, BEGIN_OF_POS);
+		for(int word_id: word_ids){
+			_word_ids.push_back(word_id);
+			_tag_ids.push_back(0);
+		}
+		_word_ids.push_back(END_OF_SENTENSE);
+		_tag_ids.push_back(END_OF_POS);
+		int size = _word_ids.size();
+		if(_lattice == NULL || _lattice->_max_num_words_in_sentence < size){
+			delete _lattice;
+			_lattice = new Lattice(size, _num_tags, _pos_hpylm, _word_hpylm_for_tag);
+		}
+		Sentence sentence(&_word_ids[0], &_tag_ids[0], size);
+		_lattice->perform_blocked_gibbs_sampling(sentence, true);
+		tags.assign(_tag_ids.begin() + 2, _tag_ids.end() - 1);
+	}
+};
+
 
 #endif
\ No newline at end of file
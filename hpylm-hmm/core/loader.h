@@ -0,0 +1,241 @@
+#ifndef _loader_
+#define _loader_
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cprintf.h"
+using namespace std;
+
+// UTF-8のバイト列をwstringに変換する
+// ロケールに依存しない. 不正なバイト列はU+FFFDにする
+inline wstring utf8_to_wstring(const char* begin, const char* end){
+	wstring str;
+	str.reserve(end - begin);
+	const unsigned char* ptr = (const unsigned char*)begin;
+	const unsigned char* last = (const unsigned char*)end;
+	while(ptr < last){
+		unsigned int ch = *ptr;
+		int num_trailing_bytes;
+		if(ch < 0x80){
+			num_trailing_bytes = 0;
+		}else if((ch & 0xE0) == 0xC0){
+			num_trailing_bytes = 1;
+			ch &= 0x1F;
+		}else if((ch & 0xF0) == 0xE0){
+			num_trailing_bytes = 2;
+			ch &= 0x0F;
+		}else if((ch & 0xF8) == 0xF0){
+			num_trailing_bytes = 3;
+			ch &= 0x07;
+		}else{
+			str += (wchar_t)0xFFFD;
+			ptr++;
+			continue;
+		}
+		ptr++;
+		bool valid = true;
+		for(int n = 0;n < num_trailing_bytes;n++){
+			if(ptr >= last || (*ptr & 0xC0) != 0x80){
+				valid = false;
+				break;
+			}
+			ch = (ch << 6) | (*ptr & 0x3F);
+			ptr++;
+		}
+		str += valid ? (wchar_t)ch : (wchar_t)0xFFFD;
+	}
+	return str;
+}
+
+// wstringをUTF-8のバイト列に変換する
+inline string wstring_to_utf8(const wstring &str){
+	string bytes;
+	bytes.reserve(str.size());
+	for(wchar_t wch: str){
+		unsigned int ch = wch;
+		if(ch < 0x80){
+			bytes += (char)ch;
+		}else if(ch < 0x800){
+			bytes += (char)(0xC0 | (ch >> 6));
+			bytes += (char)(0x80 | (ch & 0x3F));
+		}else if(ch < 0x10000){
+			bytes += (char)(0xE0 | (ch >> 12));
+			bytes += (char)(0x80 | ((ch >> 6) & 0x3F));
+			bytes += (char)(0x80 | (ch & 0x3F));
+		}else{
+			bytes += (char)(0xF0 | (ch >> 18));
+			bytes += (char)(0x80 | ((ch >> 12) & 0x3F));
+			bytes += (char)(0x80 | ((ch >> 6) & 0x3F));
+			bytes += (char)(0x80 | (ch & 0x3F));
+		}
+	}
+	return bytes;
+}
+
+// 読み込み専用でmmapしたファイル
+class MappedFile{
+public:
+	const char* _data;
+	size_t _size;
+	MappedFile(){
+		_data = NULL;
+		_size = 0;
+	}
+	~MappedFile(){
+		if(_data != NULL){
+			munmap((void*)_data, _size);
+		}
+	}
+	bool open(const string &filename){
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if(fd == -1){
+			return false;
+		}
+		struct stat st;
+		if(fstat(fd, &st) == -1){
+			::close(fd);
+			return false;
+		}
+		_size = st.st_size;
+		if(_size > 0){
+			void* ptr = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(ptr == MAP_FAILED){
+				::close(fd);
+				return false;
+			}
+			madvise(ptr, _size, MADV_SEQUENTIAL);
+			_data = (const char*)ptr;
+		}
+		::close(fd);
+		return true;
+	}
+};
+
+// 1スレッドぶんの分かち書きの結果
+// 単語にはチャンク内で出現順に局所IDを振り、文字列はバイト列のまま持つ
+class TokenizedChunk{
+public:
+	vector<int> _word_ids;		// 局所ID
+	vector<size_t> _offsets;	// i番目の行は[_offsets[i], _offsets[i + 1])
+	vector<string> _vocabulary;	// 局所IDからバイト列へ
+	unordered_map<string, int> _vocabulary_inv;
+	bool _skip_empty_lines;
+	TokenizedChunk(){
+		_skip_empty_lines = true;
+	}
+	void tokenize(const char* begin, const char* end){
+		_offsets.push_back(0);
+		string word;
+		const char* line_begin = begin;
+		while(line_begin < end){
+			const char* line_end = (const char*)memchr(line_begin, '\n', end - line_begin);
+			if(line_end == NULL){
+				line_end = end;
+			}
+			const char* word_begin = line_begin;
+			for(const char* ptr = line_begin;ptr <= line_end;ptr++){
+				if(ptr == line_end || *ptr == ' '){
+					if(ptr > word_begin){
+						word.assign(word_begin, ptr - word_begin);
+						auto itr = _vocabulary_inv.find(word);
+						if(itr == _vocabulary_inv.end()){
+							int local_id = _vocabulary.size();
+							_vocabulary.push_back(word);
+							_vocabulary_inv[word] = local_id;
+							_word_ids.push_back(local_id);
+						}else{
+							_word_ids.push_back(itr->second);
+						}
+					}
+					word_begin = ptr + 1;
+				}
+			}
+			// 空行は飛ばす
+			if(_skip_empty_lines == false || _word_ids.size() > _offsets.back()){
+				_offsets.push_back(_word_ids.size());
+			}
+			line_begin = line_end + 1;
+		}
+	}
+	int get_num_lines(){
+		return _offsets.size() - 1;
+	}
+};
+
+// [0, size)をnum_threads個のチャンクに分け、境界を返す
+// チャンクの境界は改行の直後に合わせる
+inline vector<size_t> split_at_line_boundaries(const char* data, size_t size, int num_threads){
+	vector<size_t> boundaries;
+	boundaries.push_back(0);
+	for(int t = 1;t < num_threads;t++){
+		size_t pos = std::max(boundaries.back(), size * t / num_threads);
+		while(pos < size && pos > 0 && data[pos - 1] != '\n'){
+			pos++;
+		}
+		boundaries.push_back(pos);
+	}
+	boundaries.push_back(size);
+	return boundaries;
+}
+
+// テキストファイルをmmapし、行単位で区切ったチャンクを複数スレッドで分かち書きする
+// 各チャンクの語彙はファイルの先頭から順にstring_to_idで全体の辞書に登録するので、
+// 単語IDの振られ方は1行ずつ読んだ場合と変わらない
+// add_lineは1行ぶんの単語IDを受け取り、falseを返すとそこで中断する
+class CorpusLoader{
+public:
+	template <class StringToId, class AddLine>
+	static bool load(const string &filename, StringToId string_to_id, AddLine add_line, int num_threads = 0){
+		MappedFile file;
+		if(file.open(filename) == false){
+			c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sを開けません.") % filename.c_str()).str().c_str());
+			exit(1);
+		}
+		if(num_threads <= 0){
+			num_threads = std::max(1, (int)thread::hardware_concurrency());
+		}
+		const char* data = file._data;
+		vector<size_t> boundaries = split_at_line_boundaries(data, file._size, num_threads);
+		vector<TokenizedChunk> chunks(num_threads);
+		vector<thread> threads;
+		for(int t = 0;t < num_threads;t++){
+			threads.emplace_back(&TokenizedChunk::tokenize, &chunks[t], data + boundaries[t], data + boundaries[t + 1]);
+		}
+		for(auto &th: threads){
+			th.join();
+		}
+		// 局所IDを全体のIDに直しながら行を追加
+		vector<int> local_to_global;
+		vector<int> word_ids;
+		for(auto &chunk: chunks){
+			local_to_global.resize(chunk._vocabulary.size());
+			for(int local_id = 0;local_id < chunk._vocabulary.size();local_id++){
+				const string &word = chunk._vocabulary[local_id];
+				local_to_global[local_id] = string_to_id(utf8_to_wstring(word.data(), word.data() + word.size()));
+			}
+			for(int n = 0;n < chunk.get_num_lines();n++){
+				word_ids.clear();
+				for(size_t i = chunk._offsets[n];i < chunk._offsets[n + 1];i++){
+					word_ids.push_back(local_to_global[chunk._word_ids[i]]);
+				}
+				if(add_line(word_ids) == false){
+					return false;
+				}
+			}
+			// 使い終わったチャンクは解放しておく
+			chunk = TokenizedChunk();
+		}
+		return true;
+	}
+};
+
+#endif
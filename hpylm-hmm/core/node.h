@@ -18,7 +18,9 @@
 #include <cassert>
 #include <chrono>
 #include "cprintf.h"
+#include "lookup.h"
 #include "sampler.h"
+#include "stats.h"
 #include "const.h"
 using namespace std;
 
@@ -26,6 +28,7 @@ class Node{
 private:
 	// 客をテーブルに追加
 	bool add_customer_to_table(int token_id, int table_k, double parent_Pw, vector<double> &d_m, vector<double> &theta_m, int &added_to_table_k){
+		SamplerStats::count_hash_probe();
 		if(_arrangement.find(token_id) == _arrangement.end()){
 			return add_customer_to_new_table(token_id, parent_Pw, d_m, theta_m, added_to_table_k);
 		}
@@ -40,11 +43,14 @@ private:
 		return false;
 	}
 	bool add_customer_to_new_table(int token_id, double parent_Pw, vector<double> &d_m, vector<double> &theta_m, int &added_to_table_k){
+		SamplerStats::count_hash_probe();
 		if(_arrangement.find(token_id) == _arrangement.end()){
 			vector<int> tables = {1};
 			_arrangement[token_id] = tables;
+			SamplerStats::count_allocation();
 		}else{
 			_arrangement[token_id].push_back(1);
+			SamplerStats::count_allocation();
 		}
 		_num_tables++;
 		_num_customers++;
@@ -58,6 +64,7 @@ private:
 		return true;
 	}
 	bool remove_customer_from_table(int token_id, int table_k, int &removed_from_table_k){
+		SamplerStats::count_hash_probe();
 		if(_arrangement.find(token_id) == _arrangement.end()){
 			c_printf("[r]%s [*]%s\n", "エラー:", "客を除去できません. _arrangement.find(token_id) == _arrangement.end()");
 			exit(1);
@@ -162,6 +169,7 @@ public:
 		return sum;
 	}
 	Node* find_child_node(int token_id, bool generate_if_not_exist = false){
+		SamplerStats::count_hash_probe();
 		auto itr = _children.find(token_id);
 		if (itr != _children.end()) {
 			return itr->second;
@@ -170,6 +178,7 @@ public:
 			return NULL;
 		}
 		Node* child = new Node(token_id);
+		SamplerStats::count_allocation();
 		child->_parent = this;
 		child->_depth = _depth + 1;
 		_children[token_id] = child;
@@ -182,6 +191,7 @@ public:
 		if(_parent){
 			parent_Pw = _parent->compute_Pw(token_id, g0, d_m, theta_m);
 		}
+		SamplerStats::count_hash_probe();
 		if(_arrangement.find(token_id) == _arrangement.end()){
 			add_customer_to_new_table(token_id, parent_Pw, d_m, theta_m, added_to_table_k);
 			if(update_n == true){
@@ -225,6 +235,7 @@ public:
 		return true;
 	}
 	bool remove_customer(int token_id, bool update_n, int &removed_from_table_k){
+		SamplerStats::count_hash_probe();
 		if(_arrangement.find(token_id) == _arrangement.end()){
 			c_printf("[r]%s [*]%s\n", "エラー:", "客を除去できません. _arrangement.find(token_id) == _arrangement.end()");
 			exit(1);
@@ -262,6 +273,7 @@ public:
 		double t_u = _num_tables;
 		double c_u = _num_customers;
 		double second_coeff = (theta_u + d_u * t_u) / (theta_u + c_u);
+		SamplerStats::count_hash_probe();
 		auto itr = _arrangement.find(token_id);
 		if(itr == _arrangement.end()){
 			if(_parent != NULL){
@@ -281,20 +293,22 @@ public:
 		// cout << (boost::format("%f <- %f + %f * %f") % (first_coeff + second_coeff * parent_Pw) % first_coeff % second_coeff % parent_Pw).str() << endl;
 		return first_coeff + second_coeff * parent_Pw;
 	}
-	double _compute_Pw(int token_id, double parent_Pw, vector<double> &d_m, vector<double> &theta_m){
+	// inverse_theta_mは深さごとの1 / (theta_u + c_u)の表
+	double _compute_Pw(int token_id, double parent_Pw, vector<double> &d_m, vector<double> &theta_m, vector<InverseTable> &inverse_theta_m){
 		double d_u = d_m[_depth];
 		double theta_u = theta_m[_depth];
 		double t_u = _num_tables;
-		double c_u = _num_customers;
+		double inv_theta_u_c_u = inverse_theta_m[_depth](_num_customers);
+		SamplerStats::count_hash_probe();
 		auto itr = _arrangement.find(token_id);
-		double second_coeff = (theta_u + d_u * t_u) / (theta_u + c_u);
+		double second_coeff = (theta_u + d_u * t_u) * inv_theta_u_c_u;
 		if(itr == _arrangement.end()){
 			return second_coeff * parent_Pw;
 		}
 		vector<int> &num_customers_at_table = itr->second;
 		double c_uw = std::accumulate(num_customers_at_table.begin(), num_customers_at_table.end(), 0);
 		double t_uw = num_customers_at_table.size();
-		double first_coeff = std::max(0.0, c_uw - d_u * t_uw) / (theta_u + c_u);
+		double first_coeff = std::max(0.0, c_uw - d_u * t_uw) * inv_theta_u_c_u;
 		return first_coeff + second_coeff * parent_Pw;
 	}
 	double compute_Pstop(double beta_stop, double beta_pass){
@@ -0,0 +1,109 @@
+#ifndef _stats_
+#define _stats_
+#include <chrono>
+#include <cstdint>
+using namespace std;
+
+// 1単語をサンプリングする間の段階
+enum{
+	STATS_PHASE_REMOVE = 0,		// 今の品詞をカウントから除く
+	STATS_PHASE_SCORE,			// 各品詞の確率を計算する
+	STATS_PHASE_SAMPLE,			// 品詞を引く
+	STATS_PHASE_ADD,			// 新しい品詞をカウントに加える
+	STATS_NUM_PHASES,
+	STATS_PHASE_NONE = -1,
+};
+
+// サンプラーのスループットと内訳の計測
+// モデルは計測が無効ならこのオブジェクトへのポインタをNULLにしておくので、各計測点の負担はNULLの判定だけになる
+// ハッシュ表の探索回数と確保の回数は計測点が深い所にあるので、スレッドごとの通し番号を常に数えておき、
+// begin_sweep()からend_sweep()までの差分を取り込む
+class SamplerStats{
+public:
+	static thread_local uint64_t _thread_hash_probes;
+	static thread_local uint64_t _thread_allocations;
+	uint64_t _num_tokens;
+	uint64_t _num_tag_changes;
+	uint64_t _num_hash_probes;
+	uint64_t _num_allocations;
+	uint64_t _num_sweeps;
+	double _elapsed_seconds;
+	double _phase_seconds[STATS_NUM_PHASES];
+	chrono::steady_clock::time_point _sweep_start;
+	chrono::steady_clock::time_point _phase_start;
+	int _phase;
+	uint64_t _hash_probes_at_start;
+	uint64_t _allocations_at_start;
+	SamplerStats(){
+		reset();
+	}
+	void reset(){
+		_num_tokens = 0;
+		_num_tag_changes = 0;
+		_num_hash_probes = 0;
+		_num_allocations = 0;
+		_num_sweeps = 0;
+		_elapsed_seconds = 0;
+		for(int phase = 0;phase < STATS_NUM_PHASES;phase++){
+			_phase_seconds[phase] = 0;
+		}
+		_phase = STATS_PHASE_NONE;
+	}
+	static inline void count_hash_probe(){
+		_thread_hash_probes += 1;
+	}
+	static inline void count_allocation(){
+		_thread_allocations += 1;
+	}
+	// サンプリングを行うスレッドで呼ぶ
+	void begin_sweep(){
+		_sweep_start = chrono::steady_clock::now();
+		_hash_probes_at_start = _thread_hash_probes;
+		_allocations_at_start = _thread_allocations;
+	}
+	void end_sweep(){
+		end_phase();
+		_elapsed_seconds += chrono::duration<double>(chrono::steady_clock::now() - _sweep_start).count();
+		_num_hash_probes += _thread_hash_probes - _hash_probes_at_start;
+		_num_allocations += _thread_allocations - _allocations_at_start;
+		_num_sweeps += 1;
+	}
+	// 前の段階を終えて次の段階を始める
+	inline void begin_phase(int phase){
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		if(_phase != STATS_PHASE_NONE){
+			_phase_seconds[_phase] += chrono::duration<double>(now - _phase_start).count();
+		}
+		_phase = phase;
+		_phase_start = now;
+	}
+	inline void end_phase(){
+		if(_phase == STATS_PHASE_NONE){
+			return;
+		}
+		_phase_seconds[_phase] += chrono::duration<double>(chrono::steady_clock::now() - _phase_start).count();
+		_phase = STATS_PHASE_NONE;
+	}
+	inline void count_token(int old_tag, int new_tag){
+		_num_tokens += 1;
+		if(old_tag != new_tag){
+			_num_tag_changes += 1;
+		}
+	}
+	// 別スレッドで計測したものをまとめる
+	// 経過時間はスレッドが並行して動いているので最も長いものを取る
+	void merge(const SamplerStats &other){
+		_num_tokens += other._num_tokens;
+		_num_tag_changes += other._num_tag_changes;
+		_num_hash_probes += other._num_hash_probes;
+		_num_allocations += other._num_allocations;
+		for(int phase = 0;phase < STATS_NUM_PHASES;phase++){
+			_phase_seconds[phase] += other._phase_seconds[phase];
+		}
+	}
+};
+
+thread_local uint64_t SamplerStats::_thread_hash_probes = 0;
+thread_local uint64_t SamplerStats::_thread_allocations = 0;
+
+#endif
@@ -11,35 +11,37 @@
 #include <unordered_map>
 #include <functional>
 #include <fstream>
+#include <mutex>
 #include <cassert>
+#include "core/cache.h"
 #include "core/hpylm.h"
 #include "core/lattice.h"
+#include "core/loader.h"
+#include "core/ranking.h"
+#include "core/tagger.h"
 #include "core/util.h"
+#include "core/vocabulary.h"
 using namespace std;
 using namespace boost;
 
-struct value_comparator {
-	bool operator()(const pair<int, int> &a, const pair<int, int> &b) {
-		return a.second > b.second;
-	}   
-};
-
 class PyHpylmHMM{
 private:
 	HPYLM** _word_hpylm_for_tag;
 	HPYLM* _pos_hpylm;
 	Lattice* _lattice;
-	unordered_map<int, wstring> _dictionary;
-	unordered_map<wstring, int> _dictionary_inv;
-	vector<vector<Word*>> _train_dataset;
-	vector<vector<Word*>> _test_dataset;
+	Vocabulary _vocabulary;
+	Corpus _train_dataset;
+	Corpus _test_dataset;
 	vector<int> _rand_indices;
 	set<int> _types_of_words;
-	int _autoincrement;
 	int _num_tags;
 	int _max_num_words_in_sentence;	// 1文あたりの最大単語数
 	bool _is_ready;
 	bool _is_first_run;
+	bool _stats_enabled;
+	SamplerStats _stats;
+	vector<int> _old_tag_ids;	// 計測用
+	std::mutex _mutex;		// サンプリング中はGILの代わりにこれでモデルを守る
 public:
 	PyHpylmHMM(int num_tags){
 		// 日本語周り
@@ -60,11 +62,11 @@ public:
 		}
 		_lattice = NULL;
 		_num_tags = num_tags;
-		_dictionary[BEGIN_OF_SENTENSE] = L"<bos>";
-		_dictionary[END_OF_SENTENSE] = L"<eos>";
-		_autoincrement = END_OF_SENTENSE + 1;
+		// BEGIN_OF_SENTENSEとEND_OF_SENTENSEはどちらも0
+		_vocabulary.add_reserved(L"<eos>");
 		_max_num_words_in_sentence = 0;
 		_is_ready = false;
+		_stats_enabled = false;
 	}
 	~PyHpylmHMM(){
 		delete _pos_hpylm;
@@ -73,98 +75,150 @@ public:
 		}
 		delete[] _word_hpylm_for_tag;
 	}
-	int string_to_word_id(wstring &word){
-		auto itr = _dictionary_inv.find(word);
-		if(itr == _dictionary_inv.end()){
-			_dictionary[_autoincrement] = word;
-			_dictionary_inv[word] = _autoincrement;
-			_autoincrement++;
-			return _autoincrement - 1;
+	// コーパスや辞書を読み書きするメソッドはサンプリングと並行して呼ばれうるのでロックを取る
+	// 中から呼ぶ下請けのメソッド(find_word_id, add_word_ids)は取らない
+	int string_to_word_id(const wstring &word){
+		ModelLock lock(_mutex);
+		return _vocabulary.add(word);
+	}
+	// 辞書を引くだけで登録はしない
+	// 辞書にない単語はどのHPYLMにも現れないIDにするので、基底分布からの確率になる
+	int find_word_id(const wstring &word){
+		int word_id = _vocabulary.find(word);
+		if(word_id == -1){
+			return _vocabulary.size();
 		}
-		return itr->second;
+		return word_id;
 	}
 	void load_textfile(string filename, double split_probability=0.05){
+		ModelLock lock(_mutex);
 		c_printf("[*]%s\n", (boost::format("%sを読み込んでいます ...") % filename.c_str()).str().c_str());
-		wifstream ifs(filename.c_str());
-		wstring line_str;
-		if (ifs.fail()){
-			c_printf("[R]%s [*]%s", "エラー", (boost::format("%sを開けません.") % filename.c_str()).str().c_str());
-			exit(1);
-		}
 		int prev_train_dataset_size = _train_dataset.size();
 		int prev_test_dataset_size = _test_dataset.size();
-		while (getline(ifs, line_str) && !line_str.empty()){
-			vector<wstring> word_strs = split_word_by(line_str, L' ');	// スペースで分割
-			if(word_strs.size() > 0){
-				vector<Word*> words;
-				// <bos>
-				// 3-gramなので2つ
-				for(int n = 0;n < 2;n++){
-					Word* bos = new Word();
-					bos->word_id = BEGIN_OF_SENTENSE;
-					bos->tag_id = BEGIN_OF_POS;
-					words.push_back(bos);
-				}
-				for(auto &word_str: word_strs){
-					if(word_str.size() == 0){
-						continue;
-					}
-					Word* word = new Word();
-					word->word_id = string_to_word_id(word_str);
-					word->tag_id = 0;
-					words.push_back(word);
-					_types_of_words.insert(word->word_id);
-				}
-				Word* eos = new Word();
-				eos->word_id = END_OF_SENTENSE;
-				eos->tag_id = END_OF_POS;
-				words.push_back(eos);
-				// 単語数を記録しておく
-				if(words.size() > _max_num_words_in_sentence){
-					_max_num_words_in_sentence = words.size();
-				}
-				// 訓練データかテストデータどちらに含めるかを決める
-				double bernoulli = Sampler::uniform(0, 1);
-				if(bernoulli < split_probability){
-					_test_dataset.push_back(words);
-				}else{
-					_train_dataset.push_back(words);
-				}
-			}
-		}
+		CorpusLoader::load(filename, [this](const wstring &word){
+			return _vocabulary.add(word);
+		}, [this, split_probability](const vector<int> &word_ids){
+			add_word_ids(word_ids, split_probability);
+			return true;
+		});
 		c_printf("[*]%s\n", (boost::format("%sを読み込みました.") % filename.c_str()).str().c_str());
 		c_printf("[*]%s\n", (boost::format("訓練データ: %d行, テストデータ: %d行, 単語数: %d") % (_train_dataset.size() - prev_train_dataset_size) % (_test_dataset.size() - prev_test_dataset_size) % _types_of_words.size()).str().c_str());
 	}
+	// 辞書に登録済みの単語IDの列を1文として訓練データかテストデータに追加
+	void add_word_ids(const vector<int> &word_ids, double split_probability){
+		if(word_ids.size() == 0){
+			return;
+		}
+		// 訓練データかテストデータどちらに含めるかを決める
+		double bernoulli = Sampler::uniform(0, 1);
+		Corpus &dataset = (bernoulli < split_probability) ? _test_dataset : _train_dataset;
+		int num_words = 0;
+		// <bos>
+		// 3-gramなので2つ
+		for(int n = 0;n < 2;n++){
+			dataset.add_word(BEGIN_OF_SENTENSE, BEGIN_OF_POS);
+			num_words++;
+		}
+		for(int word_id: word_ids){
+			dataset.add_word(word_id, 0);
+			num_words++;
+			_types_of_words.insert(word_id);
+		}
+		dataset.add_word(END_OF_SENTENSE, END_OF_POS);
+		num_words++;
+		dataset.end_sentence();
+		// 単語数を記録しておく
+		if(num_words > _max_num_words_in_sentence){
+			_max_num_words_in_sentence = num_words;
+		}
+	}
 	void load(string dirname){
+		ModelLock lock(_mutex);
 		// 辞書を読み込み
+		// mmapするだけなので語彙が大きくてもすぐ終わる
+		// モデルを読み込めるまでは今の辞書を置き換えない
+		Vocabulary vocabulary;
 		string dictionary_filename = dirname + "/hmm.dict";
-		std::ifstream ifs(dictionary_filename);
-		if(ifs.good()){
-			boost::archive::binary_iarchive iarchive(ifs);
-			iarchive >> _dictionary;
-			ifs.close();
+		bool has_dictionary = std::ifstream(dictionary_filename).good();
+		if(has_dictionary && vocabulary.load(dictionary_filename) == false){
+			return;
 		}
 		// モデルパラメータの読み込み
-		_pos_hpylm->load(dirname + "/pos.hpylm");
+		bool complete = _pos_hpylm->load(dirname + "/pos.hpylm");
 		for(int tag = 0;tag < _num_tags;tag++){
-			_word_hpylm_for_tag[tag]->load((boost::format("%s/word.%d.hpylm") % dirname.c_str() % tag).str());
+			complete = _word_hpylm_for_tag[tag]->load((boost::format("%s/word.%d.hpylm") % dirname.c_str() % tag).str()) && complete;
+		}
+		if(complete == false){
+			return;
+		}
+		// モデルを読み込めた時だけ辞書を置き換える
+		if(has_dictionary){
+			_vocabulary = std::move(vocabulary);
 		}
 	}
 	void save(string dirname){
+		ModelLock lock(_mutex);
 		// 辞書を保存
-		string dictionary_filename = dirname + "/hmm.dict";
-		std::ofstream ofs(dictionary_filename);
-		boost::archive::binary_oarchive oarchive(ofs);
-		oarchive << _dictionary;
-		ofs.close();
+		if(_vocabulary.save(dirname + "/hmm.dict") == false){
+			return;
+		}
 		// モデルパラメータの保存
 		_pos_hpylm->save(dirname + "/pos.hpylm");
 		for(int tag = 0;tag < _num_tags;tag++){
 			_word_hpylm_for_tag[tag]->save((boost::format("%s/word.%d.hpylm") % dirname.c_str() % tag).str());
 		}
 	}
+	// 分かち書き済みのコーパスと辞書をバイナリで保存
+	bool save_corpus(string filename){
+		ModelLock lock(_mutex);
+		CacheWriter writer;
+		writer.open("hpylm-hmm");
+		writer.write<int32_t>(_max_num_words_in_sentence);
+		writer.write_vocabulary(_vocabulary);
+		writer.write_vector(vector<int>(_types_of_words.begin(), _types_of_words.end()));
+		writer.write_corpus(_train_dataset);
+		writer.write_corpus(_test_dataset);
+		if(writer.save(filename) == false){
+			c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sに書き込めません.") % filename.c_str()).str().c_str());
+			return false;
+		}
+		return true;
+	}
+	bool load_corpus(string filename){
+		ModelLock lock(_mutex);
+		CacheReader reader;
+		if(reader.open(filename, "hpylm-hmm") == false){
+			return false;
+		}
+		int32_t max_num_words_in_sentence;
+		Vocabulary vocabulary;
+		vector<int> types_of_words;
+		Corpus train_dataset;
+		Corpus test_dataset;
+		bool complete = reader.read(max_num_words_in_sentence) && reader.read_vocabulary(vocabulary);
+		// 予約語の単語IDは変わらない
+		complete = complete && vocabulary.get_num_reserved() == _vocabulary.get_num_reserved();
+		complete = complete && reader.read_vector(types_of_words) && reader.read_corpus(train_dataset) && reader.read_corpus(test_dataset);
+		if(complete == false){
+			c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sが壊れています.") % filename.c_str()).str().c_str());
+			return false;
+		}
+		_max_num_words_in_sentence = max_num_words_in_sentence;
+		_vocabulary = std::move(vocabulary);
+		_types_of_words = set<int>(types_of_words.begin(), types_of_words.end());
+		_train_dataset = std::move(train_dataset);
+		_test_dataset = std::move(test_dataset);
+		_rand_indices.clear();
+		// 文の最大長が変わるのでラティスは作り直す
+		if(_lattice != NULL){
+			delete _lattice;
+			_lattice = NULL;
+		}
+		return true;
+	}
 	void prepare_for_training(){
 		c_printf("[*]%s\n", "学習の準備中です ...");
+		SignalChecker checker(_mutex);
 		if(_lattice == NULL){
 			_lattice = new Lattice(_max_num_words_in_sentence, _num_tags, _pos_hpylm, _word_hpylm_for_tag);
 		}
@@ -184,98 +238,151 @@ public:
 		}
 		// 各文にランダムに品詞を割り当ててモデルに追加
 		vector<int> token_ids = {0, 0, 0};
-		for(int data_index = 0;data_index < _train_dataset.size();data_index++){
-			if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
+		int num_lines = _rand_indices.size();
+		for(int data_index = 0;data_index < num_lines;data_index++){
+			if(checker.interrupted() || _train_dataset.size() < num_lines){		// ctrl+cが押されたかチェック
 				return;
 			}
-			vector<Word*> &sentence = _train_dataset[data_index];
+			Sentence sentence = _train_dataset[data_index];
 			// HPYLMを更新
 			for(int t = 2;t < sentence.size();t++){
-				sentence[t]->tag_id = Sampler::uniform_int(0, _num_tags - 1);
+				sentence.tag_id(t) = Sampler::uniform_int(0, _num_tags - 1);
 				generate_pos_token_ids(sentence, token_ids, t);
 				_pos_hpylm->add_customer_at_timestep(token_ids, 2);
 				generate_word_token_ids(sentence, token_ids, t);
-				int tag = sentence[t]->tag_id;
+				int tag = sentence.tag_id(t);
 				HPYLM* hpylm = _word_hpylm_for_tag[tag];
 				hpylm->add_customer_at_timestep(token_ids, 2);
 			}
 			// プログレスバー
-			if(data_index % 100 == 0 || data_index == _train_dataset.size() - 1){
-				show_progress(data_index, _train_dataset.size());
+			if(data_index % 100 == 0 || data_index == num_lines - 1){
+				show_progress(data_index, num_lines);
 			}
 		}
 		cout << "\r\33[2K";
 		_is_ready = true;
 	}
-	void generate_pos_token_ids(vector<Word*> &sentence, vector<int> &token_ids, int t){
-		token_ids[0] = sentence[t - 2]->tag_id;
-		token_ids[1] = sentence[t - 1]->tag_id;
-		token_ids[2] = sentence[t]->tag_id;
+	void generate_pos_token_ids(Sentence &sentence, vector<int> &token_ids, int t){
+		token_ids[0] = sentence.tag_id(t - 2);
+		token_ids[1] = sentence.tag_id(t - 1);
+		token_ids[2] = sentence.tag_id(t);
 	}
-	void generate_word_token_ids(vector<Word*> &sentence, vector<int> &token_ids, int t){
-		token_ids[0] = sentence[t - 2]->word_id;
-		token_ids[1] = sentence[t - 1]->word_id;
-		token_ids[2] = sentence[t]->word_id;
+	void generate_word_token_ids(Sentence &sentence, vector<int> &token_ids, int t){
+		token_ids[0] = sentence.word_id(t - 2);
+		token_ids[1] = sentence.word_id(t - 1);
+		token_ids[2] = sentence.word_id(t);
 	}
+	// サンプリング中はGILを手放し、Python側の別のスレッドからのメソッドの呼び出しはSignalCheckerの合間に割り込む
+	// 合間に追加された文は次のスイープから引く. コーパスを読み込み直されて文が減ったらスイープを打ち切る
 	void perform_gibbs_sampling(){
+		SignalChecker checker(_mutex);
 		assert(_is_ready);
 		assert(_rand_indices.size() == _train_dataset.size());
-		shuffle(_rand_indices.begin(), _rand_indices.end(), Sampler::mt);	// データをシャッフル
+		shuffle(_rand_indices.begin(), _rand_indices.end(), Sampler::rng);	// データをシャッフル
 		vector<int> token_ids = {0, 0, 0};
-		for(int n = 0;n < _train_dataset.size();n++){
-			if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
-				return;
+		SamplerStats* stats = _stats_enabled ? &_stats : NULL;
+		_lattice->_stats = stats;
+		if(stats != NULL){
+			stats->begin_sweep();
+		}
+		int num_lines = _rand_indices.size();
+		for(int n = 0;n < num_lines;n++){
+			if(checker.interrupted() || _train_dataset.size() < num_lines){		// ctrl+cが押されたかチェック
+				break;
 			}
 			int data_index = _rand_indices[n];
-			vector<Word*> &sentence = _train_dataset[data_index];
+			Sentence sentence = _train_dataset[data_index];
+			if(stats != NULL){
+				stats->begin_phase(STATS_PHASE_REMOVE);
+				_old_tag_ids.assign(sentence._tag_ids, sentence._tag_ids + sentence.size());
+			}
 			// 以前のサンプリング結果を削除
 			for(int t = 2;t < sentence.size();t++){
 				generate_pos_token_ids(sentence, token_ids, t);
 				_pos_hpylm->remove_customer_at_timestep(token_ids, 2);
 				generate_word_token_ids(sentence, token_ids, t);
-				int tag = sentence[t]->tag_id;
+				int tag = sentence.tag_id(t);
 				HPYLM* hpylm = _word_hpylm_for_tag[tag];
 				hpylm->remove_customer_at_timestep(token_ids, 2);
 			}
 			// 品詞をサンプリングしてセット
 			_lattice->perform_blocked_gibbs_sampling(sentence, false);	// argmax=false
+			if(stats != NULL){
+				stats->begin_phase(STATS_PHASE_ADD);
+			}
 			// HPYLMを更新
 			for(int t = 2;t < sentence.size();t++){
 				generate_pos_token_ids(sentence, token_ids, t);
 				_pos_hpylm->add_customer_at_timestep(token_ids, 2);
 				generate_word_token_ids(sentence, token_ids, t);
-				int tag = sentence[t]->tag_id;
+				int tag = sentence.tag_id(t);
 				HPYLM* hpylm = _word_hpylm_for_tag[tag];
 				hpylm->add_customer_at_timestep(token_ids, 2);
 			}
+			if(stats != NULL){
+				stats->end_phase();
+				for(int t = 2;t < sentence.size();t++){
+					stats->count_token(_old_tag_ids[t], sentence.tag_id(t));
+				}
+			}
 			// プログレスバー
-			if(n % 100 == 0 || n == _train_dataset.size() - 1){
-				show_progress(n, _train_dataset.size());
+			if(n % 100 == 0 || n == num_lines - 1){
+				show_progress(n, num_lines);
 			}
 		}
+		if(stats != NULL){
+			stats->end_sweep();
+		}
 		_is_first_run = false;
 	}
+	// 乱数のシードを決める. initialize()より前に呼べば、同じシードとスレッド数で同じ結果になる
+	// 乱数はスレッドごとに持つので、学習を呼び出すのと同じスレッドから呼ぶ
+	void set_seed(uint64_t seed){
+		Sampler::set_seed(seed);
+	}
+	uint64_t get_seed(){
+		return Sampler::get_seed();
+	}
+	void set_stats_enabled(bool enabled){
+		ModelLock lock(_mutex);
+		_stats_enabled = enabled;
+	}
+	bool get_stats_enabled(){
+		ModelLock lock(_mutex);
+		return _stats_enabled;
+	}
+	// 最後にreset_stats()を呼んでからの計測結果
+	python::dict get_stats(){
+		ModelLock lock(_mutex);
+		return dict_from_stats(_stats);
+	}
+	void reset_stats(){
+		ModelLock lock(_mutex);
+		_stats.reset();
+	}
 	// デバッグ用
 	void remove_all_customers(){
+		SignalChecker checker(_mutex);
 		assert(_is_ready);
 		vector<int> token_ids = {0, 0, 0};
 		for(int data_index = 0;data_index < _train_dataset.size();data_index++){
-			if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
+			if(checker.interrupted()){		// ctrl+cが押されたかチェック
 				return;
 			}
-			vector<Word*> &sentence = _train_dataset[data_index];
+			Sentence sentence = _train_dataset[data_index];
 			// 以前のサンプリング結果を削除
 			for(int t = 2;t < sentence.size();t++){
 				generate_pos_token_ids(sentence, token_ids, t);
 				_pos_hpylm->remove_customer_at_timestep(token_ids, 2);
 				generate_word_token_ids(sentence, token_ids, t);
-				int tag = sentence[t]->tag_id;
+				int tag = sentence.tag_id(t);
 				HPYLM* hpylm = _word_hpylm_for_tag[tag];
 				hpylm->remove_customer_at_timestep(token_ids, 2);
 			}
 		}
 	}
 	void sample_hyperparams(){
+		ModelLock lock(_mutex);
 		_pos_hpylm->sample_hyperparams();
 		for(int tag = 0;tag < _num_tags;tag++){
 			_word_hpylm_for_tag[tag]->sample_hyperparams();
@@ -288,19 +395,20 @@ public:
 		return _num_tags;
 	}
 	double compute_perplexity(){
+		ModelLock lock(_mutex);
 		double ppl = 0;
 		int num_lines = _test_dataset.size();
 		vector<int> context_token_ids = {0, 0};
 		for(int data_index = 0;data_index < num_lines;data_index++){
-			vector<Word*> &sentence = _test_dataset[data_index];
+			Sentence sentence = _test_dataset[data_index];
 			double log_Pw = 0;
 			for(int t = 2;t < sentence.size();t++){
-				context_token_ids[0] = sentence[t - 2]->word_id;
-				context_token_ids[1] = sentence[t - 1]->word_id;
+				context_token_ids[0] = sentence.word_id(t - 2);
+				context_token_ids[1] = sentence.word_id(t - 1);
 				cout << context_token_ids[0] << "," << context_token_ids[1] << endl;
-				int tag = sentence[t]->tag_id;
+				int tag = sentence.tag_id(t);
 				HPYLM* hpylm = _word_hpylm_for_tag[tag];
-				double Pw_h = hpylm->compute_Pw_h(token_id, context_token_ids);
+				double Pw_h = hpylm->compute_Pw_h(sentence.word_id(t), context_token_ids);
 				log_Pw += log2(Pw_h);
 			}
 			ppl += log_Pw / (sentence.size() - 2);
@@ -309,6 +417,7 @@ public:
 		return ppl;
 	}
 	void dump_hpylm(){
+		ModelLock lock(_mutex);
 		for(int tag = 0;tag < _num_tags;tag++){
 			HPYLM* hpylm = _word_hpylm_for_tag[tag];
 			cout << "hpylm: " << tag << endl;
@@ -317,25 +426,48 @@ public:
 		cout << "hpylm (pos)" << endl;
 		cout << "# of customers: " << _pos_hpylm->get_num_customers() << endl;
 	}
+	// input_pathの各行の品詞の最大事後確率の列を求め、"単語/品詞ID"を空白区切りで並べてoutput_pathに書き出す
+	// 辞書にない単語も登録はしない
+	// num_threadsが0以下ならコア数ぶんのスレッドを使う. 品詞ごとの単語数のリストを返す
+	python::list tag_file(string input_path, string output_path, int num_threads){
+		ModelLock lock(_mutex);
+		vector<int> tag_counts;
+		bool complete;
+		{
+			ReleaseGIL release;
+			vector<LatticeDecoder*> decoders;
+			for(int t = 0;t < FileTagger::get_num_threads(num_threads);t++){
+				decoders.push_back(new LatticeDecoder(_num_tags, _pos_hpylm, _word_hpylm_for_tag));
+			}
+			complete = FileTagger::tag(input_path, output_path, decoders, [this](const wstring &word){
+				return find_word_id(word);
+			}, tag_counts);
+			for(LatticeDecoder* decoder: decoders){
+				delete decoder;
+			}
+		}
+		if(complete == false){
+			return python::list();
+		}
+		tag_counts.resize(_num_tags, 0);
+		return list_from_vector(tag_counts);
+	}
 	void show_typical_words_for_each_tag(int number_to_show_for_each_tag){
+		ModelLock lock(_mutex);
+		TopKRanking ranking(number_to_show_for_each_tag);
 		for(int tag = 0;tag < _num_tags;tag++){
-			int n = 0;
 			wcout << L"tag " << tag << L":" << endl << L"	";
-			multiset<pair<int, int>, value_comparator> ranking;
+			ranking.clear();
 			unordered_map<int, vector<int>> &arrangement = _word_hpylm_for_tag[tag]->_root->_arrangement;
 			for(auto &elem: arrangement){
 				int token_id = elem.first;
 				vector<int> &num_customers_at_table = elem.second;
 				int count = std::accumulate(num_customers_at_table.begin(), num_customers_at_table.end(), 0);	
-				ranking.insert(std::make_pair(token_id, count));
+				ranking.push(token_id, count);
 			}
-			for(auto elem: ranking){
-				wstring word = _dictionary[elem.first];
+			for(auto elem: ranking.get_sorted()){
+				wstring word = _vocabulary.get_wstring(elem.first);
 				wcout << word << L"/" << elem.second << L", ";
-				n++;
-				if(n > number_to_show_for_each_tag){
-					break;
-				}
 				if(elem.second < 10){
 					break;
 				}
@@ -346,7 +478,7 @@ public:
 };
 
 BOOST_PYTHON_MODULE(model){
-	python::class_<PyHpylmHMM>("hpylm_hmm", python::init<int>())
+	python::class_<PyHpylmHMM, boost::noncopyable>("hpylm_hmm", python::init<int>())
 	.def("string_to_word_id", &PyHpylmHMM::string_to_word_id)
 	.def("prepare_for_training", &PyHpylmHMM::prepare_for_training)
 	.def("perform_gibbs_sampling", &PyHpylmHMM::perform_gibbs_sampling)
@@ -356,7 +488,16 @@ BOOST_PYTHON_MODULE(model){
 	.def("save", &PyHpylmHMM::save)
 	.def("get_num_tags", &PyHpylmHMM::get_num_tags)
 	.def("dump_hpylm", &PyHpylmHMM::dump_hpylm)
+	.def("tag_file", &PyHpylmHMM::tag_file)
 	.def("show_typical_words_for_each_tag", &PyHpylmHMM::show_typical_words_for_each_tag)
 	.def("remove_all_customers", &PyHpylmHMM::remove_all_customers)
-	.def("load_textfile", &PyHpylmHMM::load_textfile);
+	.def("load_textfile", &PyHpylmHMM::load_textfile)
+	.def("save_corpus", &PyHpylmHMM::save_corpus)
+	.def("load_corpus", &PyHpylmHMM::load_corpus)
+	.def("set_seed", &PyHpylmHMM::set_seed)
+	.def("get_seed", &PyHpylmHMM::get_seed)
+	.def("set_stats_enabled", &PyHpylmHMM::set_stats_enabled)
+	.def("get_stats_enabled", &PyHpylmHMM::get_stats_enabled)
+	.def("get_stats", &PyHpylmHMM::get_stats)
+	.def("reset_stats", &PyHpylmHMM::reset_stats);
 }
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "core/bench.h"
+#include "core/corpus.h"
+#include "core/ihmm.h"
+#include "core/sampler.h"
+using namespace std;
+
+#define EOS_ID 1
+
+// PyInfiniteHMMと同じく文末に<eos>を1つ置く
+void build_dataset(const BenchmarkCorpus &corpus, Corpus &dataset){
+	for(const auto &words: corpus._lines){
+		for(int word_id: words){
+			dataset.add_word(word_id, 0);
+		}
+		dataset.add_word(EOS_ID, 0);
+		dataset.end_sentence();
+	}
+}
+// 品詞数はサンプリング中に増減するので、初期値を変えて計測する
+// 1回で1文をサンプリングし、次は続きの文から始める
+void bench_beam_sampling(Benchmark &bench, const BenchmarkCorpus &corpus, int initial_num_tags){
+	Corpus dataset;
+	build_dataset(corpus, dataset);
+	Sampler::set_seed(0);
+	InfiniteHMM* hmm = new InfiniteHMM(initial_num_tags + 1);
+	hmm->initialize(dataset);
+	BenchmarkResult result("InfiniteHMM::perform_beam_sampling_with_line", "token");
+	result.add_param("corpus", corpus._name);
+	result.add_param("initial_num_tags", initial_num_tags);
+	result.add_param("mean_line_length", corpus.get_mean_line_length());
+	result.add_param("num_words", (int)corpus.get_num_words());
+	int data_index = 0;
+	BenchmarkResult &measured = bench.measure(result, [&](){
+		Sentence line = dataset[data_index];
+		hmm->perform_beam_sampling_with_line(line);
+		data_index = (data_index + 1) % dataset.size();
+		return (uint64_t)line.size();
+	});
+	// 計測を終えた時点の品詞数
+	measured.add_param("num_tags", hmm->get_num_tags());
+	delete hmm;
+}
+// usage: ./model.bench <テキストファイル> <出力するJSON> [1試行の秒数]
+int main(int argc, char** argv){
+	if(argc < 3){
+		cerr << "usage: " << argv[0] << " <textfile> <output.json> [min_seconds]" << endl;
+		return 1;
+	}
+	Benchmark bench;
+	if(argc > 3){
+		bench._min_seconds = atof(argv[3]);
+	}
+	vector<BenchmarkCorpus> corpora;
+	corpora.push_back(BenchmarkCorpus::load_textfile(argv[1], EOS_ID + 1));
+	for(int line_length: {10, 30, 100}){
+		corpora.push_back(BenchmarkCorpus::generate(30000, line_length, 5000, EOS_ID + 1));
+	}
+	for(const auto &corpus: corpora){
+		for(int initial_num_tags: {5, 10, 20}){
+			bench_beam_sampling(bench, corpus, initial_num_tags);
+		}
+	}
+	if(bench.write_json(argv[2], BENCH_REVISION) == false){
+		c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sに書き込めません.") % argv[2]).str().c_str());
+		return 1;
+	}
+	return 0;
+}
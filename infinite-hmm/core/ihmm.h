@@ -9,22 +9,21 @@
 #include <boost/format.hpp>
 #include <cassert>
 #include <cmath>
+#include <fstream>
+#include <iostream>
 #include <unordered_map>
 #include <set>
 #include <algorithm>
+#include "corpus.h"
 #include "cprintf.h"
+#include "lookup.h"
 #include "sampler.h"
-#include "util.h"
+#include "stats.h"
 using namespace std;
 
 #define BOP 0
 #define EOP 0
 
-typedef struct Word {
-	int word_id;
-	int tag_id;
-} Word;
-
 class Table{
 private:
 	friend class boost::serialization::access;
@@ -132,6 +131,10 @@ public:
 	double _gamma;
 	double _beta_emission;
 	double _gamma_emission;
+	InverseTable _inverse_alpha_beta_table;		// 1 / (n_i + beta + alpha)
+	InverseTable _inverse_gamma_table;			// 1 / (n_o + gamma)
+	InverseTable _inverse_beta_emission_table;	// 1 / (m_i + beta_e)
+	InverseTable _inverse_gamma_emission_table;	// 1 / (m_o + gamma_e)
 	int _initial_num_tags;
 	int _num_words;
 	int _sum_oracle_tags_count;
@@ -143,6 +146,8 @@ public:
 	double* _gibbs_sampling_table;
 	double* _beam_sampling_table_u;
 	double** _beam_sampling_table_s;
+	SamplerStats* _stats;	// 計測しないならNULL
+	vector<int> _old_tags;	// 計測用
 	InfiniteHMM(int initial_num_tags){
 		_alpha = 0.1;
 		_beta = 1;
@@ -158,11 +163,12 @@ public:
 		_gibbs_sampling_table = NULL;
 		_beam_sampling_table_u = NULL;
 		_beam_sampling_table_s = NULL;
+		_stats = NULL;
 	}
-	void initialize(vector<vector<Word*>> &dataset){
+	void initialize(Corpus &dataset){
 		// サンプリングテーブル
 		for(int data_index = 0;data_index < dataset.size();data_index++){
-			vector<Word*> &line = dataset[data_index];
+			Sentence line = dataset[data_index];
 			if(line.size() > _max_sequence_length){
 				_max_sequence_length = line.size();
 			}
@@ -181,31 +187,29 @@ public:
 		// nグラムカウントテーブル
 		init_ngram_counts(dataset);
 	}
-	void init_ngram_counts(vector<vector<Word*>> &dataset){
+	void init_ngram_counts(Corpus &dataset){
 		c_printf("[*]%s\n", "n-gramモデルを構築してます ...");
 		// 最初は品詞をランダムに割り当てる
 		set<int> word_set;
 		int num_words = 0;
 		unordered_map<int, int> tag_for_word;
 		for(int data_index = 0;data_index < dataset.size();data_index++){
-			vector<Word*> &line = dataset[data_index];
-			// Word* word = line[0];
-			// word->tag_id = BOP;
-			// word_set.insert(word->word_id);
-			// increment_tag_word_count(line[0]);
-			// increment_tag_unigram_count(line[0]->tag_id);
+			Sentence line = dataset[data_index];
+			// line.tag_id(0) = BOP;
+			// word_set.insert(line.word_id(0));
+			// increment_tag_word_count(line.tag_id(0), line.word_id(0));
+			// increment_tag_unigram_count(line.tag_id(0));
 			
 			int ti_1 = BOP;
 			for(int pos = 0;pos < line.size();pos++){	// 2-gramなので2番目から.
-				Word* word = line[pos];
 				int ti = Sampler::uniform_int(EOP + 1, _initial_num_tags - 1);
 				increment_tag_bigram_count(ti_1, ti);
 				increment_tag_unigram_count(ti);
-				int wi = word->word_id;
+				int wi = line.word_id(pos);
 				increment_tag_word_count(ti, wi);
 				word_set.insert(wi);
 				num_words += 1;
-				word->tag_id = ti;
+				line.tag_id(pos) = ti;
 				ti_1 = ti;
 			}
 			increment_tag_bigram_count(ti_1, EOP);
@@ -273,17 +277,22 @@ public:
 		}
 	}
 	void increment_tag_bigram_count(int context_tag_id, int tag_id){
+		SamplerStats::count_hash_probe();
 		_sum_bigram_destination[context_tag_id] += 1;
 
 		Table* table = NULL;
+		SamplerStats::count_hash_probe();
 		auto itr_context = _bigram_tag_table.find(context_tag_id);
 		if(itr_context == _bigram_tag_table.end()){
+			SamplerStats::count_allocation();
 			table = new Table(tag_id);
 			_bigram_tag_table[context_tag_id][tag_id] = table;
 		}else{
 			unordered_map<int, Table*> &tables = itr_context->second;
+			SamplerStats::count_hash_probe();
 			auto itr_table = tables.find(tag_id);
 			if(itr_table == tables.end()){
+				SamplerStats::count_allocation();
 				table = new Table(tag_id);
 				tables[tag_id] = table;
 			}else{
@@ -296,21 +305,23 @@ public:
 			increment_oracle_tag_count(tag_id);
 		}
 	}
-	void increment_tag_word_count(Word* word){
-		increment_tag_word_count(word->tag_id, word->word_id);
-	}
 	void increment_tag_word_count(int tag_id, int word_id){
+		SamplerStats::count_hash_probe();
 		_sum_word_count_for_tag[tag_id] += 1;
 
 		Table* table = NULL;
+		SamplerStats::count_hash_probe();
 		auto itr_tag = _tag_word_table.find(tag_id);
 		if(itr_tag == _tag_word_table.end()){
+			SamplerStats::count_allocation();
 			table = new Table(word_id);
 			_tag_word_table[tag_id][word_id] = table;
 		}else{
 			unordered_map<int, Table*> &tables = itr_tag->second;
+			SamplerStats::count_hash_probe();
 			auto itr_table = tables.find(word_id);
 			if(itr_table == tables.end()){
+				SamplerStats::count_allocation();
 				table = new Table(word_id);
 				tables[word_id] = table;
 			}else{
@@ -324,20 +335,24 @@ public:
 		}
 	}
 	void increment_oracle_tag_count(int tag_id){
+		SamplerStats::count_hash_probe();
 		_oracle_tag_counts[tag_id] += 1;
 		_sum_oracle_tags_count += 1;
 	}
 	void increment_oracle_word_count(int word_id){
+		SamplerStats::count_hash_probe();
 		_oracle_word_counts[word_id] += 1;
 		_sum_oracle_words_count += 1;
 	}
 	void decrement_oracle_word_count(int word_id){
+		SamplerStats::count_hash_probe();
 		_oracle_word_counts[word_id] -= 1;
 		assert(_oracle_word_counts[word_id] >= 0);
 		_sum_oracle_words_count -= 1;
 		assert(_sum_oracle_words_count >= 0);
 	}
 	void decrement_oracle_tag_count(int tag_id){
+		SamplerStats::count_hash_probe();
 		auto itr = _oracle_tag_counts.find(tag_id);
 		assert(itr != _oracle_tag_counts.end());
 		itr->second -= 1;
@@ -349,6 +364,7 @@ public:
 		assert(_sum_oracle_tags_count >= 0);
 	}
 	void decrement_tag_bigram_count(int context_tag_id, int tag_id){
+		SamplerStats::count_hash_probe();
 		auto itr = _sum_bigram_destination.find(context_tag_id);
 		assert(itr != _sum_bigram_destination.end());
 		itr->second -= 1;
@@ -357,9 +373,11 @@ public:
 			_sum_bigram_destination.erase(itr);
 		}
 
+		SamplerStats::count_hash_probe();
 		auto itr_context = _bigram_tag_table.find(context_tag_id);
 		assert(itr_context != _bigram_tag_table.end());
 		unordered_map<int, Table*> &tables = itr_context->second;
+		SamplerStats::count_hash_probe();
 		auto itr_table = tables.find(tag_id);
 		assert(itr_table != tables.end());
 		Table* table = itr_table->second;
@@ -376,6 +394,7 @@ public:
 		}
 	}
 	void decrement_tag_word_count(int tag_id, int word_id){
+		SamplerStats::count_hash_probe();
 		auto itr_sum = _sum_word_count_for_tag.find(tag_id);
 		assert(itr_sum != _sum_word_count_for_tag.end());
 		itr_sum->second -= 1;
@@ -384,9 +403,11 @@ public:
 			_sum_word_count_for_tag.erase(itr_sum);
 		}
 
+		SamplerStats::count_hash_probe();
 		auto itr_tag = _tag_word_table.find(tag_id);
 		assert(itr_tag != _tag_word_table.end());
 		unordered_map<int, Table*> &tables = itr_tag->second;
+		SamplerStats::count_hash_probe();
 		auto itr_table = tables.find(word_id);
 		assert(itr_table != tables.end());
 		Table* table = itr_table->second;
@@ -403,11 +424,13 @@ public:
 		}
 	}
 	int get_bigram_tag_count(int context_tag_id, int tag_id){
+		SamplerStats::count_hash_probe();
 		auto itr_context = _bigram_tag_table.find(context_tag_id);
 		if(itr_context == _bigram_tag_table.end()){
 			return 0;
 		}
 		unordered_map<int, Table*> &tables = itr_context->second;
+		SamplerStats::count_hash_probe();
 		auto itr_table = tables.find(tag_id);
 		if(itr_table == tables.end()){
 			return 0;
@@ -416,6 +439,7 @@ public:
 		return table->_num_customers;
 	}
 	int get_oracle_count_for_tag(int tag_id){
+		SamplerStats::count_hash_probe();
 		auto itr = _oracle_tag_counts.find(tag_id);
 		if(itr == _oracle_tag_counts.end()){
 			return 0;
@@ -423,6 +447,7 @@ public:
 		return itr->second;
 	}
 	int get_oracle_count_for_word(int word_id){
+		SamplerStats::count_hash_probe();
 		auto itr = _oracle_word_counts.find(word_id);
 		if(itr == _oracle_word_counts.end()){
 			return 0;
@@ -430,11 +455,13 @@ public:
 		return itr->second;
 	}
 	int get_tag_word_count(int tag_id, int word_id){
+		SamplerStats::count_hash_probe();
 		auto itr_tag = _tag_word_table.find(tag_id);
 		if(itr_tag == _tag_word_table.end()){
 			return 0;
 		}
 		unordered_map<int, Table*> &tables = itr_tag->second;
+		SamplerStats::count_hash_probe();
 		auto itr_table = tables.find(word_id);
 		if(itr_table == tables.end()){
 			return 0;
@@ -494,54 +521,74 @@ public:
 	int sum_oracle_words_count(){
 		return _sum_oracle_words_count;
 	}
+	// 読むだけで要素を増やさないので、複数のスレッドから同時に呼べる
 	int sum_word_count_for_tag(int tag_id){
-		return _sum_word_count_for_tag[tag_id];
+		auto itr = _sum_word_count_for_tag.find(tag_id);
+		if(itr == _sum_word_count_for_tag.end()){
+			return 0;
+		}
+		return itr->second;
 	}
 	int sum_bigram_destination(int tag_id){
-		return _sum_bigram_destination[tag_id];
+		auto itr = _sum_bigram_destination.find(tag_id);
+		if(itr == _sum_bigram_destination.end()){
+			return 0;
+		}
+		return itr->second;
+	}
+	// ハイパーパラメータが変わった時だけ表が作り直される
+	void update_lookup_tables(){
+		_inverse_alpha_beta_table.update(_beta + _alpha);
+		_inverse_gamma_table.update(_gamma);
+		_inverse_beta_emission_table.update(_beta_emission);
+		_inverse_gamma_emission_table.update(_gamma_emission);
 	}
 	int sum_oracle_tags_count(){
 		return _sum_oracle_tags_count;
 	}
 	// P(s_{t+1}|s_t)
 	double compute_Ptag_context(int tag_id, int context_tag_id, int correcting_count_for_bigram = 0, int correcting_count_for_destination = 0){
-		double n_i = sum_bigram_destination(context_tag_id);
+		update_lookup_tables();
+		int n_i = sum_bigram_destination(context_tag_id);
 		double n_ij = get_bigram_tag_count(context_tag_id, tag_id);
 		double alpha = (tag_id == context_tag_id) ? _alpha : 0;
-		double empirical_p = (n_ij + alpha) / (n_i + _beta + _alpha);
-		double coeff_oracle_p = _beta / (n_i + _beta + _alpha);	// 親の分布から生成される確率. 親からtag_idが生成される確率とは別物.
-		double n_o = sum_oracle_tags_count();
+		double inv_n_i = _inverse_alpha_beta_table(n_i);
+		double empirical_p = (n_ij + alpha) * inv_n_i;
+		double coeff_oracle_p = _beta * inv_n_i;	// 親の分布から生成される確率. 親からtag_idが生成される確率とは別物.
+		int n_o = sum_oracle_tags_count();
 		double n_oj = get_oracle_count_for_tag(tag_id);
 		double T = get_num_tags();
 		double g0 = 1.0 / (T + 1.0);
-		double oracle_p = (n_oj + _gamma * g0) / (n_o + _gamma);
+		double oracle_p = (n_oj + _gamma * g0) * _inverse_gamma_table(n_o);
 		return empirical_p + coeff_oracle_p * oracle_p;
 	}
 	// P(y_t|s_t)
 	double compute_Pword_tag(int word_id, int tag_id){
-		double m_i = sum_word_count_for_tag(tag_id);
+		update_lookup_tables();
+		int m_i = sum_word_count_for_tag(tag_id);
 		double m_iq = get_tag_word_count(tag_id, word_id);
-		double empirical_p = m_iq / (m_i + _beta_emission);
-		double coeff_oracle_p = _beta_emission / (m_i + _beta_emission);	// 親の分布から生成される確率. 親からword_idが生成される確率とは別物.
-		double m_o = sum_oracle_words_count();
+		double inv_m_i = _inverse_beta_emission_table(m_i);
+		double empirical_p = m_iq * inv_m_i;
+		double coeff_oracle_p = _beta_emission * inv_m_i;	// 親の分布から生成される確率. 親からword_idが生成される確率とは別物.
+		int m_o = sum_oracle_words_count();
 		double m_oq = get_oracle_count_for_word(word_id);
 		double W = get_num_words();
 		double g0 = 1.0 / (W + 1);
 		// cout << "tag = " << tag_id <<  ", m_i = " << m_i << ", m_iq = " << m_iq << endl;
 		// cout << "m_o = " << m_o << ", m_oq = " << m_oq << endl;
-		double oracle_p = (m_oq + _gamma_emission * g0) / (m_o + _gamma_emission);
+		double oracle_p = (m_oq + _gamma_emission * g0) * _inverse_gamma_emission_table(m_o);
 		// cout << "empirical_p = " << empirical_p << ", coeff_oracle_p = " << coeff_oracle_p << ", oracle_p = " << oracle_p << endl;
 		return empirical_p + coeff_oracle_p * oracle_p;
 	}
 	double compute_gamma_distribution(double v, double a, double b){
 		return pow(b, a) / tgamma(a) * pow(v, a - 1) * exp(-b * v);
 	}
-	double compute_log_Pdata(vector<Word*> &line){
+	double compute_log_Pdata(Sentence &line){
 		double p = 0;
 		int ti_1 = BOP;
 		for(int pos = 0;pos < line.size();pos++){
-			int ti = line[pos]->tag_id;
-			int wi = line[pos]->word_id;
+			int ti = line.tag_id(pos);
+			int wi = line.word_id(pos);
 			double log_p_tag = log(compute_Ptag_context(ti, ti_1));
 			double log_p_word = log(compute_Pword_tag(wi, ti));
 			p += log_p_tag + log_p_word;
@@ -580,6 +627,9 @@ public:
 			_gibbs_sampling_table[new_tag] = p_conditional;
 		}
 		assert(sum > 0);
+		if(_stats != NULL){
+			_stats->begin_phase(STATS_PHASE_SAMPLE);
+		}
 		double normalizer = 1.0 / sum;
 		double bernoulli = Sampler::uniform(0, 1);
 		sum = 0;
@@ -608,44 +658,61 @@ public:
 		}
 		return max_tag;
 	}
-	void perform_gibbs_sampling_with_line(vector<Word*> &line){
+	void perform_gibbs_sampling_with_line(Sentence &line){
 		if(line.size() < 2){
 			return;
 		}
 		int pos = 0;
 		int ti_1 = BOP;
 		for(;pos < line.size();pos++){
-			int ti = line[pos]->tag_id;
-			int wi = line[pos]->word_id;
-			int ti1 = (pos == line.size() - 1) ? EOP : line[pos + 1]->tag_id;
+			int ti = line.tag_id(pos);
+			int wi = line.word_id(pos);
+			int ti1 = (pos == line.size() - 1) ? EOP : line.tag_id(pos + 1);
 
 			// 現在のtiをモデルから除去
+			if(_stats != NULL){
+				_stats->begin_phase(STATS_PHASE_REMOVE);
+			}
 			decrement_tag_bigram_count(ti_1, ti);
 			decrement_tag_bigram_count(ti, ti1);
 			decrement_tag_unigram_count(ti);
 			decrement_tag_word_count(ti, wi);
 			increment_tag_bigram_count(ti_1, ti1);
 			// 新しい状態をサンプリング
+			if(_stats != NULL){
+				_stats->begin_phase(STATS_PHASE_SCORE);
+			}
 			int new_tag = gibbs_sample_new_tag(ti_1, ti1, wi);
 			// モデルに追加
+			if(_stats != NULL){
+				_stats->begin_phase(STATS_PHASE_ADD);
+			}
 			increment_tag_word_count(new_tag, wi);
 			increment_tag_bigram_count(ti_1, new_tag);
 			increment_tag_bigram_count(new_tag, ti1);
 			increment_tag_unigram_count(new_tag);
 			decrement_tag_bigram_count(ti_1, ti1);
-			line[pos]->tag_id = new_tag;
+			line.tag_id(pos) = new_tag;
 			ti_1 = new_tag;
+			if(_stats != NULL){
+				_stats->end_phase();
+				_stats->count_token(ti, new_tag);
+			}
 		}
 	}
-	void perform_beam_sampling_with_line(vector<Word*> &line){
+	void perform_beam_sampling_with_line(Sentence &line){
 		if(line.size() < 1){
 			return;
 		}
+		if(_stats != NULL){
+			_stats->begin_phase(STATS_PHASE_REMOVE);
+			_old_tags.assign(line._tag_ids, line._tag_ids + line.size());
+		}
 		// 品詞をモデルから除去
 		int ti_1 = BOP;
 		for(int pos = 0;pos < line.size();pos++){
-			int ti = line[pos]->tag_id;
-			int wi = line[pos]->word_id;
+			int ti = line.tag_id(pos);
+			int wi = line.word_id(pos);
 			decrement_tag_bigram_count(ti_1, ti);
 			decrement_tag_unigram_count(ti);
 			decrement_tag_word_count(ti, wi);
@@ -672,16 +739,21 @@ public:
 
 		// cout << "starting u" << endl;
 		// uのサンプリング
+		if(_stats != NULL){
+			_stats->begin_phase(STATS_PHASE_SCORE);
+		}
+		// [0, 1)の一様乱数をまとめて作ってから遷移確率をかける
+		Sampler::fill_uniform(_beam_sampling_table_u, line.size() + 1);
 		ti_1 = BOP;
 		for(int pos = 0;pos < line.size();pos++){
-			int ti = line[pos]->tag_id;
+			int ti = line.tag_id(pos);
 			double p = compute_Ptag_context(ti, ti_1);
-			_beam_sampling_table_u[pos] = Sampler::uniform(0, p);
+			_beam_sampling_table_u[pos] *= p;
 			// cout << (boost::format("u[%d] <- %f; p = %f; %d -> %d") % pos % _beam_sampling_table_u[pos] % p % ti_1 % ti).str() << endl;
 			ti_1 = ti;
 		}
 		double p = compute_Ptag_context(EOP, ti_1);
-		_beam_sampling_table_u[line.size()] = Sampler::uniform(0, p);
+		_beam_sampling_table_u[line.size()] *= p;
 		// cout << (boost::format("u[%d] <- %f; p = %f; %d -> %d") % line.size() % _beam_sampling_table_u[line.size()] % p % ti_1 % EOP).str() << endl;
 		// sのサンプリング
 		// cout << "starting s" << endl;
@@ -689,7 +761,7 @@ public:
 		// cout << "new_tag: " << new_tag << endl;
 		//// forwardパス
 		////// pos == 1
-		int wi = line[0]->word_id;
+		int wi = line.word_id(0);
 		double ui = _beam_sampling_table_u[0];
 		for(int tag = EOP + 1;tag < _tag_unigram_count.size();tag++){
 			if(is_tag_new(tag)){
@@ -713,7 +785,7 @@ public:
 		// }
 		////// pos > 1
 		for(int pos = 1;pos < line.size();pos++){
-			int wi = line[pos]->word_id;
+			int wi = line.word_id(pos);
 			double ui = _beam_sampling_table_u[pos];
 			double sum_over_tag = 0;
 			// 新しい品詞以外
@@ -805,6 +877,9 @@ public:
 		}
 		//// backwardパス
 		// cout << "backward" << endl;
+		if(_stats != NULL){
+			_stats->begin_phase(STATS_PHASE_SAMPLE);
+		}
 		int sampled_tag = EOP;
 		for(int pos = line.size() - 1;pos >= 0;pos--){
 			double sum = 0;
@@ -859,20 +934,29 @@ public:
 			}
 			sampled_tag = (sampled_tag == -1) ? new_tag : sampled_tag;
 			// cout << "sampled: " << sampled_tag << endl;
-			line[pos]->tag_id = sampled_tag;
+			line.tag_id(pos) = sampled_tag;
 		}
 
 		// サンプリングした品詞をモデルに追加
+		if(_stats != NULL){
+			_stats->begin_phase(STATS_PHASE_ADD);
+		}
 		ti_1 = BOP;
 		for(int pos = 0;pos < line.size();pos++){
-			int ti = line[pos]->tag_id;
+			int ti = line.tag_id(pos);
 			increment_tag_bigram_count(ti_1, ti);
-			int wi = line[pos]->word_id;
+			int wi = line.word_id(pos);
 			increment_tag_unigram_count(ti);
 			increment_tag_word_count(ti, wi);
 			ti_1 = ti;
 		}
 		increment_tag_bigram_count(ti_1, EOP);
+		if(_stats != NULL){
+			_stats->end_phase();
+			for(int pos = 0;pos < line.size();pos++){
+				_stats->count_token(_old_tags[pos], line.tag_id(pos));
+			}
+		}
 		// exit(0);
 		// exit(0);
 	}
@@ -1018,4 +1102,24 @@ public:
 
 };
 
+// 左から順に、直前の品詞と今の単語から最も確率の高い品詞を選ぶ
+// モデルは読むだけなので、スレッドごとに1つ作れば同時に使える
+class GreedyDecoder{
+public:
+	InfiniteHMM* _hmm;
+	GreedyDecoder(InfiniteHMM* hmm){
+		_hmm = hmm;
+		// 表の作り直しが各スレッドで起きないよう先に済ませておく
+		hmm->update_lookup_tables();
+	}
+	void decode(const vector<int> &word_ids, vector<int> &tags){
+		tags.resize(word_ids.size());
+		int context_tag_id = BOP;
+		for(int i = 0;i < word_ids.size();i++){
+			tags[i] = _hmm->argmax_Ptag_context_word(context_tag_id, word_ids[i]);
+			context_tag_id = tags[i];
+		}
+	}
+};
+
 #endif
\ No newline at end of file
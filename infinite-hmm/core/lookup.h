@@ -0,0 +1,58 @@
+#ifndef _lookup_
+#define _lookup_
+#include <cmath>
+#include <vector>
+using namespace std;
+
+// 小さいカウントの範囲を表引きする既定の大きさ
+// 4096要素のdoubleで32KBなので数個並べてもL2に収まる
+#define COUNT_LOOKUP_TABLE_SIZE 4096
+
+struct LogFunction{
+	static inline double compute(double x){
+		return std::log(x);
+	}
+};
+struct InverseFunction{
+	static inline double compute(double x){
+		return 1.0 / x;
+	}
+};
+
+// 整数のカウントnとハイパーパラメータaについてf(n + a)を表引きする
+// aが変わった時だけ作り直し、表の範囲外のnはその場で計算する
+template <class Function>
+class CountLookupTable{
+public:
+	double _a;
+	int _size;
+	bool _is_ready;
+	vector<double> _values;
+	CountLookupTable(int size = COUNT_LOOKUP_TABLE_SIZE){
+		_a = 0;
+		_size = size;
+		_is_ready = false;
+	}
+	inline void update(double a){
+		if(_is_ready && a == _a){
+			return;
+		}
+		_a = a;
+		_values.resize(_size);
+		for(int n = 0;n < _size;n++){
+			_values[n] = Function::compute(n + a);
+		}
+		_is_ready = true;
+	}
+	inline double operator()(int n) const {
+		if(n < _size){
+			return _values[n];
+		}
+		return Function::compute(n + _a);
+	}
+};
+
+typedef CountLookupTable<LogFunction> LogTable;
+typedef CountLookupTable<InverseFunction> InverseTable;
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef _ranking_
+#define _ranking_
+#include <algorithm>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// (ID, 回数)の組を流し込み、回数の多い上位k個だけを残す
+// 大きさkのヒープで持つので、n個を流し込んでもO(n log k)で全体を並べ替えない
+// 回数が同じならIDの小さい方を上位とする
+class TopKRanking{
+public:
+	int _k;
+	vector<pair<int, int>> _heap;	// 先頭が残っている中で最も下位
+	TopKRanking(int k){
+		_k = std::max(0, k);
+	}
+	// aがbより上位ならtrue
+	static bool is_higher(const pair<int, int> &a, const pair<int, int> &b){
+		if(a.second != b.second){
+			return a.second > b.second;
+		}
+		return a.first < b.first;
+	}
+	void push(int id, int count){
+		if(_k == 0){
+			return;
+		}
+		pair<int, int> elem(id, count);
+		if(_heap.size() < _k){
+			_heap.push_back(elem);
+			std::push_heap(_heap.begin(), _heap.end(), is_higher);
+			return;
+		}
+		if(is_higher(elem, _heap.front()) == false){
+			return;
+		}
+		std::pop_heap(_heap.begin(), _heap.end(), is_higher);
+		_heap.back() = elem;
+		std::push_heap(_heap.begin(), _heap.end(), is_higher);
+	}
+	// 上位から順に並べて返す
+	vector<pair<int, int>> get_sorted(){
+		vector<pair<int, int>> result(_heap);
+		std::sort(result.begin(), result.end(), is_higher);
+		return result;
+	}
+	void clear(){
+		_heap.clear();
+	}
+};
+
+#endif
@@ -1,8 +1,13 @@
 #ifndef _util_
 #define _util_
 #include <boost/python.hpp>
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
 #include <vector>
 #include <iostream>
+#include "stats.h"
 using namespace std;
 using namespace boost;
 
@@ -26,6 +31,206 @@ python::dict dict_from_map(unordered_map<T1,T2> &map_){
 	 }
 	 return py_dict;  
 }
+python::dict dict_from_stats(const SamplerStats &stats){
+	python::dict py_dict;
+	py_dict["tokens"] = stats._num_tokens;
+	py_dict["sweeps"] = stats._num_sweeps;
+	py_dict["seconds"] = stats._elapsed_seconds;
+	py_dict["tokens_per_sec"] = (stats._elapsed_seconds > 0) ? stats._num_tokens / stats._elapsed_seconds : 0.0;
+	py_dict["remove_seconds"] = stats._phase_seconds[STATS_PHASE_REMOVE];
+	py_dict["score_seconds"] = stats._phase_seconds[STATS_PHASE_SCORE];
+	py_dict["sample_seconds"] = stats._phase_seconds[STATS_PHASE_SAMPLE];
+	py_dict["add_seconds"] = stats._phase_seconds[STATS_PHASE_ADD];
+	py_dict["tag_changes"] = stats._num_tag_changes;
+	py_dict["hash_probes"] = stats._num_hash_probes;
+	py_dict["hash_probes_per_token"] = (stats._num_tokens > 0) ? stats._num_hash_probes / (double)stats._num_tokens : 0.0;
+	py_dict["allocations"] = stats._num_allocations;
+	return py_dict;
+}
+// サンプリング中はGILを手放しておき、一定の文数か時間ごとに取り直してctrl+cをチェックする
+// その間もPython側の別のスレッドが動ける
+// モデルの排他ロックも持ち、チェックのたびに一旦手放すので、別のスレッドからのモデルへのアクセスはそこに割り込む
+class SignalChecker{
+public:
+	PyThreadState* _thread_state;
+	std::mutex &_mutex;
+	int _interval_lines;
+	double _interval_seconds;
+	int _num_lines;
+	chrono::steady_clock::time_point _last_check;
+	SignalChecker(std::mutex &mutex, int interval_lines = 1000, double interval_seconds = 0.05): _mutex(mutex){
+		_interval_lines = interval_lines;
+		_interval_seconds = interval_seconds;
+		_num_lines = 0;
+		_last_check = chrono::steady_clock::now();
+		_thread_state = PyEval_SaveThread();
+		_mutex.lock();
+	}
+	~SignalChecker(){
+		_mutex.unlock();
+		PyEval_RestoreThread(_thread_state);
+	}
+	// 1文ごとに呼ぶ. ctrl+cが押されていたらtrue
+	bool interrupted(){
+		_num_lines += 1;
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		if(_num_lines < _interval_lines && chrono::duration<double>(now - _last_check).count() < _interval_seconds){
+			return false;
+		}
+		_num_lines = 0;
+		_mutex.unlock();
+		PyEval_RestoreThread(_thread_state);
+		bool interrupted = PyErr_CheckSignals() != 0;
+		_thread_state = PyEval_SaveThread();
+		_mutex.lock();
+		_last_check = chrono::steady_clock::now();
+		return interrupted;
+	}
+};
+// サンプリングと並行して呼ばれうるメソッドでモデルに触る前に取る
+// 待つ間はGILを手放すので、ロックを持ったままGILを待っているサンプリング側と互いに待ち続けることはない
+class ModelLock{
+public:
+	std::mutex &_mutex;
+	ModelLock(std::mutex &mutex): _mutex(mutex){
+		if(_mutex.try_lock()){
+			return;
+		}
+		PyThreadState* thread_state = PyEval_SaveThread();
+		_mutex.lock();
+		PyEval_RestoreThread(thread_state);
+	}
+	~ModelLock(){
+		_mutex.unlock();
+	}
+};
+// スコープの間GILを手放す. その間はPythonのオブジェクトに触れてはいけない
+class ReleaseGIL{
+public:
+	PyThreadState* _thread_state;
+	ReleaseGIL(){
+		_thread_state = PyEval_SaveThread();
+	}
+	~ReleaseGIL(){
+		PyEval_RestoreThread(_thread_state);
+	}
+};
+// モデルのテーブルをコピーせずにPythonのバッファプロトコルで見せる
+// memoryviewやnumpy.asarray()で作った配列が生きている間はモデル(_owner)を参照し続ける
+// _num_exportsが0でない間、モデルはテーブルを確保し直してはいけない
+// _ownedがtrueなら_dataはこのオブジェクトのもので、解放時に一緒にfreeする
+struct TableBuffer{
+	PyObject_HEAD
+	PyObject* _owner;
+	void* _data;
+	bool _owned;
+	const char* _format;
+	Py_ssize_t _itemsize;
+	int _ndim;
+	Py_ssize_t _shape[3];
+	Py_ssize_t _strides[3];
+	int* _num_exports;
+};
+int table_buffer_getbuffer(PyObject* self, Py_buffer* view, int flags){
+	TableBuffer* buffer = (TableBuffer*)self;
+	if((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE){
+		PyErr_SetString(PyExc_BufferError, "model tables are read-only");
+		view->obj = NULL;
+		return -1;
+	}
+	Py_ssize_t length = buffer->_itemsize;
+	for(int i = 0;i < buffer->_ndim;i++){
+		length *= buffer->_shape[i];
+	}
+	bool with_shape = (flags & PyBUF_ND) == PyBUF_ND;
+	view->buf = buffer->_data;
+	view->obj = self;
+	Py_INCREF(self);
+	view->len = length;
+	view->readonly = 1;
+	view->itemsize = buffer->_itemsize;
+	view->format = ((flags & PyBUF_FORMAT) == PyBUF_FORMAT) ? (char*)buffer->_format : NULL;
+	view->ndim = with_shape ? buffer->_ndim : 1;
+	view->shape = with_shape ? buffer->_shape : NULL;
+	view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? buffer->_strides : NULL;
+	view->suboffsets = NULL;
+	view->internal = NULL;
+	if(buffer->_num_exports != NULL){
+		*buffer->_num_exports += 1;
+	}
+	return 0;
+}
+void table_buffer_releasebuffer(PyObject* self, Py_buffer* view){
+	static_cast<void>(view);
+	TableBuffer* buffer = (TableBuffer*)self;
+	if(buffer->_num_exports != NULL){
+		*buffer->_num_exports -= 1;
+	}
+}
+void table_buffer_dealloc(PyObject* self){
+	TableBuffer* buffer = (TableBuffer*)self;
+	Py_XDECREF(buffer->_owner);
+	if(buffer->_owned){
+		free(buffer->_data);
+	}
+	Py_TYPE(self)->tp_free(self);
+}
+PyTypeObject* table_buffer_type(){
+	// Python 2ではPyBufferProcsの先頭に古いバッファプロトコルの関数があるので、名前で設定する
+	static PyBufferProcs buffer_procs;
+	static PyTypeObject type = {PyVarObject_HEAD_INIT(NULL, 0) "TableBuffer"};
+	if(type.tp_basicsize == 0){
+		buffer_procs.bf_getbuffer = table_buffer_getbuffer;
+		buffer_procs.bf_releasebuffer = table_buffer_releasebuffer;
+		type.tp_basicsize = sizeof(TableBuffer);
+#if PY_MAJOR_VERSION < 3
+		type.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER;
+#else
+		type.tp_flags = Py_TPFLAGS_DEFAULT;
+#endif
+		type.tp_dealloc = table_buffer_dealloc;
+		type.tp_as_buffer = &buffer_procs;
+		type.tp_doc = "read-only view of a model table";
+		if(PyType_Ready(&type) < 0){
+			python::throw_error_already_set();
+		}
+	}
+	return &type;
+}
+template<class T> const char* table_buffer_format();
+template<> const char* table_buffer_format<int>(){
+	return "i";
+}
+template<> const char* table_buffer_format<double>(){
+	return "d";
+}
+// dataを形shapeのC順の読み取り専用memoryviewとして返す
+// ownerがNULLでなければdataはownerのもの. NULLならdataはmallocで確保したもので、memoryviewに引き渡す
+template<class T>
+python::object table_view(T* data, const vector<Py_ssize_t> &shape, PyObject* owner, int* num_exports){
+	assert(shape.size() > 0 && shape.size() <= 3);
+	TableBuffer* buffer = PyObject_New(TableBuffer, table_buffer_type());
+	if(buffer == NULL){
+		python::throw_error_already_set();
+	}
+	Py_XINCREF(owner);
+	buffer->_owner = owner;
+	buffer->_data = data;
+	buffer->_owned = (owner == NULL);
+	buffer->_format = table_buffer_format<T>();
+	buffer->_itemsize = sizeof(T);
+	buffer->_ndim = shape.size();
+	buffer->_num_exports = num_exports;
+	Py_ssize_t stride = sizeof(T);
+	for(int i = buffer->_ndim - 1;i >= 0;i--){
+		buffer->_shape[i] = shape[i];
+		buffer->_strides[i] = stride;
+		stride *= shape[i];
+	}
+	PyObject* view = PyMemoryView_FromObject((PyObject*)buffer);
+	Py_DECREF(buffer);
+	return python::object(python::handle<>(view));
+}
 double factorial(double n) {
 	if (n == 0){
 		return 1;
@@ -0,0 +1,285 @@
+#ifndef _vocabulary_
+#define _vocabulary_
+#include <boost/format.hpp>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include "cprintf.h"
+#include "loader.h"
+using namespace std;
+
+// 語彙ファイル
+// ヘッダの後に単語IDから文字列の位置への表, 逆引きのハッシュ表, 文字列を並べた領域をそのまま置くので、
+// mmapするだけで読み込める
+// 数値はそのままのバイト列で書くので、同じアーキテクチャでしか読めない
+#define VOCABULARY_MAGIC "UPOSVOCB"
+#define VOCABULARY_VERSION 1
+
+struct VocabularyHeader{
+	char magic[8];
+	uint32_t version;
+	uint32_t num_reserved;
+	uint64_t num_words;
+	uint64_t capacity;		// ハッシュ表の大きさ
+	uint64_t arena_size;
+};
+
+// 単語の文字列と単語IDの対応
+// 全ての単語をUTF-8で1つの領域に詰めて並べ、単語IDからはその位置の表で、文字列からは開番地法のハッシュ表で引く
+// 単語ごとのwstringやハッシュのノードを持たないので、unordered_mapを2つ持つより小さい
+// 先頭の_num_reserved個は<bos>などの予約語で、文字列からは引けない
+// load()した語彙はmmapした領域をそのまま読み、単語を追加する時に初めて自前の領域に複製する
+class Vocabulary{
+public:
+	int _num_reserved;
+	vector<uint64_t> _offsets;	// i番目の単語は_arenaの[_offsets[i], _offsets[i + 1])
+	vector<int32_t> _slots;		// 単語ID. 空きは-1
+	vector<char> _arena;
+	unique_ptr<MappedFile> _file;	// load()で読み込んだ時だけ
+	// 読む時はこちらを使う. 自前の領域かmmapした領域を指す
+	size_t _num_words;
+	size_t _capacity;
+	const uint64_t* _offsets_view;
+	const int32_t* _slots_view;
+	const char* _arena_view;
+	Vocabulary(){
+		clear();
+	}
+	void clear(){
+		_file.reset();
+		_num_reserved = 0;
+		_offsets.assign(1, 0);
+		_slots.assign(16, -1);
+		_arena.clear();
+		bind_owned();
+	}
+	void bind_owned(){
+		_num_words = _offsets.size() - 1;
+		_capacity = _slots.size();
+		_offsets_view = _offsets.data();
+		_slots_view = _slots.data();
+		_arena_view = _arena.data();
+	}
+	// mmapした領域を自前の領域に複製する
+	void detach(){
+		if(_file == NULL){
+			return;
+		}
+		_offsets.assign(_offsets_view, _offsets_view + _num_words + 1);
+		_slots.assign(_slots_view, _slots_view + _capacity);
+		_arena.assign(_arena_view, _arena_view + _offsets_view[_num_words]);
+		_file.reset();
+		bind_owned();
+	}
+	// FNV-1a
+	static inline uint64_t hash(const char* data, size_t size){
+		uint64_t h = 0xCBF29CE484222325ULL;
+		for(size_t i = 0;i < size;i++){
+			h ^= (unsigned char)data[i];
+			h *= 0x100000001B3ULL;
+		}
+		return h;
+	}
+	inline size_t size() const {
+		return _num_words;
+	}
+	inline int get_num_reserved() const {
+		return _num_reserved;
+	}
+	// 予約語を除いた単語数
+	inline size_t get_num_searchable() const {
+		return _num_words - _num_reserved;
+	}
+	inline const char* word_data(int word_id) const {
+		return _arena_view + _offsets_view[word_id];
+	}
+	inline size_t word_size(int word_id) const {
+		return _offsets_view[word_id + 1] - _offsets_view[word_id];
+	}
+	wstring get_wstring(int word_id) const {
+		assert(0 <= word_id && word_id < _num_words);
+		return utf8_to_wstring(word_data(word_id), word_data(word_id) + word_size(word_id));
+	}
+	// 見つからなければ-1
+	int find(const char* data, size_t size) const {
+		size_t mask = _capacity - 1;
+		for(size_t slot = hash(data, size) & mask;;slot = (slot + 1) & mask){
+			int32_t word_id = _slots_view[slot];
+			if(word_id == -1){
+				return -1;
+			}
+			if(word_size(word_id) == size && memcmp(word_data(word_id), data, size) == 0){
+				return word_id;
+			}
+		}
+	}
+	int find(const wstring &word) const {
+		string bytes = wstring_to_utf8(word);
+		return find(bytes.data(), bytes.size());
+	}
+	// 予約語は文字列から引けないので、同じ文字列をadd()すると別の単語IDになる
+	int add_reserved(const wstring &word){
+		assert(_num_reserved == _num_words);
+		detach();
+		string bytes = wstring_to_utf8(word);
+		append(bytes.data(), bytes.size());
+		_num_reserved++;
+		return _num_words - 1;
+	}
+	// 登録済みならその単語IDを返す
+	int add(const wstring &word){
+		string bytes = wstring_to_utf8(word);
+		int word_id = find(bytes.data(), bytes.size());
+		if(word_id != -1){
+			return word_id;
+		}
+		detach();
+		word_id = append(bytes.data(), bytes.size());
+		if((_num_words - _num_reserved) * 2 > _capacity){
+			rehash(_capacity * 2);
+		}else{
+			insert(word_id);
+		}
+		return word_id;
+	}
+	int append(const char* data, size_t size){
+		_arena.insert(_arena.end(), data, data + size);
+		_offsets.push_back(_arena.size());
+		bind_owned();
+		return _num_words - 1;
+	}
+	void insert(int word_id){
+		size_t mask = _capacity - 1;
+		size_t slot = hash(word_data(word_id), word_size(word_id)) & mask;
+		while(_slots[slot] != -1){
+			slot = (slot + 1) & mask;
+		}
+		_slots[slot] = word_id;
+	}
+	// 予約語以外の全ての単語をハッシュ表に入れ直す. capacityは2の累乗
+	void rehash(size_t capacity){
+		_slots.assign(capacity, -1);
+		bind_owned();
+		for(int word_id = _num_reserved;word_id < _num_words;word_id++){
+			insert(word_id);
+		}
+	}
+	// 単語の位置の表と文字列の領域から作り直す. ハッシュ表は作り直すので保存しなくてよい
+	bool assign(int num_reserved, vector<uint64_t> &offsets, vector<char> &arena){
+		if(is_valid_offsets(offsets.data(), offsets.size(), arena.size()) == false || num_reserved < 0 || num_reserved > offsets.size() - 1){
+			return false;
+		}
+		_file.reset();
+		_num_reserved = num_reserved;
+		_offsets.swap(offsets);
+		_arena.swap(arena);
+		size_t capacity = 16;
+		while((_offsets.size() - 1 - _num_reserved) * 2 > capacity){
+			capacity *= 2;
+		}
+		rehash(capacity);
+		return true;
+	}
+	static bool is_valid_offsets(const uint64_t* offsets, size_t size, uint64_t arena_size){
+		if(size == 0 || offsets[0] != 0 || offsets[size - 1] != arena_size){
+			return false;
+		}
+		for(size_t i = 1;i < size;i++){
+			if(offsets[i] < offsets[i - 1]){
+				return false;
+			}
+		}
+		return true;
+	}
+	// 一時ファイルに書いてから名前を変える
+	bool save(const string &filename){
+		VocabularyHeader header;
+		memcpy(header.magic, VOCABULARY_MAGIC, 8);
+		header.version = VOCABULARY_VERSION;
+		header.num_reserved = _num_reserved;
+		header.num_words = _num_words;
+		header.capacity = _capacity;
+		header.arena_size = _offsets_view[_num_words];
+		string tmp_filename = filename + ".tmp";
+		ofstream ofs(tmp_filename, ios::binary);
+		if(ofs.good() == false){
+			c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sに書き込めません.") % filename.c_str()).str().c_str());
+			return false;
+		}
+		ofs.write((const char*)&header, sizeof(header));
+		ofs.write((const char*)_offsets_view, (_num_words + 1) * sizeof(uint64_t));
+		ofs.write((const char*)_slots_view, _capacity * sizeof(int32_t));
+		ofs.write(_arena_view, header.arena_size);
+		ofs.close();
+		if(ofs.fail() || rename(tmp_filename.c_str(), filename.c_str()) != 0){
+			c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sに書き込めません.") % filename.c_str()).str().c_str());
+			return false;
+		}
+		return true;
+	}
+	// ファイルをmmapして読み込む. 失敗したら何も変えない
+	bool load(const string &filename){
+		unique_ptr<MappedFile> file(new MappedFile());
+		if(file->open(filename) == false){
+			return false;
+		}
+		VocabularyHeader header;
+		if(file->_size < sizeof(header) || memcmp(file->_data, VOCABULARY_MAGIC, 8) != 0){
+			c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sは語彙ファイルではありません.") % filename.c_str()).str().c_str());
+			return false;
+		}
+		memcpy(&header, file->_data, sizeof(header));
+		if(header.version != VOCABULARY_VERSION){
+			c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sはバージョンが異なります.") % filename.c_str()).str().c_str());
+			return false;
+		}
+		// 各領域の大きさがファイルの大きさと合っているか確認
+		size_t available = (file->_size - sizeof(header)) / sizeof(uint64_t);
+		bool valid = header.num_words < available && header.num_words < INT32_MAX && header.num_reserved <= header.num_words;
+		valid = valid && header.capacity > 0 && (header.capacity & (header.capacity - 1)) == 0 && (header.num_words - header.num_reserved) < header.capacity;
+		const uint64_t* offsets = NULL;
+		const int32_t* slots = NULL;
+		if(valid){
+			offsets = (const uint64_t*)(file->_data + sizeof(header));
+			slots = (const int32_t*)(offsets + header.num_words + 1);
+			size_t remaining = file->_size - sizeof(header) - (header.num_words + 1) * sizeof(uint64_t);
+			valid = header.capacity <= remaining / sizeof(int32_t) && header.arena_size == remaining - header.capacity * sizeof(int32_t);
+		}
+		valid = valid && is_valid_offsets(offsets, header.num_words + 1, header.arena_size);
+		// 空きが1つもないと見つからない単語を引いた時に止まらない
+		size_t num_filled = 0;
+		for(size_t slot = 0;valid && slot < header.capacity;slot++){
+			if(slots[slot] == -1){
+				continue;
+			}
+			valid = slots[slot] >= (int32_t)header.num_reserved && slots[slot] < (int32_t)header.num_words;
+			num_filled++;
+		}
+		valid = valid && num_filled < header.capacity;
+		if(valid == false){
+			c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sが壊れています.") % filename.c_str()).str().c_str());
+			return false;
+		}
+		// 引く時はランダムアクセスになる
+		madvise((void*)file->_data, file->_size, MADV_RANDOM);
+		_num_reserved = header.num_reserved;
+		_num_words = header.num_words;
+		_capacity = header.capacity;
+		_offsets_view = offsets;
+		_slots_view = slots;
+		_arena_view = (const char*)(slots + header.capacity);
+		_offsets.clear();
+		_slots.clear();
+		_arena.clear();
+		_file = std::move(file);
+		return true;
+	}
+};
+
+#endif
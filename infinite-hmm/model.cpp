@@ -11,32 +11,32 @@
 #include <unordered_map>
 #include <functional>
 #include <fstream>
+#include <mutex>
 #include <cassert>
+#include "core/cache.h"
 #include "core/ihmm.h"
+#include "core/loader.h"
+#include "core/ranking.h"
+#include "core/tagger.h"
 #include "core/util.h"
+#include "core/vocabulary.h"
 using namespace std;
 using namespace boost;
 
-struct value_comparator {
-	bool operator()(const pair<int, int> &a, const pair<int, int> &b) {
-		return a.second > b.second;
-	}   
-};
-
 class PyInfiniteHMM{
 private:
-	unordered_map<int, wstring> _dictionary;
-	unordered_map<wstring, int> _dictionary_inv;
+	Vocabulary _vocabulary;
 	unordered_map<int, int> _word_count;
-	vector<vector<Word*>> _dataset;
+	Corpus _dataset;
 	vector<int> _rand_indices;
-	int _autoincrement;
 	int _bos_id;
 	int _eos_id;
 	int _unk_id;
 	int _max_num_words_in_line;
 	int _min_num_words_in_line;
 	double _minimum_temperature;
+	SamplerStats _stats;	// 計測が有効なら_hmm->_statsがこれを指す
+	std::mutex _mutex;		// サンプリング中はGILの代わりにこれでモデルを守る
 public:
 	InfiniteHMM* _hmm;
 	PyInfiniteHMM(int initial_num_tags){
@@ -51,92 +51,88 @@ public:
 		wcin.imbue(ctype_default);
 
 		_hmm = new InfiniteHMM(initial_num_tags + 1);
-		_bos_id = 0;
-		_dictionary[_bos_id] = L"<bos>";
-		_eos_id = 1;
-		_dictionary[_eos_id] = L"<eos>";
-		_unk_id = 2;
-		_dictionary[_unk_id] = L"<unk>";
-		_autoincrement = _unk_id + 1;
+		_bos_id = _vocabulary.add_reserved(L"<bos>");
+		_eos_id = _vocabulary.add_reserved(L"<eos>");
+		_unk_id = _vocabulary.add_reserved(L"<unk>");
 
 		_max_num_words_in_line = -1;
 		_min_num_words_in_line = -1;
 
 		_minimum_temperature = 0.08;
 	}
+	// コーパスや辞書を読み書きするメソッドはサンプリングと並行して呼ばれうるのでロックを取る
+	// 中から呼ぶ下請けのメソッド(find_word_id, add_word_ids)は取らない
 	int add_string(wstring word){
-		auto itr = _dictionary_inv.find(word);
-		if(itr == _dictionary_inv.end()){
-			_dictionary[_autoincrement] = word;
-			_dictionary_inv[word] = _autoincrement;
-			_autoincrement++;
-			return _autoincrement - 1;
-		}
-		return itr->second;
+		ModelLock lock(_mutex);
+		return _vocabulary.add(word);
 	}
 	int string_to_word_id(wstring word){
-		auto itr = _dictionary_inv.find(word);
-		if(itr == _dictionary_inv.end()){
+		ModelLock lock(_mutex);
+		return find_word_id(word);
+	}
+	// 辞書にない単語は<unk>
+	int find_word_id(const wstring &word){
+		int word_id = _vocabulary.find(word);
+		if(word_id == -1){
 			return _unk_id;
 		}
-		return itr->second;
+		return word_id;
 	}
 	void load_textfile(string filename){
+		ModelLock lock(_mutex);
 		c_printf("[*]%s\n", (boost::format("%sを読み込んでいます ...") % filename.c_str()).str().c_str());
-		wifstream ifs(filename.c_str());
-		wstring line_str;
-		if (ifs.fail()){
-			c_printf("[R]%s [*]%s", "エラー", (boost::format("%sを開けません.") % filename.c_str()).str().c_str());
-			exit(1);
-		}
-		while (getline(ifs, line_str) && !line_str.empty()){
+		bool complete = CorpusLoader::load(filename, [this](const wstring &word){
+			return _vocabulary.add(word);
+		}, [this](const vector<int> &word_ids){
 			if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
-				return;
+				return false;
 			}
-			add_line(line_str);
+			add_word_ids(word_ids);
+			return true;
+		});
+		if(complete == false){
+			return;
 		}
 		c_printf("[*]%s\n", (boost::format("%sを読み込みました.") % filename.c_str()).str().c_str());
 	}
 	void add_line(wstring line_str){
+		ModelLock lock(_mutex);
 		vector<wstring> word_strs = split_word_by(line_str, L' ');	// スペースで分割
-		int num_words = word_strs.size();
+		vector<int> word_ids;
+		for(auto &word_str: word_strs){
+			if(word_str.size() == 0){
+				continue;
+			}
+			word_ids.push_back(_vocabulary.add(word_str));
+		}
+		add_word_ids(word_ids);
+	}
+	// 辞書に登録済みの単語IDの列を1文として追加
+	void add_word_ids(const vector<int> &word_ids){
+		int num_words = word_ids.size();
 		if(num_words > _max_num_words_in_line){
 			_max_num_words_in_line = num_words;
 		}
 		if(num_words < _max_num_words_in_line || _min_num_words_in_line == -1){
 			_min_num_words_in_line = num_words;
 		}
-		if(word_strs.size() > 0){
-			vector<Word*> words;
+		if(word_ids.size() > 0){
 			// <bos>
-			// Word* bos = new Word();
-			// bos->word_id = -1;
-			// bos->tag_id = BOP;
-			// words.push_back(bos);
+			// _dataset.add_word(-1, BOP);
 			// _word_count[_bos_id] += 1;
 
-			for(auto &word_str: word_strs){
-				if(word_str.size() == 0){
-					continue;
-				}
-				Word* word = new Word();
-				word->word_id = add_string(word_str);
-				words.push_back(word);
-				_word_count[word->word_id] += 1;
+			for(int word_id: word_ids){
+				_dataset.add_word(word_id, 0);
+				_word_count[word_id] += 1;
 			}
 
-			Word* eos = new Word();
-			eos->word_id = _eos_id;
-			words.push_back(eos);
+			_dataset.add_word(_eos_id, 0);
 			_word_count[_eos_id] += 1;
 
-			// Word* eop = new Word();
-			// eop->word_id = -1;
-			// eop->tag_id = EOP;
-			// words.push_back(eop);
+			// _dataset.add_word(-1, EOP);
 
 			// 訓練データに追加
-			_dataset.push_back(words);
+			_dataset.end_sentence();
 		}
 	}
 	int get_count_for_word(int word_id){
@@ -150,84 +146,188 @@ public:
 		return _hmm->get_num_tags();
 	}
 	void mark_low_frequency_words_as_unknown(int threshold = 1){
-		for(int data_index = 0;data_index < _dataset.size();data_index++){
-			vector<Word*> &line = _dataset[data_index];
-			for(auto word = line.begin(), end = line.end();word != end;word++){
-				int word_id = (*word)->word_id;
-				int count = get_count_for_word(word_id);
-				if(count <= threshold){
-					(*word)->word_id = _unk_id;
-				}
+		ModelLock lock(_mutex);
+		for(int &word_id: _dataset._word_ids){
+			int count = get_count_for_word(word_id);
+			if(count <= threshold){
+				word_id = _unk_id;
 			}
 		}
 	}
 	void initialize(){
+		ModelLock lock(_mutex);
 		_hmm->initialize(_dataset);
 	}
 	bool load(string dirname){
+		ModelLock lock(_mutex);
 		// 辞書を読み込み
+		// mmapするだけなので語彙が大きくてもすぐ終わる
+		// モデルを読み込めるまでは今の辞書を置き換えない
+		Vocabulary vocabulary;
 		string dictionary_filename = dirname + "/ihmm.dict";
-		std::ifstream ifs(dictionary_filename);
-		if(ifs.good()){
-			boost::archive::binary_iarchive iarchive(ifs);
-			iarchive >> _dictionary;
-			iarchive >> _dictionary_inv;
-			iarchive >> _autoincrement;
-			ifs.close();
+		bool has_dictionary = std::ifstream(dictionary_filename).good();
+		if(has_dictionary && vocabulary.load(dictionary_filename) == false){
+			return false;
 		}
-		return _hmm->load(dirname);
+		if(_hmm->load(dirname) == false){
+			return false;
+		}
+		// モデルを読み込めた時だけ辞書を置き換える
+		if(has_dictionary){
+			_vocabulary = std::move(vocabulary);
+		}
+		return true;
 	}
 	bool save(string dirname){
+		ModelLock lock(_mutex);
 		// 辞書を保存
-		std::ofstream ofs(dirname + "/ihmm.dict");
-		boost::archive::binary_oarchive oarchive(ofs);
-		oarchive << _dictionary;
-		oarchive << _dictionary_inv;
-		oarchive << _autoincrement;
-		ofs.close();
+		if(_vocabulary.save(dirname + "/ihmm.dict") == false){
+			return false;
+		}
 		return _hmm->save(dirname);
 	}
+	// 分かち書き済みのコーパスと辞書をバイナリで保存
+	bool save_corpus(string filename){
+		ModelLock lock(_mutex);
+		CacheWriter writer;
+		writer.open("infinite-hmm");
+		writer.write<int32_t>(_max_num_words_in_line);
+		writer.write<int32_t>(_min_num_words_in_line);
+		writer.write_vocabulary(_vocabulary);
+		writer.write<uint64_t>(_word_count.size());
+		for(const auto &elem: _word_count){
+			writer.write<int32_t>(elem.first);
+			writer.write<int32_t>(elem.second);
+		}
+		writer.write_corpus(_dataset);
+		if(writer.save(filename) == false){
+			c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sに書き込めません.") % filename.c_str()).str().c_str());
+			return false;
+		}
+		return true;
+	}
+	bool load_corpus(string filename){
+		ModelLock lock(_mutex);
+		CacheReader reader;
+		if(reader.open(filename, "infinite-hmm") == false){
+			return false;
+		}
+		int32_t max_num_words_in_line, min_num_words_in_line;
+		uint64_t size;
+		Vocabulary vocabulary;
+		unordered_map<int, int> word_count;
+		Corpus dataset;
+		bool complete = reader.read(max_num_words_in_line) && reader.read(min_num_words_in_line) && reader.read_vocabulary(vocabulary);
+		// 予約語の単語IDは変わらない
+		complete = complete && vocabulary.get_num_reserved() == _vocabulary.get_num_reserved();
+		complete = complete && reader.read(size);
+		for(uint64_t n = 0;complete && n < size;n++){
+			int32_t word_id = 0, count = 0;
+			complete = reader.read(word_id) && reader.read(count);
+			word_count[word_id] = count;
+		}
+		complete = complete && reader.read_corpus(dataset);
+		if(complete == false){
+			c_printf("[r]%s [*]%s\n", "エラー", (boost::format("%sが壊れています.") % filename.c_str()).str().c_str());
+			return false;
+		}
+		_max_num_words_in_line = max_num_words_in_line;
+		_min_num_words_in_line = min_num_words_in_line;
+		_vocabulary = std::move(vocabulary);
+		_word_count = std::move(word_count);
+		_dataset = std::move(dataset);
+		_rand_indices.clear();
+		return true;
+	}
 	int argmax_Ptag_context_word(int context_tag_id, int word_id){
+		ModelLock lock(_mutex);
 		return _hmm->argmax_Ptag_context_word(context_tag_id, word_id);
 	}
+	// サンプリング中はGILを手放し、Python側の別のスレッドからのメソッドの呼び出しはSignalCheckerの合間に割り込む
+	// 合間に追加された文は次のスイープから引く. コーパスを読み込み直されて文が減ったらスイープを打ち切る
 	void perform_gibbs_sampling(){
+		SignalChecker checker(_mutex);
 		if(_rand_indices.size() != _dataset.size()){
 			_rand_indices.clear();
 			for(int data_index = 0;data_index < _dataset.size();data_index++){
 				_rand_indices.push_back(data_index);
 			}
 		}
-		shuffle(_rand_indices.begin(), _rand_indices.end(), Sampler::mt);	// データをシャッフル
-		for(int n = 0;n < _dataset.size();n++){
-			if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
-				return;
+		shuffle(_rand_indices.begin(), _rand_indices.end(), Sampler::rng);	// データをシャッフル
+		begin_sweep();
+		int num_lines = _rand_indices.size();
+		for(int n = 0;n < num_lines;n++){
+			if(checker.interrupted() || _dataset.size() < num_lines){		// ctrl+cが押されたかチェック
+				break;
 			}
 			int data_index = _rand_indices[n];
-			vector<Word*> &line = _dataset[data_index];
+			Sentence line = _dataset[data_index];
 			_hmm->perform_gibbs_sampling_with_line(line);
 		}
+		end_sweep();
 	}
 	void perform_beam_sampling(){
+		SignalChecker checker(_mutex);
 		if(_rand_indices.size() != _dataset.size()){
 			_rand_indices.clear();
 			for(int data_index = 0;data_index < _dataset.size();data_index++){
 				_rand_indices.push_back(data_index);
 			}
 		}
-		shuffle(_rand_indices.begin(), _rand_indices.end(), Sampler::mt);	// データをシャッフル
-		for(int n = 0;n < _dataset.size();n++){
-			if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
-				return;
+		shuffle(_rand_indices.begin(), _rand_indices.end(), Sampler::rng);	// データをシャッフル
+		begin_sweep();
+		int num_lines = _rand_indices.size();
+		for(int n = 0;n < num_lines;n++){
+			if(checker.interrupted() || _dataset.size() < num_lines){		// ctrl+cが押されたかチェック
+				break;
 			}
 			int data_index = _rand_indices[n];
-			vector<Word*> &line = _dataset[data_index];
+			Sentence line = _dataset[data_index];
 			_hmm->perform_beam_sampling_with_line(line);
 		}
+		end_sweep();
+	}
+	void begin_sweep(){
+		if(_hmm->_stats != NULL){
+			_hmm->_stats->begin_sweep();
+		}
+	}
+	void end_sweep(){
+		if(_hmm->_stats != NULL){
+			_hmm->_stats->end_sweep();
+		}
+	}
+	// 乱数のシードを決める. initialize()より前に呼べば、同じシードとスレッド数で同じ結果になる
+	// 乱数はスレッドごとに持つので、学習を呼び出すのと同じスレッドから呼ぶ
+	void set_seed(uint64_t seed){
+		Sampler::set_seed(seed);
+	}
+	uint64_t get_seed(){
+		return Sampler::get_seed();
+	}
+	void set_stats_enabled(bool enabled){
+		ModelLock lock(_mutex);
+		_hmm->_stats = enabled ? &_stats : NULL;
+	}
+	bool get_stats_enabled(){
+		ModelLock lock(_mutex);
+		return _hmm->_stats != NULL;
+	}
+	// 最後にreset_stats()を呼んでからの計測結果
+	python::dict get_stats(){
+		ModelLock lock(_mutex);
+		return dict_from_stats(_stats);
+	}
+	void reset_stats(){
+		ModelLock lock(_mutex);
+		_stats.reset();
 	}
 	void set_temperature(double temperature){
+		ModelLock lock(_mutex);
 		_hmm->_temperature = temperature;
 	}
 	void anneal_temperature(double multiplier){
+		ModelLock lock(_mutex);
 		if(_hmm->_temperature > _minimum_temperature){
 			_hmm->_temperature *= multiplier;
 		}
@@ -235,37 +335,61 @@ public:
 	void show_temperature(){
 		c_printf("[*]%s: %lf\n", "temperature", _hmm->_temperature);
 	}
+	// input_pathの各行の品詞をargmax_Ptag_context_word()で左から順に推定し、"単語/品詞ID"を空白区切りで並べてoutput_pathに書き出す
+	// 単語はfind_word_id()で引くので、辞書にない単語は<unk>として扱う
+	// num_threadsが0以下ならコア数ぶんのスレッドを使う. 品詞IDごとの単語数のリストを返す
+	python::list tag_file(string input_path, string output_path, int num_threads){
+		ModelLock lock(_mutex);
+		vector<int> tag_counts;
+		bool complete;
+		{
+			ReleaseGIL release;
+			vector<GreedyDecoder*> decoders;
+			for(int t = 0;t < FileTagger::get_num_threads(num_threads);t++){
+				decoders.push_back(new GreedyDecoder(_hmm));
+			}
+			complete = FileTagger::tag(input_path, output_path, decoders, [this](const wstring &word){
+				return find_word_id(word);
+			}, tag_counts);
+			for(GreedyDecoder* decoder: decoders){
+				delete decoder;
+			}
+		}
+		if(complete == false){
+			return python::list();
+		}
+		// 品詞IDは使われていないものも含めて通し番号
+		tag_counts.resize(std::max(tag_counts.size(), _hmm->_tag_unigram_count.size()), 0);
+		return list_from_vector(tag_counts);
+	}
 	void show_log_Pdata(){
+		ModelLock lock(_mutex);
 		double log_p = 0;
 		for(int data_index = 0;data_index < _dataset.size();data_index++){
-			vector<Word*> &line = _dataset[data_index];
+			Sentence line = _dataset[data_index];
 			log_p += _hmm->compute_log_Pdata(line);
 		}
 		c_printf("[*]%s: %lf\n", "log_Pdata", log_p);
 	}
 	void show_typical_words_for_each_tag(int number_to_show_for_each_tag){
+		ModelLock lock(_mutex);
+		TopKRanking ranking(number_to_show_for_each_tag);
 		for(int tag = 0;tag < _hmm->_tag_unigram_count.size();tag++){
 			if(_hmm->_tag_unigram_count[tag] == 0){
 				continue;
 			}
-			unordered_map<int, Table*> &tables = _hmm->_tag_word_table[tag];
-			int n = 0;
 			c_printf("[*]%s\n", (boost::format("tag %d:") % tag).str().c_str());
 			wcout << L"\t";
-			multiset<pair<int, int>, value_comparator> ranking;
-			for(const auto &elem: tables){
-				ranking.insert(std::make_pair(elem.first, elem.second->_num_customers));
+			ranking.clear();
+			auto itr_tag = _hmm->_tag_word_table.find(tag);
+			if(itr_tag != _hmm->_tag_word_table.end()){
+				for(const auto &elem: itr_tag->second){
+					ranking.push(elem.first, elem.second->_num_customers);
+				}
 			}
-			for(const auto &elem: ranking){
-				wstring word = _dictionary[elem.first];
+			for(const auto &elem: ranking.get_sorted()){
+				wstring word = _vocabulary.get_wstring(elem.first);
 				wcout << word << L"/" << elem.second << L", ";
-				n++;
-				if(n > number_to_show_for_each_tag){
-					break;
-				}
-				// if(elem.second < 10){
-				// 	break;
-				// }
 			}
 			wcout << endl;
 		}
@@ -273,7 +397,7 @@ public:
 };
 
 BOOST_PYTHON_MODULE(model){
-	python::class_<PyInfiniteHMM>("ihmm", python::init<int>())
+	python::class_<PyInfiniteHMM, boost::noncopyable>("ihmm", python::init<int>())
 	.def("string_to_word_id", &PyInfiniteHMM::string_to_word_id)
 	.def("add_string", &PyInfiniteHMM::add_string)
 	.def("perform_gibbs_sampling", &PyInfiniteHMM::perform_gibbs_sampling)
@@ -289,6 +413,15 @@ BOOST_PYTHON_MODULE(model){
 	.def("show_log_Pdata", &PyInfiniteHMM::show_log_Pdata)
 	.def("show_temperature", &PyInfiniteHMM::show_temperature)
 	.def("argmax_Ptag_context_word", &PyInfiniteHMM::argmax_Ptag_context_word)
+	.def("tag_file", &PyInfiniteHMM::tag_file)
 	.def("get_num_tags", &PyInfiniteHMM::get_num_tags)
-	.def("load_textfile", &PyInfiniteHMM::load_textfile);
+	.def("load_textfile", &PyInfiniteHMM::load_textfile)
+	.def("save_corpus", &PyInfiniteHMM::save_corpus)
+	.def("load_corpus", &PyInfiniteHMM::load_corpus)
+	.def("set_seed", &PyInfiniteHMM::set_seed)
+	.def("get_seed", &PyInfiniteHMM::get_seed)
+	.def("set_stats_enabled", &PyInfiniteHMM::set_stats_enabled)
+	.def("get_stats_enabled", &PyInfiniteHMM::get_stats_enabled)
+	.def("get_stats", &PyInfiniteHMM::get_stats)
+	.def("reset_stats", &PyInfiniteHMM::reset_stats);
 }
\ No newline at end of file